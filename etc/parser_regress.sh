@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Replay damaged Host/USB byte streams through the frame parser and check
+# that every valid frame around the damage is still decoded. Build the
+# tool with -fsanitize=address to also catch memory errors.
+#
+# Usage: parser_regress.sh [path to ads1292r_evm]
+#
+CAPTURE=${1:-../evm/ads1292r_evm}
+TMP=`mktemp -d`
+trap "rm -rf $TMP" EXIT
+FAIL=0
+
+# Wire frames to splice the damage between
+$CAPTURE -f w emulator stream 10 > $TMP/good.bin || exit 1
+
+# replay name file nframes: expect nframes x 14 rows decoded from file
+replay () {
+	local rows=`$CAPTURE $2 stream $3 2>/dev/null | wc -l`
+	if [ "$rows" -eq $(($3 * 14)) ]; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1: $rows rows, expected $(($3 * 14))"
+		FAIL=1
+	fi
+}
+
+# A command frame type followed by far more than a frame of data before
+# the next END_DATA_HEADER (overflowed frame.data when replies were
+# delimited by the first 0x03)
+{ printf '\x02\x91'; head -c 298 /dev/zero | tr '\0' 'U'; printf '\x03'; cat $TMP/good.bin; } > $TMP/long_reply.bin
+replay long_reply $TMP/long_reply.bin 10
+
+# A stream frame with its type byte corrupted to a command type and its
+# trailer lost must not swallow the frames after it
+{ head -c 189 $TMP/good.bin; printf '\x02\x9c'; tail -c +192 $TMP/good.bin | head -c 59; printf '\x00\x00'; tail -c +253 $TMP/good.bin; } > $TMP/bad_type.bin
+replay bad_type $TMP/bad_type.bin 9
+
+# Command replies and acks between stream frames
+{ head -c 126 $TMP/good.bin; printf '\x02\x92\x00\x73\x03\x03\x0a\x02\x9b\x03'; tail -c +127 $TMP/good.bin; } > $TMP/replies.bin
+replay replies $TMP/replies.bin 10
+
+exit $FAIL
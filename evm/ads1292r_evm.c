@@ -11,7 +11,7 @@
  * Version 0.2 (03 November 2012)
  * 
  * To compile:
- * gcc -o ads1x9x_evm ads1x9x_evm.c
+ * gcc -O2 -pthread -I../lib -o ads1292r_evm ads1292r_evm.c ../lib/ads1x9x*.c -lm
  *
  */
 
@@ -26,73 +26,99 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "ads1x9x_alarm.h"
+#include "ads1x9x_evm.h"
+#include "ads1x9x_hrv.h"
+#include "ads1x9x_merge.h"
+#include "ads1x9x_metrics.h"
+#include "ads1x9x_pcapng.h"
+#include "ads1x9x_probe.h"
+#include "ads1x9x_probes.h"
+#include "ads1x9x_quality.h"
+#include "ads1x9x_recorder.h"
+#include "ads1x9x_resp.h"
+#include "ads1x9x_spectrum.h"
+#include "ads1x9x_sink.h"
+#include "ads1x9x_splice.h"
+#include "ads1x9x_template.h"
+#include "ads1x9x_uring.h"
 
 
 #define APP_NAME "ads1x9x_evm"
 #define VERSION "0.2, 3 Nov 2012"
 
-#define TRUE 1
-#define FALSE 0
-
 #define FORMAT_DECIMAL 1
 #define FORMAT_BINARY 2
 #define FORMAT_RAW 3
+// Complete Host/USB frames including header and trailer, as read from the EVM
+#define FORMAT_WIRE 4
 
-#define FILTER_40HZ_LOWPASS 1
-// 50Hz notch and 0.5-150Hz pass
-#define FILTER_50HZ_NOTCH 2
-// 60Hz notch and 0.5-150Hz pass
-#define FILTER_60HZ_NOTCH 3
-
-// Host/USB protocol command definitions in ADS1x9x_USB_Communication.h
-
-
-#define CMD_REG_WRITE			0x91
-#define CMD_REG_READ			0x92
-
-
-#define CMD_DATA_STREAMING		0x93
-
-#define CMD_ACQUIRE_DATA		0x94
+// Devices in a merge command
+#define MAX_MERGE_DEVICES 8
 
-#define PROC_DATA_DOWNLOAD_COMMAND	0x95
-#define CMD_DATA_DOWNLOAD		0x96
-#define FIRMWARE_UPGRADE_COMMAND	0x97
-#define START_RECORDING_COMMAND		0x98
+// Frames per signal quality verdict, about 0.5s, for stream frames and
+// for acquire data and downloads
+#define QUALITY_BLOCK_FRAMES 18
+#define QUALITY_BLOCK_ACQUIRE_FRAMES 32
 
+// Spectrum windows (about 5s) averaged before choosing a mains notch, and
+// how far the power per bin of a mains band must stand above the bands
+// either side of it for a mains line to be found (10dB)
+#define NOTCH_WINDOWS 10
+#define NOTCH_RATIO 10
 
-#define CMD_QUERY_FIRMWARE_VERSION		0x99
+// Output queued while alarms are on, about 7 minutes of decimal output
+#define ALARM_OUTPUT_QUEUE (4 << 20)
 
-#define STATUS_INFO_REQ 			0x9A
-#define CMD_FILTER_SELECT		0x9B
-#define CMD_ERASE_MEMORY		0x9C
+// Interval between rewrites of the -T template file
+#define TEMPLATE_WRITE_MS 1000
 
-// Seems to have no effect
-#define CMD_RESTART				0x9D
+// A download with no data for this long has stalled
+#define DOWNLOAD_STALL_MS 5000
 
-// Host <-> EVM data frames
-// START_DATA_HEADER (packet type/cmd) (data ...) END_DATA_HEADER
-#define START_DATA_HEADER			0x02
-#define END_DATA_HEADER				0x03
+// Time allowed for every device to answer a probe
+#define PROBE_TIMEOUT_MS 250
 
-// ADS1292R registers. ADS129x[R] datasheet, Table 14, page 39.
-// RegAddr RegName: Bit7 Bit6 .. Bit0 [value on reset]
-// 0x00 ID: REV_ID7 REV_ID6 REV_ID5 1 0 0 REV_ID1 REV_ID0 [factory programmed]
-// 0x01 CONFIG1: SINGLE-SHOT 0 0 0 0 DR2 DR1 DR0 [0x02 on reset]
-// 0x02 CONFIG2: 1 PBD_LOFF_COMP PDB_REFBUF VREF_4V CLK_EN 0 INT_TEST TEST_FREQ [0x80 on reset]
-// 0x03 LOFF: COMP_TH2 COMP_TH1 COMP_TH0 1 ILEAD_OFF1 ILEAD_OFF0 0 FLEAD_OFF [0x10 on reset]
-// 0x04 CH1SET: PD1 GAIN1_2 GAIN1_1 GAIN1_0 MUX1_3 MUX1_2 MUX1_1 MUX1_0 [0x00]
-// 0x05 CH2SET: PD2 GAIN2_2 GAIN2_1 GAIN2_0 MUX2_3 MUX2_2 MUX2_1 MUX2_0 [0x00]
-//
-#define REG_ID 0x00
-
-
-// A structure that represents one frame of Host/USB protocol.
-typedef struct  {
-	uint8_t type;
-	uint8_t length;
-	uint8_t data[128];
-} ads1x9x_evm_frame_t;
+/**
+ * Analysis stages run on streamed samples, each enabled by its option.
+ * Results are written as '#' lines into decimal output, else to stderr.
+ */
+typedef struct {
+	int format;
+	ads1x9x_sink_t *out;
+	uint64_t sample_index;
+	ads1x9x_rpeak_t *rpeak;
+	ads1x9x_hrv_t *hrv;
+	ads1x9x_resp_t *resp;
+	ads1x9x_alarm_t *alarm;
+
+	// Signal quality, and the gate holding output until each verdict.
+	// Gap records go straight to marks, ahead of held output.
+	ads1x9x_quality_t *quality;
+	ads1x9x_sink_t *gate;
+	ads1x9x_sink_t *marks;
+	int verdict;
+	uint64_t block_start;
+	int block_frames;
+	int in_gap;
+	uint64_t gap_start;
+	int gap_flags;
+	int gap_frames;
+
+	ads1x9x_spectrum_t *spectrum;
+	int spectrum_report;
+	// Transport to send CMD_FILTER_SELECT on, or NULL to leave the filter
+	ads1x9x_transport_t *notch_t;
+	// Power per bin of the mains bands and of the floor either side
+	double mains50, mains60;
+	double floor50, floor60;
+} analysis_t;
 
 // The debug level set with the -d command line switch
 int debug_level = 0;
@@ -101,83 +127,11 @@ int debug_level = 0;
 int quiet_mode = FALSE;
 
 // Set to true in signal_handler to signal exit from main loop
-int exit_flag = FALSE;
+volatile int exit_flag = FALSE;
 
 void debug (int level, const char *msg, ...);
 void warning (const char *msg, ...);
 
-uint8_t cmd_buf[256];
-
-/**
- * Open serial IO device to ADS1292R EVM 
- * (8N1, 57600bps, raw mode, no handshaking)
- *
- * @param deviceName Pointer to string with device name (eg "/dev/ttyACM0")
- * @return Operating system file descriptor or -1 if there was an error.
- */
-int ads1x9x_evm_open(char *deviceName, int bps) {
-
-	int fd = open(deviceName,O_RDWR);
-	if (fd==0) {
-		fprintf (stderr,"Error: unable to open device %s\n",deviceName);
-		return -1;
-	} 
-
-	struct termios tios;
-	int status=tcgetattr(fd,&tios);
-	if (status < 0) {
-    	fprintf (stderr,"Error: error calling tcgetattr\n");
-		return -1;
-	}
-
-	int speed = B9600;
-	switch (bps) {
-		case 9600:
-			speed = B9600;
-			break;
-		case 19200:
-			speed = B19200;
-			break;
-		case 38400:
-			speed = B38400;
-			break;
-		case 57600:
-			speed = B57600;
-			break;
-		case 115200:
-			speed = B115200;
-			break;
-		default:
-			fprintf (stderr,"Unsupported speed %d bps\n", bps);
-	}
-
-	// Set tx/rx speed at 115200bps, and set raw mode
- 	cfsetispeed(&tios,speed);
- 	cfsetospeed(&tios,speed);
-	cfmakeraw(&tios);
-
-	tios.c_cflag &= ~CSTOPB; // Set 1 stop bit
-	tios.c_cflag |= (CREAD | CLOCAL); // Enable receiver and disable hardware flow control
-	tios.c_oflag = 0; // Disable some modem settings
-
-
-	//tios.c_cc[VMIN] = 1; 
-	//tios.c_cc[VTIME] = 0;
-
-	tcsetattr(fd, TCSANOW, &tios);
-
-	return fd;
-}
-
-/**
- * Close serial IO device.
- * @param fd File descriptor
- */
-void ads1x9x_evm_close(int fd) {
-	close(fd);
-}
-
-
 /**
  * Display to stderr current version of this application.
  */
@@ -191,18 +145,59 @@ void version () {
 void usage () {
 	fprintf (stderr,"\n");
 	fprintf (stderr,"Usage: ads1x9x_evm [-q] [-v] [-h] [-d level] device command [params...]\n");
+	fprintf (stderr,"       ads1x9x_evm [-b bps] probe [device...] (spidev nodes only if named)\n");
 
 	//fprintf (stderr,"  -c channel \t Set channel. Allowed values: 11 to 26.\n");	
 	fprintf (stderr,"\n");
 	fprintf (stderr,"Options:\n");
 	fprintf (stderr,"  -d level \t Set debug level, 0 = min (default), 9 = max verbosity\n");
+	fprintf (stderr,"  -f format \t Stream output: d = decimal (default), r = raw payload, w = wire frames\n");
+	fprintf (stderr,"  -o file \t Write stream output to file instead of stdout\n");
+	fprintf (stderr,"  -w file \t Trace every command and frame to file in pcapng format, - for stdout\n");
+	fprintf (stderr,"           \t (with -o), eg for wireshark -k -i -\n");
+	fprintf (stderr,"  -R dir[,mb[,s[,sync_ms]]] \t Crash safe recording to segment files in dir, rotated\n");
+	fprintf (stderr,"           \t at mb MiB (default 64) or s seconds, synced every sync_ms (default 1000)\n");
+	fprintf (stderr,"  -a \t Resume data_download, appending to -o file (formats b, r, w). The EVM always\n");
+	fprintf (stderr,"           \t sends from the start, so the whole recording is read again\n");
+	fprintf (stderr,"  -b bps \t Serial speed, any rate the USB-serial device supports (default 9600)\n");
+	fprintf (stderr,"  -L \t Low latency link: frame sized reads, driver low latency flag, report link stats\n");
+	fprintf (stderr,"  -U depth \t Use io_uring for device reads and output with depth buffers in flight\n");
+	fprintf (stderr,"           \t (no effect on archive, which splices from the device to the output; -R\n");
+	fprintf (stderr,"           \t segments are written by the recorder's own thread, not through io_uring)\n");
+	fprintf (stderr,"  -H window_s \t Detect R peaks on ch2 of stream and report HRV over window_s seconds\n");
+	fprintf (stderr,"           \t per beat: #hrv t rr_ms hr sdnn rmssd pnn50 lf hf lf/hf\n");
+	fprintf (stderr,"  -A lo,hi \t Alarms on stream: lead-off, heart rate outside lo-hi bpm (from -H beats if\n");
+	fprintf (stderr,"           \t enabled, else the EVM heart rate) and flatline, to stderr and -u, -W.\n");
+	fprintf (stderr,"           \t Output is then queued; if its reader stalls for minutes output is dropped\n");
+	fprintf (stderr,"  -u path \t Also send alarms as JSON datagrams to unix socket path\n");
+	fprintf (stderr,"  -W url \t Also POST alarms as JSON to http://host[:port]/path\n");
+	fprintf (stderr,"  -Q \t Drop stream or acquire_data output of 0.5s blocks with leads off, clipping, baseline\n");
+	fprintf (stderr,"           \t drift or noise; each dropped run is marked #gap t_start t_end reasons frames.\n");
+	fprintf (stderr,"           \t data_download drops only in decimal output; b, r and w keep every frame for -a\n");
+	fprintf (stderr,"  -T file \t Average beats of acquire_data ch2 into templates by shape, rewriting file\n");
+	fprintf (stderr,"           \t every second and at the end; each beat is output as #beat t cluster corr lag\n");
+	fprintf (stderr,"  -B \t Detect breaths on ch1 of stream, per breath: #resp t interval_s rate mean_rate amplitude\n");
+	fprintf (stderr,"  -S \t Report band powers of both channels every 0.5s (1s FFT windows)\n");
+	fprintf (stderr,"           \t #spec t then base signal mains50 mains60 hf for ch1 and ch2\n");
+	fprintf (stderr,"  -N \t Measure mains interference on stream and select the 50Hz or 60Hz notch if\n");
+	fprintf (stderr,"           \t either line stands 10dB above its neighbouring bins: #notch choice ratio50 ratio60\n");
+	fprintf (stderr,"  -M file \t Rewrite metrics to file in Prometheus text format every second\n");
+	fprintf (stderr,"           \t (SIGUSR1 dumps metrics to stderr at any time)\n");
 	fprintf (stderr,"  -q \t Quiet mode: suppress warning messages.\n");
 	fprintf (stderr,"  -v \t Print version to stderr and exit\n");
 	fprintf (stderr,"  -h \t Display this message to stderr and exit\n");
 	fprintf (stderr,"\n");
 	fprintf (stderr,"Parameters:\n");
 	fprintf (stderr,"  device:  the unix device file corresponding to the device (often /dev/ttyACM0)\n");
-	fprintf (stderr,"  command: readreg reg | writereg reg val | stream nsamples\n");
+	fprintf (stderr,"           or 'auto' for the first EVM that answers a probe (all of them for merge)\n");
+	fprintf (stderr,"           or 'emulator' for a software emulation of the EVM\n");
+	fprintf (stderr,"           or a file recorded with -f w to replay\n");
+	fprintf (stderr,"  command: readreg reg | writereg reg val | stream nframes | bench nframes\n");
+	fprintf (stderr,"           | archive nframes [check] (zero-copy wire frame capture to -o file or\n");
+	fprintf (stderr,"             stdout, not -R; check also parses a copy to count frames, as -w does)\n");
+	fprintf (stderr,"           | data_download (flash recording; -f b = int32 samples, r, w or d)\n");
+	fprintf (stderr,"           | merge nrows [latency_ms] (device is a comma separated list, output is\n");
+	fprintf (stderr,"             us since first row then ch1 ch2 of each device on one timebase)\n");
 	fprintf (stderr,"\n");
 	//fprintf (stderr,"See this blog post for details: \n    http://jdesbonnet.blogspot.com/2012/04/stm32w-rfckit-as-802154-network.html\n");
 	fprintf (stderr,"Version: ");
@@ -262,199 +257,745 @@ void signal_handler(int signum, siginfo_t *info, void *ptr) {
 }
 
 /**
- * Continue to read from file handle fd until 'length' bytes
- * have been read.
- */
-void read_n_bytes (int fd, void *buf, int length) {
-	//fprintf (stderr,"read_n_bytes length=%d\n",length);
-	int n=0;
-	while (n < length) {
-		n += read(fd,buf+n,length-n);
-		//fprintf (stderr,"*");
-		//fflush(stderr);
-	}
-}
-
-/**
- * Display length bytes from pointer buf in zero padded
- * hex.
+ * SIGUSR1 handler: dump metrics to stderr from the metrics thread.
  */
-void display_hex(uint8_t *buf, int length) {
-	int i;
-	for (i = 0; i < length; i++) {
-		fprintf (stderr,"%02X ",buf[i]);
-	}
+void metrics_signal_handler(int signum) {
+	(void)signum;
+	ads1x9x_metrics_request_dump();
 }
 
 /**
- * Read a Host/EVM protocol frame from ADS1x9x EVM module. Unfortunately
- * there is no easy way to know the packet length. Scanning for 
- * END_OF_DATA is not reliable because the EOD value (0x03) is a valid
- * value for frame payload.
+ * @deprecated  Use ads1x9x_evm_read_frame() instead.
  *
- * @return TBD
+ * @return The entire frame length (excluding cksum) if successful, -1 on error.
  */
-int ads1x9x_evm_read_frame (int fd, ads1x9x_evm_frame_t *frame) {
+int ads1x9x_evm_read_response (ads1x9x_evm_parser_t *p) {
 	
-	int i,c=0;
+	int i;
+	uint8_t c,v,heart_rate,respiration,lead_off;
+	uint8_t buf[8];
+	int16_t sample;
 
 	// Wait for start of data header
 	do {
-		read_n_bytes (fd,&c,1);
-		//fprintf (stderr,"[ %x ] ",c);
+		if (ads1x9x_evm_parser_read (p,&c,1) < 0) {
+			return -1;
+		}
+		fprintf (stderr,"%02x .",c);
 	} while (c != START_DATA_HEADER);
 
 	//fprintf (stderr,"*** START_OF_DATA ***\n");
 
-	// Need to know type of frame to calculate length
-	read_n_bytes (fd,&c,1);
-	//fprintf (stderr,"c=%02x\n",c);
-
-	frame->type = c;
+	// Read packet type
+	if (ads1x9x_evm_parser_read (p,&c,1) < 0) {
+		return -1;
+	}
+	fprintf (stderr,"c=%02x\n",c);
+	ADS1X9X_PROBE1(reply_received, c);
 
 	switch (c) {
-		case CMD_DATA_STREAMING:
-			// Read HR + RESP + LOFF + 14 x (ch1(16bits) + ch2(16bits))  + 2xEOH = 61 bytes
-			frame->length = 59;
-			read_n_bytes (fd,frame->data,61);
-			break;
+
 
 		case CMD_REG_READ:
-		case CMD_QUERY_FIRMWARE_VERSION:
-			frame->length = 5;
-			read_n_bytes (fd,frame->data,5);
+			ads1x9x_evm_parser_read (p,buf,5);
+			v = buf[1];
+			fprintf (stdout,"%x\n",v);
 			break;
 
-		case CMD_ACQUIRE_DATA:
-			// Read 2 x status bytes, 8 x (ch1(24bits) + ch2(24bits) + EOD = 51
-			frame->length = 51;
-			read_n_bytes (fd,frame->data,51);
+		case CMD_QUERY_FIRMWARE_VERSION:
+			ads1x9x_evm_parser_read (p,buf,2);
+			fprintf (stdout,"%d.%d\n",buf[0],buf[1]);
 			break;
+		
 		default:
 			fprintf (stderr,"unknown packet type %x\n",c);
-			uint8_t buf[4];
-			i = 0;
 			do {
-				read_n_bytes(fd,buf,1);
-				display_hex(buf,1);
-				i++;
+				if (ads1x9x_evm_parser_read(p,buf,1) < 0) {
+					return -1;
+				}
+				ads1x9x_display_hex(buf,1);
 			} while (buf[0] != END_DATA_HEADER);
 			fprintf (stderr, "\n");
-			frame->length = i-1;
 	}
 
 	return 0;
 }
 
 /**
- * Read a Host/EVM frame by scanning for END_DATA_HEADER. This cannot be used
- * in general because frame data may contain END_DATA_HEADER.
+ * Probe the devices named, or every serial port if none, and print
+ * one line per device to stdout: path, kind, state, firmware version,
+ * REG_ID, part and reply time.
+ *
+ * @return Number of devices found.
  */
-int ads1x9x_evm_read_frame_to_eod (int fd, ads1x9x_evm_frame_t *frame) {
-	
-	int c=0;
+int probe (char **paths, int npaths, int bps) {
+	ads1x9x_probe_result_t r[ADS1X9X_PROBE_MAX];
+	int i, n = 0;
 
-	// Wait for start of data header
-	do {
-		read_n_bytes (fd,&c,1);
-	} while (c != START_DATA_HEADER);
+	if (npaths == 0) {
+		n = ads1x9x_probe_find(r, ADS1X9X_PROBE_MAX);
+	}
+	for (i = 0; i < npaths && n < ADS1X9X_PROBE_MAX; i++) {
+		ads1x9x_probe_add(&r[n++], paths[i]);
+	}
+	int found = ads1x9x_probe_run(r, n, bps, PROBE_TIMEOUT_MS);
+	for (i = 0; i < n; i++) {
+		char fw[16] = "-", id[16] = "-";
+		if (r[i].fw_major >= 0) {
+			snprintf(fw, sizeof(fw), "%d.%d", r[i].fw_major, r[i].fw_minor);
+		}
+		if (r[i].id >= 0) {
+			snprintf(id, sizeof(id), "0x%02x", r[i].id);
+		}
+		fprintf (stdout,"%s %s %s %s %s %s %.1f\n", r[i].path, r[i].kind,
+			ads1x9x_probe_state_name(r[i].state), fw, id,
+			r[i].dev != NULL ? r[i].dev->name : "-", r[i].ms);
+	}
+	return found;
+}
 
-	// read packet type
-	read_n_bytes (fd,&c,1);
-	frame->type = c;
+/**
+ * Resolve device "auto" by probing the serial ports for EVMs.
+ *
+ * @param all Return every EVM found as a comma separated list, else the first.
+ * @return Allocated device string or NULL if no EVM answered.
+ */
+char *probe_auto (int bps, int all) {
+	ads1x9x_probe_result_t r[ADS1X9X_PROBE_MAX];
+	char list[ADS1X9X_PROBE_MAX * 65] = "";
+	int i, n = 0, nevm = 0;
+
+	n = ads1x9x_probe_find(r, ADS1X9X_PROBE_MAX);
+	ads1x9x_probe_run(r, n, bps, PROBE_TIMEOUT_MS);
+	for (i = 0; i < n; i++) {
+		debug (1, "probe: %s %s", r[i].path, ads1x9x_probe_state_name(r[i].state));
+		if (r[i].state != ADS1X9X_PROBE_FOUND || (nevm > 0 && !all)) {
+			continue;
+		}
+		if (nevm++ > 0) {
+			strcat(list, ",");
+		}
+		strcat(list, r[i].path);
+	}
+	return nevm > 0 ? strdup(list) : NULL;
+}
 
-	// Read until END_DATA_HEADER
-	int i = 0;
-	uint8_t buf[4];
-	do {
-		read_n_bytes(fd,buf,1);
-		//display_hex(buf,1);
-		frame->data[i]=buf[0];
-		i++;
-	} while (buf[0] != END_DATA_HEADER);
+/**
+ * Report achieved frame rate and the bytes returned per read to stderr.
+ */
+void report_link (const ads1x9x_transport_t *t, int nframe, double seconds) {
+	if (quiet_mode) {
+		return;
+	}
+	fprintf (stderr,"link: %d frames in %.3f s, %.1f frames/s, %llu reads, bytes/read min %d mean %.1f max %d\n",
+		nframe, seconds, seconds > 0 ? nframe / seconds : 0.0,
+		(unsigned long long)t->read_calls, t->read_min,
+		t->read_calls ? (double)t->read_bytes / t->read_calls : 0.0, t->read_max);
+}
 
-	frame->length = i-1;
-	return 0;
+/**
+ * Report frame parser counters at debug level 1.
+ */
+void debug_parser_stats (const ads1x9x_evm_parser_t *p) {
+	debug (1, "frames %llu, resyncs %llu, discarded bytes %llu, estimated lost frames %llu",
+		(unsigned long long)p->frames, (unsigned long long)p->resyncs,
+		(unsigned long long)p->discarded_bytes, (unsigned long long)p->lost_frames);
 }
 
 /**
- * @deprecated  Use ads1x9x_evm_read_frame() instead.
+ * Write an analysis result line.
+ */
+static void analysis_vprintf (analysis_t *a, ads1x9x_sink_t *out, const char *fmt, va_list args) {
+	char buf[256];
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	if (n >= (int)sizeof(buf)) {
+		n = sizeof(buf) - 1;
+	}
+	if (a->format == FORMAT_DECIMAL) {
+		out->write(out, buf, n);
+	} else {
+		fputs(buf, stderr);
+	}
+}
+
+static void analysis_printf (analysis_t *a, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	analysis_vprintf (a, a->out, fmt, args);
+	va_end(args);
+}
+
+static void analysis_mark (analysis_t *a, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	analysis_vprintf (a, a->marks, fmt, args);
+	va_end(args);
+}
+
+/**
+ * Record the end of a run of poor quality blocks.
+ */
+static void end_gap (analysis_t *a, uint64_t end) {
+	char reasons[64];
+	analysis_mark (a, "#gap %.3f %.3f %s %d\n", (double)a->gap_start / EVM_STREAM_SPS,
+		(double)end / EVM_STREAM_SPS, ads1x9x_quality_reasons(a->gap_flags, reasons, sizeof(reasons)),
+		a->gap_frames);
+	a->in_gap = FALSE;
+}
+
+/**
+ * Called once a frame has been output. At the end of a quality block the
+ * held output is released or, if the block is poor, dropped and added to
+ * the current gap.
+ */
+static void analysis_frame_done (analysis_t *a) {
+	ads1x9x_quality_t *q = a->quality;
+	if (q == NULL) {
+		return;
+	}
+	a->block_frames++;
+	if (!a->verdict) {
+		return;
+	}
+	a->verdict = FALSE;
+	debug (1, "sqi %.3f %d 0x%x", (double)a->block_start / EVM_STREAM_SPS, q->sqi, q->flags);
+	if (q->flags) {
+		if (!a->in_gap) {
+			a->in_gap = TRUE;
+			a->gap_start = a->block_start;
+			a->gap_flags = 0;
+			a->gap_frames = 0;
+		}
+		a->gap_flags |= q->flags;
+		a->gap_frames += a->block_frames;
+	} else if (a->in_gap) {
+		end_gap (a, a->block_start);
+	}
+	if (a->gate != NULL) {
+		ads1x9x_gate_sink_release (a->gate, q->flags == 0);
+	}
+	a->block_start = a->sample_index;
+	a->block_frames = 0;
+}
+
+/**
+ * End of stream: keep output of an incomplete block and close any gap.
+ */
+static void analysis_finish (analysis_t *a) {
+	if (a->quality == NULL) {
+		return;
+	}
+	if (a->in_gap) {
+		end_gap (a, a->block_start);
+	}
+	if (a->gate != NULL) {
+		ads1x9x_gate_sink_release (a->gate, TRUE);
+	}
+}
+
+/**
+ * Mean power per bin of bands b1 and b2 on channel c.
+ */
+static double band_density (const ads1x9x_spectrum_t *s, int c, int b1, int b2) {
+	int bins = s->band_hi[b1] - s->band_lo[b1];
+	if (b2 >= 0) {
+		bins += s->band_hi[b2] - s->band_lo[b2];
+	}
+	double power = s->band[c][b1] + (b2 >= 0 ? s->band[c][b2] : 0);
+	return bins > 0 ? power / bins : 0;
+}
+
+/**
+ * Once enough spectra are in, select the notch filter for a mains line
+ * that stands out from the spectrum around it. The ECG itself has more
+ * power at 50Hz than at 60Hz, so the bands are compared with their
+ * neighbours rather than with each other. If both lines are found the
+ * one further above its floor is chosen.
+ */
+static void choose_notch (analysis_t *a) {
+	ads1x9x_spectrum_t *s = a->spectrum;
+	int c;
+	for (c = 0; c < ADS1X9X_SPECTRUM_NCHANNELS; c++) {
+		a->mains50 += band_density(s, c, ADS1X9X_BAND_MAINS50, -1);
+		a->mains60 += band_density(s, c, ADS1X9X_BAND_MAINS60, -1);
+		a->floor50 += band_density(s, c, ADS1X9X_BAND_MAINS50_BELOW, ADS1X9X_BAND_MAINS50_ABOVE);
+		a->floor60 += band_density(s, c, ADS1X9X_BAND_MAINS60_BELOW, ADS1X9X_BAND_MAINS60_ABOVE);
+	}
+	if (s->windows < NOTCH_WINDOWS) {
+		return;
+	}
+	int found50 = a->mains50 > a->floor50 * NOTCH_RATIO;
+	int found60 = a->mains60 > a->floor60 * NOTCH_RATIO;
+	int filter = 0;
+	if (found50 && (!found60 || a->mains50 * a->floor60 > a->mains60 * a->floor50)) {
+		filter = FILTER_50HZ_NOTCH;
+	} else if (found60) {
+		filter = FILTER_60HZ_NOTCH;
+	}
+	analysis_printf (a, "#notch %s %.3g %.3g\n", filter == FILTER_50HZ_NOTCH ? "50"
+		: filter == FILTER_60HZ_NOTCH ? "60" : "none",
+		a->floor50 > 0 ? a->mains50 / a->floor50 : 0, a->floor60 > 0 ? a->mains60 / a->floor60 : 0);
+	if (filter != 0) {
+		// The ack arrives among the stream frames and is skipped there
+		ads1x9x_evm_write_cmd(a->notch_t, CMD_FILTER_SELECT, 0x03, filter);
+	}
+	a->notch_t = NULL;
+}
+
+/**
+ * Run the enabled analysis stages on a frame of decoded samples. Alarms
+ * are evaluated first, before the frame is output.
  *
- * @return The entire frame length (excluding cksum) if successful, -1 on error.
+ * @param frame_ns Host time the frame was read
  */
-int ads1x9x_evm_read_response (int fd) {
-	
+static void analyse_frame (analysis_t *a, const uint8_t *data, const int32_t *samples, int nrows,
+	uint64_t frame_ns) {
 	int i;
-	uint8_t c,v,heart_rate,respiration,lead_off;
-	uint8_t buf[8];
-	int16_t sample;
+	uint64_t r;
+	ads1x9x_hrv_metrics_t m;
+	ads1x9x_breath_t b;
+	double t_frame = (double)a->sample_index / EVM_STREAM_SPS;
+
+	if (a->alarm != NULL) {
+		ads1x9x_alarm_frame (a->alarm, frame_ns, t_frame, data[2], samples + 1, EVM_NCHANNELS, nrows);
+		// The EVM reports 0 until it has a heart rate and while leads
+		// are off, which is no estimate rather than a low rate
+		if (a->rpeak == NULL && data[0] != 0) {
+			ads1x9x_alarm_hr (a->alarm, frame_ns, t_frame, data[0]);
+		}
+	}
 
-	// Wait for start of data header
-	do {
-		read_n_bytes (fd,&c,1);
-		fprintf (stderr,"%02x .",c);
-	} while (c != START_DATA_HEADER);
+	for (i = 0; i < nrows; i++) {
+		if (a->rpeak != NULL && ads1x9x_rpeak_process(a->rpeak, samples[i*2 + 1], &r)) {
+			double t = (double)r / EVM_STREAM_SPS;
+			if (ads1x9x_hrv_beat(a->hrv, t)) {
+				ads1x9x_hrv_metrics(a->hrv, &m);
+				if (a->alarm != NULL) {
+					ads1x9x_alarm_hr (a->alarm, frame_ns, t, m.hr_bpm);
+				}
+				analysis_printf (a, "#hrv %.3f %.0f %.1f %.1f %.1f %.1f %.1f %.1f %.3f\n",
+					t, m.rr_ms, m.hr_bpm, m.sdnn_ms, m.rmssd_ms, m.pnn50,
+					m.lf_ms2, m.hf_ms2, m.lf_hf);
+			}
+		}
+		if (a->resp != NULL && ads1x9x_resp_process(a->resp, samples[i*2], &b)) {
+			analysis_printf (a, "#resp %.3f %.2f %.1f %.1f %.0f\n",
+				b.t, b.interval_s, b.rate_bpm, b.mean_rate_bpm, b.amplitude);
+		}
+	}
+	if (a->quality != NULL && ads1x9x_quality_push(a->quality, data[2], samples, nrows)) {
+		a->verdict = TRUE;
+	}
+	if (a->spectrum != NULL && ads1x9x_spectrum_push(a->spectrum, samples, nrows) > 0) {
+		double (*band)[ADS1X9X_NBANDS] = a->spectrum->band;
+		if (a->spectrum_report) {
+			analysis_printf (a, "#spec %.3f %.3g %.3g %.3g %.3g %.3g %.3g %.3g %.3g %.3g %.3g\n",
+				(double)(a->sample_index + nrows) / EVM_STREAM_SPS,
+				band[0][0], band[0][1], band[0][2], band[0][3], band[0][4],
+				band[1][0], band[1][1], band[1][2], band[1][3], band[1][4]);
+		}
+		if (a->notch_t != NULL) {
+			choose_notch (a);
+		}
+	}
+	a->sample_index += nrows;
+}
 
-	//fprintf (stderr,"*** START_OF_DATA ***\n");
+/**
+ * Judge a frame of acquire data or of a download for signal quality. The
+ * other analysis stages run on stream frames only.
+ */
+static void analyse_acquire_frame (analysis_t *a, const uint8_t *data, const int32_t *samples) {
+	if (a->quality != NULL && ads1x9x_quality_push(a->quality, EVM_ACQUIRE_LEAD_OFF(data),
+			samples, EVM_ACQUIRE_ROWS)) {
+		a->verdict = TRUE;
+	}
+	a->sample_index += EVM_ACQUIRE_ROWS;
+}
 
-	// Read packet type
-	read_n_bytes (fd,&c,1);
-	fprintf (stderr,"c=%02x\n",c);
+/**
+ * Read CMD_DATA_STREAMING frames and write them to a sink.
+ *
+ * @param nframe Number of frames to read
+ * @param format One of FORMAT_DECIMAL, FORMAT_RAW, FORMAT_WIRE
+ * @param latency If not NULL, also receives the read-to-output latency of
+ * each frame in ns. Latency is always recorded in the metrics histogram.
+ * @param a Analysis stages, or NULL for none
+ * @return Number of frames written.
+ */
+int stream_frames (ads1x9x_evm_parser_t *p, ads1x9x_sink_t *out, int nframe, int format, uint64_t *latency,
+	analysis_t *a) {
+	ads1x9x_evm_frame_t frame;
+	uint64_t t0, t1;
+	int i,j;
+	uint8_t heart_rate,respiration_rate,lead_off;
+	int32_t samples[EVM_STREAM_ROWS * EVM_NCHANNELS];
+	uint8_t wire[2 + sizeof(frame.data)] = {START_DATA_HEADER, CMD_DATA_STREAMING};
+
+	for (j = 0; j < nframe && !exit_flag; j++) {
+		if (ads1x9x_evm_read_frame (p, &frame) < 0) {
+			break;
+		}
+		if (frame.type != CMD_DATA_STREAMING) {
+			// A command reply among the stream
+			debug (1, "skipping frame type 0x%02x in stream", frame.type);
+			j--;
+			continue;
+		}
+		t0 = ads1x9x_now_ns();
+		if (a != NULL) {
+			ads1x9x_evm_decode_stream (frame.data, samples);
+			analyse_frame (a, frame.data, samples, EVM_STREAM_ROWS, frame.read_ns);
+		}
+		switch (format) {
+			case FORMAT_RAW:
+				out->write (out, &frame.data, EVM_STREAM_PAYLOAD);
+				break;
+			case FORMAT_WIRE:
+				// One write per frame so a recorder never splits a frame
+				wire[1] = frame.type;
+				memcpy (wire + 2, frame.data, EVM_STREAM_PAYLOAD + 2);
+				out->write (out, wire, 2 + EVM_STREAM_PAYLOAD + 2);
+				break;
+			default:
+				heart_rate = frame.data[0];
+				respiration_rate = frame.data[1];
+				lead_off = frame.data[2];
+
+				ads1x9x_evm_decode_stream (frame.data, samples);
+				for (i = 0; i < EVM_STREAM_ROWS; i++) {
+					ads1x9x_sink_printf (out, "%d %d %d %d %d \n", samples[i*2], samples[i*2 + 1],
+						heart_rate,respiration_rate,lead_off);
+				}
+		}
+		ADS1X9X_PROBE1(decode_done, EVM_STREAM_ROWS);
+		t1 = ads1x9x_now_ns();
+		ads1x9x_hist_record(&ads1x9x_metrics.read_to_output, t1 - t0);
+		if (latency != NULL) {
+			latency[j] = t1 - t0;
+		}
+		if (a != NULL) {
+			analysis_frame_done (a);
+		}
+	}
+	if (a != NULL) {
+		analysis_finish (a);
+	}
+	return j;
+}
 
-	switch (c) {
+static int compare_u64 (const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
 
+/**
+ * Benchmark harness: stream nframe frames through the selected transport
+ * and sink, and report throughput, CPU time per frame and read-to-output
+ * latency percentiles to stderr.
+ */
+void bench (ads1x9x_evm_parser_t *p, ads1x9x_sink_t *out, int nframe, int format, analysis_t *a) {
+	struct timespec w0, w1;
+	struct rusage r0, r1;
+	uint64_t *latency = calloc(nframe, sizeof(uint64_t));
+
+	getrusage(RUSAGE_SELF, &r0);
+	clock_gettime(CLOCK_MONOTONIC, &w0);
+
+	int n = stream_frames (p, out, nframe, format, latency, a);
+	out->flush(out);
+
+	clock_gettime(CLOCK_MONOTONIC, &w1);
+	getrusage(RUSAGE_SELF, &r1);
+
+	double wall = (w1.tv_sec - w0.tv_sec) + (w1.tv_nsec - w0.tv_nsec) * 1e-9;
+	double cpu = (r1.ru_utime.tv_sec - r0.ru_utime.tv_sec) + (r1.ru_stime.tv_sec - r0.ru_stime.tv_sec)
+		+ ((r1.ru_utime.tv_usec - r0.ru_utime.tv_usec) + (r1.ru_stime.tv_usec - r0.ru_stime.tv_usec)) * 1e-6;
+
+	if (n > 0) {
+		qsort(latency, n, sizeof(uint64_t), compare_u64);
+		fprintf (stderr,"transport=%s sink=%s frames=%d\n", p->t->name, out->name, n);
+		fprintf (stderr,"%.0f frames/s, %.3f us CPU/frame\n", n / wall, cpu * 1e6 / n);
+		fprintf (stderr,"read-to-output latency us: p50 %.3f p99 %.3f p99.9 %.3f max %.3f\n",
+			latency[n/2] * 1e-3, latency[n*99/100] * 1e-3, latency[n*999/1000] * 1e-3,
+			latency[n-1] * 1e-3);
+	}
+	free(latency);
+}
 
-		case CMD_REG_READ:
-			read_n_bytes (fd,buf,5);
-			v = buf[1];
-			fprintf (stdout,"%x\n",v);
-			break;
+/**
+ * Bytes written per CMD_DATA_DOWNLOAD frame in the given output format,
+ * or 0 if that format is not fixed size per frame.
+ */
+static int download_frame_bytes (int format) {
+	switch (format) {
+		case FORMAT_WIRE:
+			return 2 + EVM_DOWNLOAD_PAYLOAD + 1;
+		case FORMAT_RAW:
+			return EVM_DOWNLOAD_PAYLOAD;
+		case FORMAT_BINARY:
+			return EVM_DOWNLOAD_ROWS * EVM_NCHANNELS * sizeof(int32_t);
+	}
+	return 0;
+}
 
-		case CMD_QUERY_FIRMWARE_VERSION:
-			read_n_bytes (fd,buf,2);
-			fprintf (stdout,"%d.%d\n",buf[0],buf[1]);
+/**
+ * Wait up to timeout_ms for the device to have data to read.
+ *
+ * @return 0 on timeout, else non-zero. Transports that cannot be polled
+ * (the emulator, reads queued by io_uring) are always taken as ready.
+ */
+static int wait_readable (ads1x9x_transport_t *t, int timeout_ms) {
+	struct pollfd pfd;
+	int r;
+
+	if (t->fd < 0 || strcmp(t->name,"uring")==0) {
+		return 1;
+	}
+	pfd.fd = t->fd;
+	pfd.events = POLLIN;
+	do {
+		r = poll(&pfd, 1, timeout_ms);
+	} while (r < 0 && errno == EINTR && !exit_flag);
+	return r != 0;
+}
+
+/**
+ * Download the whole flash recording with CMD_DATA_DOWNLOAD and write it
+ * to a sink, reporting progress to stderr once a second. Frames are
+ * fixed length and validated by the parser so 0x03 in sample data does
+ * not end the download early.
+ *
+ * @param skip Frames already saved by an interrupted download. The
+ * firmware always sends from the start so these are read and dropped.
+ * @param a Analysis for signal quality, or NULL for none
+ * @return Frames in the recording, or -1 if the end of the recording
+ * was not reached, including when the EVM sent nothing for
+ * DOWNLOAD_STALL_MS.
+ */
+int64_t download (ads1x9x_evm_parser_t *p, ads1x9x_sink_t *out, int format, uint64_t skip,
+	analysis_t *a) {
+	ads1x9x_evm_frame_t frame;
+	int32_t samples[EVM_DOWNLOAD_ROWS * EVM_NCHANNELS];
+	uint8_t wire[2 + sizeof(frame.data)] = {START_DATA_HEADER, CMD_DATA_DOWNLOAD};
+	uint64_t n = 0;
+	uint64_t t0 = ads1x9x_now_ns();
+	uint64_t next_report = t0 + 1000000000ULL;
+	int complete = FALSE;
+	int i;
+
+	ads1x9x_evm_write_cmd(p->t, CMD_DATA_DOWNLOAD, 0x00, 0x00);
+
+	while (!exit_flag) {
+		if (ads1x9x_evm_parse (p, &frame) == 0) {
+			if (!wait_readable (p->t, DOWNLOAD_STALL_MS)) {
+				warning ("download stalled: nothing from the EVM for %d s after %llu frames",
+					DOWNLOAD_STALL_MS / 1000, (unsigned long long)n);
+				break;
+			}
+			if (ads1x9x_evm_read_frame (p, &frame) < 0) {
+				break;
+			}
+		}
+		if (frame.type != CMD_DATA_DOWNLOAD) {
+			debug (1, "ignoring frame type %02x during download", frame.type);
+			continue;
+		}
+		if (frame.length == 0) {
+			// End of recording, kept in wire output so a replay ends
+			// where the download did
+			if (format == FORMAT_WIRE) {
+				out->write (out, wire, 2);
+				out->write (out, frame.data, 1);
+			}
+			complete = TRUE;
 			break;
-		
-		default:
-			fprintf (stderr,"unknown packet type %x\n",c);
-			do {
-				read_n_bytes(fd,buf,1);
-				display_hex(buf,1);
-			} while (buf[0] != END_DATA_HEADER);
-			fprintf (stderr, "\n");
+		}
+		if (n++ < skip) {
+			if (a != NULL) {
+				a->sample_index += EVM_DOWNLOAD_ROWS;
+			}
+			continue;
+		}
+		if (a != NULL) {
+			ads1x9x_evm_decode_acquire (frame.data, samples);
+			analyse_acquire_frame (a, frame.data, samples);
+		}
+
+		switch (format) {
+			case FORMAT_RAW:
+				out->write (out, frame.data, EVM_DOWNLOAD_PAYLOAD);
+				break;
+			case FORMAT_WIRE:
+				memcpy (wire + 2, frame.data, EVM_DOWNLOAD_PAYLOAD + 1);
+				out->write (out, wire, 2 + EVM_DOWNLOAD_PAYLOAD + 1);
+				break;
+			case FORMAT_BINARY:
+				ads1x9x_evm_decode_acquire (frame.data, samples);
+				out->write (out, samples, sizeof(samples));
+				break;
+			default:
+				ads1x9x_evm_decode_acquire (frame.data, samples);
+				for (i = 0; i < EVM_DOWNLOAD_ROWS; i++) {
+					ads1x9x_sink_printf (out, "%d %d\n", samples[i*2], samples[i*2 + 1]);
+				}
+		}
+		ADS1X9X_PROBE1(decode_done, EVM_DOWNLOAD_ROWS);
+		if (a != NULL) {
+			analysis_frame_done (a);
+		}
+
+		uint64_t now = ads1x9x_now_ns();
+		if (!quiet_mode && now >= next_report) {
+			fprintf (stderr,"download: %llu frames, %.0f frames/s\r", (unsigned long long)n,
+				(n - skip) * 1e9 / (now - t0));
+			next_report = now + 1000000000ULL;
+		}
+	}
+	if (a != NULL) {
+		analysis_finish (a);
 	}
+	out->flush(out);
 
-	return 0;
+	if (!quiet_mode) {
+		double seconds = (ads1x9x_now_ns() - t0) * 1e-9;
+		fprintf (stderr,"download: %llu frames (%llu resumed), %.1f s of data in %.1f s%s\n",
+			(unsigned long long)n, (unsigned long long)(n < skip ? n : skip),
+			n * EVM_DOWNLOAD_ROWS / (double)EVM_STREAM_SPS, seconds, complete ? "" : ", incomplete");
+	}
+	if (p->lost_frames > 0) {
+		warning ("about %llu frames lost in transfer, output has gaps", (unsigned long long)p->lost_frames);
+	}
+	return complete ? (int64_t)n : -1;
 }
 
 /**
- * Write a command to ADS1x9x EVM. Commands are:
- * CMD_REG_WRITE (0x91): register, value
- * CMD_REG_READ (0x92): register, 0x00
- * CMD_DATA_STREAMING (0x93): on/off, 0x00  (0x00 = off, 0x01 = on)
+ * Stream from several EVMs at once and merge them onto one host timebase
+ * at EVM_STREAM_SPS. Devices are polled and each frame timestamped on
+ * arrival to track each device's clock offset and drift.
  *
- * @return Always 0.
+ * @param nrows Number of merged rows to write, each the time in us since
+ * the first row then ch1 ch2 of each device
+ * @param max_latency_ms Longest a row waits for a slow device
+ * @return Number of rows written.
  */
+int merge_streams (ads1x9x_transport_t **ts, int n, ads1x9x_sink_t *out, int nrows, int format, int max_latency_ms) {
+	ads1x9x_evm_parser_t *parsers = calloc(n, sizeof(ads1x9x_evm_parser_t));
+	ads1x9x_merge_t *m = ads1x9x_merge_new(n, EVM_NCHANNELS, EVM_STREAM_SPS, EVM_STREAM_SPS * 16, max_latency_ms);
+	ads1x9x_evm_frame_t frame;
+	struct pollfd pfd[MAX_MERGE_DEVICES];
+	int pidx[MAX_MERGE_DEVICES];
+	int ended[MAX_MERGE_DEVICES] = {0};
+	int32_t samples[EVM_STREAM_ROWS * EVM_NCHANNELS];
+	int32_t row[MAX_MERGE_DEVICES * EVM_NCHANNELS];
+	uint8_t buf[1024];
+	uint64_t t_row, t_first = 0;
+	int i, j, rows = 0, r = 0;
+
+	if (parsers == NULL || m == NULL) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		ads1x9x_evm_parser_init(&parsers[i], ts[i]);
+		ads1x9x_evm_write_cmd(ts[i], CMD_DATA_STREAMING, 0x00, 0x00);
+	}
 
-int ads1x9x_evm_write_cmd (int fd, int cmd, int param0, int param1) {
+	while (rows < nrows && r >= 0 && !exit_flag) {
+		// Transports without a descriptor (emulator) are always ready
+		int npoll = 0, immediate = FALSE;
+		for (i = 0; i < n; i++) {
+			pidx[i] = -1;
+			if (ended[i]) {
+				continue;
+			}
+			if (ts[i]->fd >= 0) {
+				pfd[npoll].fd = ts[i]->fd;
+				pfd[npoll].events = POLLIN;
+				pidx[i] = npoll++;
+			} else {
+				immediate = TRUE;
+			}
+		}
+		if (poll(pfd, npoll, immediate ? 0 : 10) < 0 && errno != EINTR) {
+			break;
+		}
 
-	cmd_buf[0] = START_DATA_HEADER;
-	cmd_buf[1] = cmd;
-	cmd_buf[2] = param0;
-	cmd_buf[3] = param1;
-	cmd_buf[4] = END_DATA_HEADER;
-	cmd_buf[5] = END_DATA_HEADER;
-	cmd_buf[6] = 0x0A;
+		for (i = 0; i < n; i++) {
+			if (ended[i] || (pidx[i] >= 0 && pfd[pidx[i]].revents == 0)) {
+				continue;
+			}
+			int len = ads1x9x_transport_read(ts[i], buf, sizeof(buf));
+			uint64_t now = ads1x9x_now_ns();
+			if (len <= 0) {
+				if (len < 0 && errno == EINTR) {
+					continue;
+				}
+				debug (1, "merge: end of input from %s", ts[i]->name);
+				ended[i] = TRUE;
+				ads1x9x_merge_end(m, i);
+				continue;
+			}
+			for (j = 0; j < len; ) {
+				j += ads1x9x_evm_parser_feed(&parsers[i], buf + j, len - j);
+				while (ads1x9x_evm_parse(&parsers[i], &frame) == 1) {
+					if (frame.type == CMD_DATA_STREAMING) {
+						ads1x9x_evm_decode_stream(frame.data, samples);
+						ads1x9x_merge_push(m, i, now, samples, EVM_STREAM_ROWS);
+					}
+				}
+			}
+		}
 
-	write (fd, &cmd_buf, 7);
+		uint64_t now = ads1x9x_now_ns();
+		while (rows < nrows && (r = ads1x9x_merge_pop(m, now, &t_row, row)) == 1) {
+			if (rows == 0) {
+				t_first = t_row;
+			}
+			if (format == FORMAT_BINARY) {
+				out->write(out, row, n * EVM_NCHANNELS * sizeof(int32_t));
+			} else {
+				ads1x9x_sink_printf(out, "%llu", (unsigned long long)(t_row - t_first) / 1000);
+				for (j = 0; j < n * EVM_NCHANNELS; j++) {
+					ads1x9x_sink_printf(out, " %d", row[j]);
+				}
+				out->write(out, "\n", 1);
+			}
+			rows++;
+		}
+	}
 
-	return 0;
+	for (i = 0; i < n; i++) {
+		ads1x9x_evm_write_cmd(ts[i], CMD_DATA_STREAMING, 0x00, 0x00);
+		debug (1, "merge: %s rate %.3f sps offset %.6f s", ts[i]->name, 1.0 / m->in[i].b, m->in[i].a);
+	}
+	debug (1, "merge: %llu rows, %llu gaps, %llu overruns", (unsigned long long)m->rows,
+		(unsigned long long)m->gaps, (unsigned long long)m->overruns);
+	ads1x9x_merge_free(m);
+	free(parsers);
+	return rows;
 }
 
 int main( int argc, char **argv) {
 
 	int speed = 9600;
 	int stream_format = FORMAT_DECIMAL;
+	int uring_depth = 0;
+	int link_tuning = FALSE;
+	int resume = FALSE;
+	uint64_t resume_frames = 0;
+	char *output_file = NULL;
+	char *metrics_file = NULL;
+	char *record_dir = NULL;
+	int hrv_window = 0;
+	int breath_detect = FALSE;
+	char *alarm_limits = NULL;
+	int quality_gate = FALSE;
+	char *template_file = NULL;
+	char *trace_file = NULL;
+	char *alarm_socket = NULL;
+	char *alarm_webhook = NULL;
+	int spectrum_report = FALSE;
+	int auto_notch = FALSE;
 
 	char *device;
 	char *command;
@@ -469,14 +1010,25 @@ int main( int argc, char **argv) {
 	act.sa_flags = SA_SIGINFO;
 	sigaction(SIGPIPE, &act, NULL);
 
+	signal(SIGUSR1, metrics_signal_handler);
+
 
 	// Parse command line arguments. See usage() for details.
 	int c;
-	while ((c = getopt(argc, argv, "b:c:d:f:hqs:t:v")) != -1) {
+	while ((c = getopt(argc, argv, "aA:b:Bc:d:f:hH:LM:No:qQR:s:St:T:u:U:vw:W:")) != -1) {
 		switch(c) {
+			case 'a':
+				resume = TRUE;
+				break;
+			case 'A':
+				alarm_limits = optarg;
+				break;
 			case 'b':
 				speed = atoi (optarg);
 				break;
+			case 'B':
+				breath_detect = TRUE;
+				break;
 			case 'd':
 				debug_level = atoi (optarg);
 				break;
@@ -486,8 +1038,58 @@ int main( int argc, char **argv) {
 					stream_format = FORMAT_BINARY;
 				} else if (optarg[0] == 'r') {
 					stream_format = FORMAT_RAW;
+				} else if (optarg[0] == 'w') {
+					stream_format = FORMAT_WIRE;
 				}
 				break;
+
+			case 'N':
+				auto_notch = TRUE;
+				break;
+
+			case 'o':
+				output_file = optarg;
+				break;
+
+			case 'H':
+				hrv_window = atoi (optarg);
+				break;
+
+			case 'L':
+				link_tuning = TRUE;
+				break;
+
+			case 'M':
+				metrics_file = optarg;
+				break;
+
+			case 'R':
+				record_dir = optarg;
+				break;
+
+			case 'S':
+				spectrum_report = TRUE;
+				break;
+
+			case 'T':
+				template_file = optarg;
+				break;
+
+			case 'u':
+				alarm_socket = optarg;
+				break;
+
+			case 'U':
+				uring_depth = atoi (optarg);
+				break;
+
+			case 'w':
+				trace_file = optarg;
+				break;
+
+			case 'W':
+				alarm_webhook = optarg;
+				break;
 			
 
 			case 'h':
@@ -499,6 +1101,10 @@ int main( int argc, char **argv) {
 				quiet_mode = TRUE;
 				break;
 
+			case 'Q':
+				quality_gate = TRUE;
+				break;
+
 			case 'v':
 				version();
 				exit(EXIT_SUCCESS);
@@ -517,6 +1123,11 @@ int main( int argc, char **argv) {
 		}
 	}
 
+	// probe [device...] lists the devices that answer
+	if (argc - optind >= 1 && strcmp(argv[optind],"probe")==0) {
+		return probe (argv + optind + 1, argc - optind - 1, speed) > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	// One parameters are mandatory
 	if (argc - optind < 2) {
 		fprintf (stderr,"Error: missing command arguments. Use -h for help.\n");
@@ -526,6 +1137,24 @@ int main( int argc, char **argv) {
 	device = argv[optind];
 	command = argv[optind+1];
 
+	// auto picks the first EVM that answers a probe, or all of them for merge
+	if (strcmp(device,"auto")==0) {
+		device = probe_auto(speed, strcmp(command,"merge")==0);
+		if (device == NULL) {
+			fprintf (stderr,"Error: no EVM found\n");
+			return EXIT_FAILURE;
+		}
+		debug (1, "auto: %s", device);
+	}
+
+	// merge takes a comma separated list of devices. The first is opened
+	// below like any other; merge opens the rest.
+	char *devices = device;
+	char *comma = strchr(devices, ',');
+	if (comma != NULL) {
+		device = strndup(devices, comma - devices);
+	}
+
 	if (debug_level > 0) {
 		debug (1,"device=%s",device);
 		debug (1,"command=%d",command);
@@ -535,32 +1164,215 @@ int main( int argc, char **argv) {
 		fprintf (stderr,"DEBUG: debug level %d\n",debug_level);
 	}
 	
+	if (ads1x9x_metrics_init(metrics_file, 1000) < 0) {
+		warning ("unable to start metrics thread");
+	}
+
+	// Protocol trace, one interface per device
+	ads1x9x_pcapng_t *trace = NULL;
+	if (trace_file != NULL) {
+		ads1x9x_sink_t *trace_out = strcmp(trace_file,"-")==0
+			? ads1x9x_sink_open_fd(STDOUT_FILENO, FALSE)
+			: ads1x9x_sink_open_file(trace_file);
+		if (trace_out == NULL || (trace = ads1x9x_pcapng_open(trace_out, APP_NAME " " VERSION)) == NULL) {
+			fprintf (stderr,"Error: unable to write trace to %s\n", trace_file);
+			return EXIT_FAILURE;
+		}
+	}
+
 	// Open device
-	int fd = ads1x9x_evm_open(device,speed);
-	if (fd < 1 ) {
+	ads1x9x_transport_t *t = ads1x9x_evm_open(device,speed);
+	if (t == NULL) {
 		fprintf (stderr,"Error: unable to open device %s\n", device);
 		return EXIT_FAILURE;
 	}
+	if (trace != NULL) {
+		t->trace = trace;
+		t->trace_interface = ads1x9x_pcapng_add_interface(trace, device);
+	}
 
 
 	// Ignore anything aleady in the buffer
-	tcflush (fd,TCIFLUSH);
+	if (t->fd >= 0) {
+		tcflush (t->fd,TCIFLUSH);
+	}
+
+	if (link_tuning && strcmp(t->name,"serial")==0) {
+		// Let a read return once a whole streaming frame has arrived, or
+		// 0.1s after the last byte.
+		if (ads1x9x_serial_set_read_size(t->fd, EVM_STREAM_PAYLOAD + 4, 1) < 0) {
+			warning ("unable to set VMIN/VTIME on %s", device);
+		}
+		if (ads1x9x_serial_set_low_latency(t->fd) < 0) {
+			debug (1, "driver for %s does not support ASYNC_LOW_LATENCY", device);
+		}
+		debug (1, "link speed requested %d bps, set %d bps", speed, ads1x9x_serial_get_speed(t->fd));
+	}
+
+	// Output sink for stream data
+	int out_fd = STDOUT_FILENO;
+	if (output_file != NULL) {
+		out_fd = open(output_file, O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+		if (out_fd < 0) {
+			fprintf (stderr,"Error: unable to open output file %s\n", output_file);
+			return EXIT_FAILURE;
+		}
+	}
+	if (resume) {
+		// Keep the whole frames of an interrupted download and append
+		int frame_bytes = download_frame_bytes(stream_format);
+		struct stat st;
+		if (output_file == NULL || frame_bytes == 0 || fstat(out_fd, &st) < 0) {
+			fprintf (stderr,"Error: resume needs -o file and format b, r or w\n");
+			return EXIT_FAILURE;
+		}
+		resume_frames = st.st_size / frame_bytes;
+		if (ftruncate(out_fd, resume_frames * frame_bytes) < 0
+				|| lseek(out_fd, 0, SEEK_END) < 0) {
+			fprintf (stderr,"Error: unable to resume %s\n", output_file);
+			return EXIT_FAILURE;
+		}
+		debug (1, "resuming after %llu frames", (unsigned long long)resume_frames);
+	}
+	ads1x9x_sink_t *out = NULL;
+
+	if (record_dir != NULL && strcmp("archive",command)==0) {
+		// archive splices to out_fd, bypassing any user space sink
+		fprintf (stderr,"Error: archive writes to -o file or stdout and cannot use -R\n");
+		return EXIT_FAILURE;
+	}
+	if (record_dir != NULL) {
+		int segment_mb = 64, segment_s = 0, sync_ms = 1000;
+		char *comma = strchr(record_dir, ',');
+		if (comma != NULL) {
+			*comma = '\0';
+			sscanf(comma + 1, "%d,%d,%d", &segment_mb, &segment_s, &sync_ms);
+		}
+		out = ads1x9x_recorder_open(record_dir, (uint64_t)segment_mb << 20, segment_s, sync_ms);
+		if (out == NULL) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (uring_depth > 0 && strcmp("archive",command)==0) {
+		// archive splices from the device to out_fd: a read queued by the
+		// io_uring transport would race it for the first bytes, and an
+		// output sink would never be written
+		warning ("-U has no effect on archive");
+	} else if (uring_depth > 0) {
+		ads1x9x_transport_t *ut = ads1x9x_uring_transport(t, uring_depth);
+		if (ut != NULL) {
+			t = ut;
+		} else {
+			warning ("io_uring not available for device %s", device);
+		}
+		// A -R recorder writes its segments itself, from its own thread
+		if (out == NULL) {
+			out = ads1x9x_uring_sink(out_fd, output_file != NULL, uring_depth);
+		}
+		if (out == NULL) {
+			warning ("io_uring not available for output");
+		}
+	}
+	if (out == NULL) {
+		out = ads1x9x_sink_open_fd(out_fd, output_file != NULL);
+	}
+	if (alarm_limits != NULL && (strcmp("stream",command)==0 || strcmp("bench",command)==0)) {
+		// Alarms are evaluated as frames are read, so a stalled reader
+		// of the output must not hold up reading
+		ads1x9x_sink_t *q = ads1x9x_queue_sink_open(out, ALARM_OUTPUT_QUEUE);
+		if (q == NULL) {
+			fprintf (stderr,"Error: unable to start output thread\n");
+			return EXIT_FAILURE;
+		}
+		out = q;
+	}
+
+	// Analysis stages on the sample stream
+	analysis_t analysis;
+	ads1x9x_rpeak_t rpeak;
+	ads1x9x_hrv_t hrv;
+	int analysis_on = FALSE;
+	memset(&analysis, 0, sizeof(analysis));
+	analysis.format = stream_format;
+	analysis.out = out;
+	if (hrv_window > 0) {
+		ads1x9x_rpeak_init(&rpeak, EVM_STREAM_SPS);
+		ads1x9x_hrv_init(&hrv, hrv_window);
+		analysis.rpeak = &rpeak;
+		analysis.hrv = &hrv;
+		analysis_on = TRUE;
+	}
+	ads1x9x_resp_t resp;
+	if (breath_detect) {
+		ads1x9x_resp_init(&resp, EVM_STREAM_SPS);
+		analysis.resp = &resp;
+		analysis_on = TRUE;
+	}
+	ads1x9x_quality_t quality;
+	if (quality_gate) {
+		// acquire_data and downloads carry 24 bit samples, 8 rows a frame
+		if (strcmp("acquire_data",command)==0 || strcmp("data_download",command)==0) {
+			ads1x9x_quality_init(&quality, 24, EVM_NCHANNELS, 1,
+				QUALITY_BLOCK_ACQUIRE_FRAMES * EVM_ACQUIRE_ROWS);
+		} else {
+			ads1x9x_quality_init(&quality, 16, EVM_NCHANNELS, 1, QUALITY_BLOCK_FRAMES * EVM_STREAM_ROWS);
+		}
+		analysis.quality = &quality;
+		analysis.marks = out;
+		// Hold output for the verdicts. A download saved in b, r or w
+		// format is kept whole so that -a can resume it, with gaps only
+		// reported. Other commands are not analysed and write straight
+		// through.
+		if (strcmp("stream",command)==0 || strcmp("bench",command)==0
+				|| strcmp("acquire_data",command)==0
+				|| (strcmp("data_download",command)==0 && stream_format == FORMAT_DECIMAL)) {
+			out = analysis.out = analysis.gate = ads1x9x_gate_sink_open(out);
+		}
+		analysis_on = TRUE;
+	}
+	ads1x9x_alarm_t alarm;
+	ads1x9x_notifier_t *notifier = NULL;
+	if (alarm_limits != NULL) {
+		double hr_low = 40, hr_high = 150;
+		sscanf(alarm_limits, "%lf,%lf", &hr_low, &hr_high);
+		notifier = ads1x9x_notifier_start(TRUE, alarm_socket, alarm_webhook);
+		if (notifier == NULL) {
+			return EXIT_FAILURE;
+		}
+		ads1x9x_alarm_init(&alarm, 0, EVM_STREAM_SPS, hr_low, hr_high, notifier);
+		analysis.alarm = &alarm;
+		analysis_on = TRUE;
+	}
+	ads1x9x_fft_plan_t *fft_plan = NULL;
+	ads1x9x_spectrum_t spectrum;
+	if (spectrum_report || auto_notch) {
+		fft_plan = ads1x9x_fft_plan_new(ADS1X9X_SPECTRUM_N);
+		ads1x9x_spectrum_init(&spectrum, fft_plan, EVM_STREAM_SPS);
+		analysis.spectrum = &spectrum;
+		analysis.spectrum_report = spectrum_report;
+		analysis.notch_t = auto_notch ? t : NULL;
+		analysis_on = TRUE;
+	}
+
+	ads1x9x_evm_parser_t parser;
+	ads1x9x_evm_parser_init(&parser, t);
 
 	ads1x9x_evm_frame_t frame;
 
 
 	if (strcmp("readreg",command)==0) {
 		int reg = atoi(argv[optind+2]);
-		ads1x9x_evm_write_cmd(fd,CMD_REG_READ,reg,0x00);
-		ads1x9x_evm_read_frame (fd, &frame);
+		ads1x9x_evm_write_cmd(t,CMD_REG_READ,reg,0x00);
+		ads1x9x_evm_read_frame (&parser, &frame);
 		fprintf (stdout, "%x\n", frame.data[1]);
 	}
 
 	else if (strcmp("writereg",command)==0) {
 		int reg = atoi(argv[optind+2]);
 		int val = atoi(argv[optind+3]);
-		ads1x9x_evm_write_cmd(fd,CMD_REG_WRITE,reg,val);
-		ads1x9x_evm_read_response(fd);
+		ads1x9x_evm_write_cmd(t,CMD_REG_WRITE,reg,val);
+		ads1x9x_evm_read_response(&parser);
 	}
 
 
@@ -568,10 +1380,10 @@ int main( int argc, char **argv) {
 		int filterOpt = atoi(argv[optind+2]);
 		// Not clear what the purpose of the first param is. FW code ignores
 		// the filter command if not 0,2,3, but is otherwise not used.
-		ads1x9x_evm_write_cmd(fd,CMD_FILTER_SELECT,0x03,filterOpt);
+		ads1x9x_evm_write_cmd(t,CMD_FILTER_SELECT,0x03,filterOpt);
 
 		// Read back ack and ignore
-		ads1x9x_evm_read_frame (fd, &frame);
+		ads1x9x_evm_read_frame (&parser, &frame);
 	}
 
 	// Start continuous data streaming by issuing ADS1x9x Read Data Continuous (RDATAC) command.
@@ -581,46 +1393,70 @@ int main( int argc, char **argv) {
 
 		// Turn on continuous data streaming. This works as a toggle command. Parameters
 		// are ignored.
-		ads1x9x_evm_write_cmd(fd,CMD_DATA_STREAMING,0x00,0x00);
+		ads1x9x_evm_write_cmd(t,CMD_DATA_STREAMING,0x00,0x00);
+
+		struct timespec t0, t1;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		int n = stream_frames (&parser, out, nframe, stream_format, NULL, analysis_on ? &analysis : NULL);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (link_tuning) {
+			report_link (t, n, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+		}
+		debug_parser_stats (&parser);
 
-		int i,j;
-		uint8_t heart_rate,respiration_rate,lead_off;
-		int16_t sample;
-		for (j = 0; j < nframe; j++) {
-			ads1x9x_evm_read_frame (fd, &frame);
-			switch (stream_format) {
-				case FORMAT_RAW:
-					write (STDOUT_FILENO, &frame.data, 59);
-					break;
-				default:
-					heart_rate = frame.data[0];
-					respiration_rate = frame.data[1];
-					lead_off = frame.data[2];
-			
-					for (i = 0; i < 14; i++) {
-					// TODO: can we just cast sample rather than all this bit fiddling
-						sample = frame.data[i*4 + 4]<<8 | frame.data[i*4 + 3];
-						fprintf (stdout,"%d ", sample);
-						sample = frame.data[i*4 + 6]<<8 | frame.data[i*4 + 5];
-						fprintf (stdout,"%d ", sample);
-						fprintf (stdout,"%d %d %d \n",heart_rate,respiration_rate,lead_off);
-					}
+		// Turn off continuous data streaming by reissuing CMD_DATA_STREAMING
+		ads1x9x_evm_write_cmd(t,CMD_DATA_STREAMING,0x00,0x00);
+	}
+
+	// Archive the raw byte stream. Once streaming is started bytes are
+	// spliced from the device to the output without passing through user
+	// space. With "check", or a -w trace, a tee'd copy is also read back
+	// to count and check frames.
+	else if (strcmp("archive",command)==0) {
+		int nframe = atoi(argv[optind+2]);
+		int checked = trace != NULL || (argc - optind > 3 && strcmp("check",argv[optind+3])==0);
+		ads1x9x_splice_stats_t stats;
+		ads1x9x_evm_parser_t check;
+		memset(&stats, 0, sizeof(stats));
+		ads1x9x_evm_parser_init(&check, NULL);
+		check.trace = t->trace;
+		check.trace_interface = t->trace_interface;
+
+		if (t->fd < 0) {
+			fprintf (stderr,"Error: archive needs a serial device or file\n");
+		} else {
+			ads1x9x_evm_write_cmd(t,CMD_DATA_STREAMING,0x00,0x00);
+			out->flush(out);
+			if (ads1x9x_splice_capture (t->fd, out_fd, (uint64_t)nframe * (EVM_STREAM_PAYLOAD + 4),
+					checked ? &check : NULL, &stats, &exit_flag) < 0) {
+				warning ("archive ended early: %s", strerror(errno));
+			}
+			ads1x9x_evm_write_cmd(t,CMD_DATA_STREAMING,0x00,0x00);
+			debug (1, "archive: %llu bytes, %llu splice calls",
+				(unsigned long long)stats.bytes, (unsigned long long)stats.splice_calls);
+			if (checked) {
+				debug_parser_stats (&check);
 			}
 		}
+	}
 
-		// Turn off continuous data streaming by reissuing CMD_DATA_STREAMING
-		ads1x9x_evm_write_cmd(fd,CMD_DATA_STREAMING,0x00,0x00);
+	else if (strcmp("bench",command)==0) {
+		int nframe = atoi(argv[optind+2]);
+		ads1x9x_evm_write_cmd(t,CMD_DATA_STREAMING,0x00,0x00);
+		bench (&parser, out, nframe, stream_format, analysis_on ? &analysis : NULL);
+		debug_parser_stats (&parser);
+		ads1x9x_evm_write_cmd(t,CMD_DATA_STREAMING,0x00,0x00);
 	}
 
 	else if (strcmp("firmware",command)==0) {
-		ads1x9x_evm_write_cmd(fd,CMD_QUERY_FIRMWARE_VERSION,0x00,0x00);
-		ads1x9x_evm_read_frame (fd, &frame);
+		ads1x9x_evm_write_cmd(t,CMD_QUERY_FIRMWARE_VERSION,0x00,0x00);
+		ads1x9x_evm_read_frame (&parser, &frame);
 
-		ads1x9x_evm_read_response(fd);
+		ads1x9x_evm_read_response(&parser);
 	}
 
 	else if (strcmp("restart",command)==0) {
-		ads1x9x_evm_write_cmd(fd,CMD_RESTART,0x00,0x00);
+		ads1x9x_evm_write_cmd(t,CMD_RESTART,0x00,0x00);
 	}
 
 	else if (strcmp("acquire_data",command)==0) {
@@ -630,42 +1466,116 @@ int main( int argc, char **argv) {
 		// Make nsamples a whole multiple of 8
 		nsamples = (nsamples>>3)<<3;
 
-		ads1x9x_evm_write_cmd(fd,CMD_ACQUIRE_DATA,nsamples>>8,nsamples&0xff);
+		ads1x9x_evm_write_cmd(t,CMD_ACQUIRE_DATA,nsamples>>8,nsamples&0xff);
 
 		// Read back ack from CMD_ACQUIRE_DATA command
-		ads1x9x_evm_read_frame_to_eod (fd, &frame);
+		ads1x9x_evm_read_frame_to_eod (&parser, &frame);
+
+		// Beat templates are large, so not on the stack
+		static ads1x9x_template_t templates;
+		ads1x9x_template_writer_t *template_writer = NULL;
+		ads1x9x_beat_t beat;
+		if (template_file != NULL) {
+			ads1x9x_template_init(&templates, EVM_STREAM_SPS);
+			template_writer = ads1x9x_template_writer_start(template_file, TEMPLATE_WRITE_MS);
+			if (template_writer == NULL) {
+				fprintf (stderr,"Error: unable to start template writer\n");
+				return EXIT_FAILURE;
+			}
+		}
 
 		// Echo data
 		int i,j;
-		int nframes = nsamples/8;
-		int32_t sample;
+		int nframes = nsamples/EVM_ACQUIRE_ROWS;
+		int32_t samples[EVM_ACQUIRE_ROWS * EVM_NCHANNELS];
 		for (j = 0; j < nframes; j++) {
-			ads1x9x_evm_read_frame(fd,&frame);
-			for (i = 0; i < 8; i++) {
-				sample = (frame.data[i*6+2]<<16) | (frame.data[i*6+3]<<8) | (frame.data[i*6+4]);
-				sample << 8;
-				fprintf (stdout, "%d ", sample);
-				sample = (frame.data[i*6+5]<<16) | (frame.data[i*6+6]<<8) | (frame.data[i*6+7]);
-				sample << 8;
-				fprintf (stdout, "%d \n", sample);
+			if (ads1x9x_evm_read_frame(&parser,&frame) < 0) {
+				break;
+			}
+			ads1x9x_evm_decode_acquire (frame.data, samples);
+			if (quality_gate) {
+				analyse_acquire_frame (&analysis, frame.data, samples);
+			}
+			for (i = 0; i < EVM_ACQUIRE_ROWS; i++) {
+				ads1x9x_sink_printf (out, "%d %d \n", samples[i*2], samples[i*2 + 1]);
+				if (template_file != NULL && ads1x9x_template_process(&templates, samples[i*2 + 1], &beat)) {
+					ads1x9x_sink_printf (out, "#beat %.3f %d %.3f %d\n", (double)beat.r_index / EVM_STREAM_SPS,
+						beat.cluster, beat.corr, beat.lag);
+					ads1x9x_template_writer_update(template_writer, &templates);
+				}
+			}
+			if (quality_gate) {
+				analysis_frame_done (&analysis);
 			}
-		}	
+		}
+		if (quality_gate) {
+			analysis_finish (&analysis);
+		}
+		if (template_writer != NULL && ads1x9x_template_writer_stop(template_writer) < 0) {
+			warning ("templates in %s are not up to date", template_file);
+		}
 	}
 	else if (strcmp("packet_read",command)==0) {
-		ads1x9x_evm_read_frame_to_eod(fd,&frame);
+		ads1x9x_evm_read_frame_to_eod(&parser,&frame);
 	}
 	else if (strcmp("erase_flash",command)==0) {
-		ads1x9x_evm_write_cmd(fd,CMD_ERASE_MEMORY,0x00,0x00);
+		ads1x9x_evm_write_cmd(t,CMD_ERASE_MEMORY,0x00,0x00);
 		// No response to this command.
-		//ads1x9x_evm_read_frame_to_eod(fd,&frame);
+		//ads1x9x_evm_read_frame_to_eod(&parser,&frame);
+	}
+	else if (strcmp("merge",command)==0) {
+		int nrows = atoi(argv[optind+2]);
+		int latency_ms = argc - optind > 3 ? atoi(argv[optind+3]) : 200;
+		ads1x9x_transport_t *ts[MAX_MERGE_DEVICES];
+		int n = 1, ok = TRUE;
+		ts[0] = t;
+		while (comma != NULL && n < MAX_MERGE_DEVICES) {
+			char *name = comma + 1;
+			comma = strchr(name, ',');
+			name = comma != NULL ? strndup(name, comma - name) : name;
+			ts[n] = ads1x9x_evm_open(name, speed);
+			if (ts[n] == NULL) {
+				fprintf (stderr,"Error: unable to open device %s\n", name);
+				ok = FALSE;
+				break;
+			}
+			if (trace != NULL) {
+				ts[n]->trace = trace;
+				ts[n]->trace_interface = ads1x9x_pcapng_add_interface(trace, name);
+			}
+			if (ts[n]->fd >= 0) {
+				tcflush (ts[n]->fd,TCIFLUSH);
+			}
+			n++;
+		}
+		if (ok) {
+			merge_streams (ts, n, out, nrows, stream_format, latency_ms);
+		}
+		for (n = n - 1; n > 0; n--) {
+			ads1x9x_evm_close(ts[n]);
+		}
 	}
 	else if (strcmp("data_download",command)==0) {
-		ads1x9x_evm_write_cmd(fd,CMD_DATA_DOWNLOAD,0x00,0x00);
-		ads1x9x_evm_read_frame_to_eod(fd,&frame);
+		if (download (&parser, out, stream_format, resume_frames, quality_gate ? &analysis : NULL) < 0) {
+			warning ("download incomplete, rerun with -a to resume");
+		}
+		debug_parser_stats (&parser);
 	} else {
 		fprintf (stderr,"Unrecognized command %s\n",command);
 	}
-	ads1x9x_evm_close(fd);
+	ads1x9x_sink_close(out);
+	ads1x9x_evm_close(t);
+	if (trace != NULL) {
+		ads1x9x_pcapng_close(trace);
+	}
+	if (fft_plan != NULL) {
+		ads1x9x_fft_plan_free(fft_plan);
+	}
+	if (notifier != NULL) {
+		ads1x9x_notifier_stop(notifier);
+	}
+
+	ads1x9x_metrics_stop();
 
 	debug (1, "Normal exit");
 	return EXIT_SUCCESS; 
@@ -0,0 +1,180 @@
+/**
+ * ads1x9x.h - definitions shared by all tools that talk to a TI ADS1x9x
+ * ECG/EEG AFE, either directly over SPI or through the EVM firmware.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_H
+#define ADS1X9X_H
+
+#include <stdint.h>
+
+#define TRUE 1
+#define FALSE 0
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// ADS1x9x SPI opcodes. ADS129x[R] datasheet, Table 12.
+#define CMD_WAKEUP 0x02
+#define CMD_STANDBY 0x04
+#define CMD_RESET 0x06
+#define CMD_START 0x08
+#define CMD_STOP 0x0a
+#define CMD_OFFSETCAL 0x1a
+#define CMD_RDATAC 0x10
+#define CMD_SDATAC 0x11
+#define CMD_RDATA 0x12
+#define CMD_RREG 0x20
+#define CMD_WREG 0x40
+
+// ADS1292R registers. ADS129x[R] datasheet, Table 14, page 39.
+// RegAddr RegName: Bit7 Bit6 .. Bit0 [value on reset]
+// 0x00 ID: REV_ID7 REV_ID6 REV_ID5 1 0 0 REV_ID1 REV_ID0 [factory programmed]
+// 0x01 CONFIG1: SINGLE-SHOT 0 0 0 0 DR2 DR1 DR0 [0x02 on reset]
+// 0x02 CONFIG2: 1 PBD_LOFF_COMP PDB_REFBUF VREF_4V CLK_EN 0 INT_TEST TEST_FREQ [0x80 on reset]
+// 0x03 LOFF: COMP_TH2 COMP_TH1 COMP_TH0 1 ILEAD_OFF1 ILEAD_OFF0 0 FLEAD_OFF [0x10 on reset]
+// 0x04 CH1SET: PD1 GAIN1_2 GAIN1_1 GAIN1_0 MUX1_3 MUX1_2 MUX1_1 MUX1_0 [0x00]
+// 0x05 CH2SET: PD2 GAIN2_2 GAIN2_1 GAIN2_0 MUX2_3 MUX2_2 MUX2_1 MUX2_0 [0x00]
+//
+#define REG_ID 0x00
+#define REG_CONFIG1 0x01
+#define REG_CONFIG2 0x02
+#define REG_LOFF 0x03
+#define REG_CH1SET 0x04
+#define REG_CH2SET 0x05
+
+/*
+ * Sample decoding.
+ *
+ * Samples reach the host in one of three encodings: 24 bit big endian
+ * two's complement straight from the ADC, 16 bit big endian from the
+ * ADS119x parts, and 16 bit little endian from the EVM firmware after
+ * its DSP filtering. ADS1X9X_WIDTH_<enc> gives the byte width of each.
+ */
+#define ADS1X9X_WIDTH_s16le 2
+#define ADS1X9X_WIDTH_s16be 2
+#define ADS1X9X_WIDTH_s24be 3
+
+static inline int32_t ads1x9x_sample_s16le (const uint8_t *p) {
+	return (int16_t)(p[0] | p[1] << 8);
+}
+
+static inline int32_t ads1x9x_sample_s16be (const uint8_t *p) {
+	return (int16_t)(p[0] << 8 | p[1]);
+}
+
+static inline int32_t ads1x9x_sample_s24be (const uint8_t *p) {
+	// Shift into the top of a 32 bit word and back down to sign extend
+	return (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8) >> 8;
+}
+
+/**
+ * A view of the samples inside a frame buffer. Nothing is copied: data
+ * points at the first byte of the first sample of the first row.
+ */
+typedef struct {
+	const uint8_t *data;
+	int nrows;      // number of sample instants
+	int nchannels;  // samples per row
+	int width;      // bytes per sample
+	int stride;     // bytes from the start of one row to the next
+	int big_endian;
+} ads1x9x_span_t;
+
+/**
+ * Return sample for channel ch of row i of a span. For use off the hot
+ * path; frame decoders generated by ADS1X9X_DEFINE_DECODER() are faster.
+ */
+static inline int32_t ads1x9x_span_sample (const ads1x9x_span_t *span, int i, int ch) {
+	const uint8_t *p = span->data + i * span->stride + ch * span->width;
+	if (span->width == 3) {
+		return ads1x9x_sample_s24be(p);
+	}
+	return span->big_endian ? ads1x9x_sample_s16be(p) : ads1x9x_sample_s16le(p);
+}
+
+/**
+ * Define a decoder for a fixed frame layout:
+ *
+ *   static inline void name (const uint8_t *frame, int32_t *out);
+ *
+ * 'frame' points at the start of the frame and 'out' receives
+ * NROWS x NCH samples, row major. All layout parameters are compile time
+ * constants so the compiler emits straight-line code with no branching
+ * on layout.
+ *
+ * @param name Function name
+ * @param ENC Sample encoding: s16le, s16be or s24be
+ * @param OFFSET Bytes from start of frame to first sample
+ * @param NROWS Sample instants per frame
+ * @param NCH Channels per sample instant
+ */
+#define ADS1X9X_DEFINE_DECODER(name, ENC, OFFSET, NROWS, NCH) \
+static inline void name (const uint8_t *frame, int32_t *out) { \
+	const uint8_t *p = frame + (OFFSET); \
+	int i; \
+	for (i = 0; i < (NROWS) * (NCH); i++) { \
+		out[i] = ads1x9x_sample_##ENC(p + i * ADS1X9X_WIDTH_##ENC); \
+	} \
+}
+
+/*
+ * ADS1x9x family frame layouts. In RDATAC/RDATA mode each conversion is
+ * read as status bytes followed by one sample per channel, MSB first.
+ * ADS1x9x datasheets, "Data Retrieval".
+ *
+ * ADS1X9X_DEFINE_DEVICE(prefix, ...) defines <prefix>_NCHANNELS,
+ * <prefix>_FRAME_SIZE, and decoders for one frame and for n back to back
+ * frames, specialised for that part:
+ *
+ *   static inline void <prefix>_decode (const uint8_t *frame, int32_t *out);
+ *   static inline void <prefix>_decode_n (const uint8_t *frames, int n, int32_t *out);
+ */
+#define ADS1X9X_DEFINE_DEVICE(prefix, ENC, STATUS, NCH) \
+enum { \
+	prefix##_NCHANNELS = (NCH), \
+	prefix##_STATUS_BYTES = (STATUS), \
+	prefix##_FRAME_SIZE = (STATUS) + (NCH) * ADS1X9X_WIDTH_##ENC \
+}; \
+ADS1X9X_DEFINE_DECODER(prefix##_decode, ENC, STATUS, 1, NCH) \
+static inline void prefix##_decode_n (const uint8_t *frames, int n, int32_t *out) { \
+	int i; \
+	for (i = 0; i < n; i++) { \
+		prefix##_decode (frames + i * prefix##_FRAME_SIZE, out + i * (NCH)); \
+	} \
+}
+
+// 16 bit parts: 16 status bits + 16 bits per channel
+ADS1X9X_DEFINE_DEVICE(ads1191, s16be, 2, 1)
+ADS1X9X_DEFINE_DEVICE(ads1192, s16be, 2, 2)
+// 24 bit parts: 24 status bits + 24 bits per channel
+ADS1X9X_DEFINE_DEVICE(ads1291, s24be, 3, 1)
+ADS1X9X_DEFINE_DEVICE(ads1292, s24be, 3, 2)
+ADS1X9X_DEFINE_DEVICE(ads1292r, s24be, 3, 2)
+ADS1X9X_DEFINE_DEVICE(ads1294, s24be, 3, 4)
+ADS1X9X_DEFINE_DEVICE(ads1296, s24be, 3, 6)
+ADS1X9X_DEFINE_DEVICE(ads1298, s24be, 3, 8)
+
+#define ADS1X9X_MAX_CHANNELS 8
+#define ADS1X9X_MAX_FRAME_SIZE ads1298_FRAME_SIZE
+
+/**
+ * Run time description of a part, for code that only learns which part
+ * it is talking to from the ID register. Select the decoder once and
+ * call it per block of frames; there is no per-sample layout branching.
+ */
+typedef struct {
+	const char *name;
+	uint8_t id;           // REG_ID value
+	uint8_t nchannels;
+	uint8_t sample_bytes;
+	uint8_t status_bytes;
+	uint8_t frame_size;
+	void (*decode_n) (const uint8_t *frames, int n, int32_t *out);
+} ads1x9x_device_t;
+
+const ads1x9x_device_t *ads1x9x_device_by_id (int id);
+const ads1x9x_device_t *ads1x9x_device_by_name (const char *name);
+
+#endif
@@ -0,0 +1,424 @@
+/**
+ * ads1x9x_alarm.c - alarm engine and notifier thread.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_alarm.h"
+#include "ads1x9x_metrics.h"
+
+// Time a condition must be absent before its alarm clears, s
+static const double hold_s[ADS1X9X_NALARMS] = { 1, 5, 5, 1 };
+
+static const char *names[ADS1X9X_NALARMS] = { "lead_off", "hr_low", "hr_high", "flatline" };
+
+// Events waiting for the notifier and webhook threads
+#define QUEUE_SIZE 256
+#define WEBHOOK_TIMEOUT_MS 500
+
+typedef struct {
+	pthread_t thread;
+	int running;
+	pthread_cond_t cond;
+	ads1x9x_alarm_event_t events[QUEUE_SIZE];
+	unsigned head;
+	unsigned tail;
+	int stop;
+	uint64_t dropped;
+} event_queue_t;
+
+struct ads1x9x_notifier {
+	pthread_mutex_t lock;
+	// Events for stderr and the socket, then for the webhook, which can
+	// take up to WEBHOOK_TIMEOUT_MS per event and so has its own thread
+	event_queue_t local;
+	event_queue_t remote;
+
+	int to_stderr;
+	int sock;
+	struct sockaddr_un sock_addr;
+	int webhook;
+	struct sockaddr_storage webhook_addr;
+	socklen_t webhook_addr_len;
+	char webhook_host[256];
+	char webhook_path[512];
+};
+
+const char *ads1x9x_alarm_name (int alarm) {
+	return alarm >= 0 && alarm < ADS1X9X_NALARMS ? names[alarm] : "unknown";
+}
+
+/**
+ * @param hr_low, hr_high Heart rate limits, bpm
+ * @param notifier Receives the events
+ */
+void ads1x9x_alarm_init (ads1x9x_alarm_t *a, int device, int sps, double hr_low, double hr_high,
+	ads1x9x_notifier_t *notifier) {
+	memset(a, 0, sizeof(*a));
+	a->device = device;
+	a->sps = sps;
+	a->notifier = notifier;
+	a->hr_low = hr_low;
+	a->hr_high = hr_high;
+	a->hr_hysteresis = 5;
+	a->flat_range = 20;
+}
+
+/**
+ * Raise an alarm when its condition is present and clear it once the
+ * condition has been absent for the hold time.
+ */
+static void update (ads1x9x_alarm_t *a, int alarm, int present, uint64_t frame_ns, double t, double value) {
+	ads1x9x_alarm_event_t e;
+
+	if (present) {
+		a->last_seen[alarm] = t;
+		if (a->active[alarm]) {
+			return;
+		}
+		a->active[alarm] = TRUE;
+	} else if (!a->active[alarm] || t - a->last_seen[alarm] < hold_s[alarm]) {
+		return;
+	} else {
+		a->active[alarm] = FALSE;
+	}
+
+	e.frame_ns = frame_ns;
+	e.t = t;
+	e.device = a->device;
+	e.alarm = alarm;
+	e.raised = a->active[alarm];
+	e.value = value;
+	ads1x9x_notifier_post(a->notifier, &e);
+}
+
+/**
+ * Evaluate a decoded frame.
+ *
+ * @param frame_ns Host time the frame arrived
+ * @param t Stream time of the frame, s
+ * @param lead_off Lead-off status from the frame, non-zero if any lead is off
+ * @param ecg First ECG sample; the next is stride samples on
+ */
+void ads1x9x_alarm_frame (ads1x9x_alarm_t *a, uint64_t frame_ns, double t, int lead_off,
+	const int32_t *ecg, int stride, int nrows) {
+	int i;
+
+	update(a, ADS1X9X_ALARM_LEAD_OFF, lead_off != 0, frame_ns, t, lead_off);
+
+	for (i = 0; i < nrows; i++) {
+		int32_t x = ecg[i * stride];
+		if (a->block_n == 0 || x < a->block_min) {
+			a->block_min = x;
+		}
+		if (a->block_n == 0 || x > a->block_max) {
+			a->block_max = x;
+		}
+		if (++a->block_n < a->sps) {
+			continue;
+		}
+
+		// End of a one second block. Flat while every block in the
+		// window is, and until a block has twice the flat range.
+		int32_t range = a->block_max - a->block_min;
+		a->ranges[a->nblocks++ % ADS1X9X_ALARM_FLAT_BLOCKS] = range;
+		a->block_n = 0;
+		int j, flat = a->nblocks >= ADS1X9X_ALARM_FLAT_BLOCKS;
+		for (j = 0; j < ADS1X9X_ALARM_FLAT_BLOCKS && flat; j++) {
+			flat = a->ranges[j] < a->flat_range;
+		}
+		if (a->active[ADS1X9X_ALARM_FLATLINE] && range < 2 * a->flat_range) {
+			flat = TRUE;
+		}
+		// Lead-off is the more specific alarm for a flat signal
+		if (a->active[ADS1X9X_ALARM_LEAD_OFF]) {
+			flat = FALSE;
+		}
+		update(a, ADS1X9X_ALARM_FLATLINE, flat, frame_ns, t, range);
+	}
+}
+
+/**
+ * Evaluate a heart rate, per beat or per frame.
+ */
+void ads1x9x_alarm_hr (ads1x9x_alarm_t *a, uint64_t frame_ns, double t, double hr) {
+	int low = hr < a->hr_low
+		|| (a->active[ADS1X9X_ALARM_HR_LOW] && hr < a->hr_low + a->hr_hysteresis);
+	int high = hr > a->hr_high
+		|| (a->active[ADS1X9X_ALARM_HR_HIGH] && hr > a->hr_high - a->hr_hysteresis);
+	if (a->active[ADS1X9X_ALARM_LEAD_OFF]) {
+		low = high = FALSE;
+	}
+	update(a, ADS1X9X_ALARM_HR_LOW, low, frame_ns, t, hr);
+	update(a, ADS1X9X_ALARM_HR_HIGH, high, frame_ns, t, hr);
+}
+
+/**
+ * POST the event to the webhook, bounded by WEBHOOK_TIMEOUT_MS.
+ */
+static int webhook_post (ads1x9x_notifier_t *n, const char *json, int json_len) {
+	struct timeval tv = { WEBHOOK_TIMEOUT_MS / 1000, (WEBHOOK_TIMEOUT_MS % 1000) * 1000 };
+	char req[1024];
+	char reply[64];
+	int ret = -1;
+
+	int fd = socket(n->webhook_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	// On Linux the send timeout also bounds connect
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	int len = snprintf(req, sizeof(req), "POST %s HTTP/1.0\r\nHost: %s\r\n"
+		"Content-Type: application/json\r\nContent-Length: %d\r\n\r\n%s",
+		n->webhook_path, n->webhook_host, json_len, json);
+	if (connect(fd, (struct sockaddr *)&n->webhook_addr, n->webhook_addr_len) == 0
+			&& write(fd, req, len) == len) {
+		int r = read(fd, reply, sizeof(reply) - 1);
+		if (r > 0) {
+			reply[r] = '\0';
+			// "HTTP/1.x 2xx"
+			ret = r > 9 && reply[9] == '2' ? 0 : -1;
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+/**
+ * Queue e on q, or drop and count it if q is full. Called with the lock
+ * held.
+ */
+static void queue_push (event_queue_t *q, const ads1x9x_alarm_event_t *e) {
+	if (q->head - q->tail < QUEUE_SIZE) {
+		q->events[q->head++ % QUEUE_SIZE] = *e;
+		pthread_cond_signal(&q->cond);
+	} else {
+		q->dropped++;
+	}
+}
+
+/**
+ * Wait for the next event on q.
+ *
+ * @return 1 with the event in e, or 0 once q is stopped and empty.
+ */
+static int queue_pop (ads1x9x_notifier_t *n, event_queue_t *q, ads1x9x_alarm_event_t *e) {
+	pthread_mutex_lock(&n->lock);
+	while (q->head == q->tail && !q->stop) {
+		pthread_cond_wait(&q->cond, &n->lock);
+	}
+	int ret = q->head != q->tail;
+	if (ret) {
+		*e = q->events[q->tail++ % QUEUE_SIZE];
+	}
+	pthread_mutex_unlock(&n->lock);
+	return ret;
+}
+
+static int event_json (const ads1x9x_alarm_event_t *e, char *json, int size) {
+	return snprintf(json, size,
+		"{\"device\":%d,\"t\":%.3f,\"alarm\":\"%s\",\"state\":\"%s\",\"value\":%.1f}\n",
+		e->device, e->t, ads1x9x_alarm_name(e->alarm), e->raised ? "raised" : "cleared", e->value);
+}
+
+/**
+ * Write the event to stderr and the socket, then pass it on to the
+ * webhook thread.
+ */
+static void deliver (ads1x9x_notifier_t *n, const ads1x9x_alarm_event_t *e) {
+	char json[256];
+	char line[256];
+
+	if (n->to_stderr) {
+		int len = snprintf(line, sizeof(line), "ALARM device %d t %.3f %s %s %.1f\n",
+			e->device, e->t, ads1x9x_alarm_name(e->alarm), e->raised ? "raised" : "cleared", e->value);
+		if (write(STDERR_FILENO, line, len) < 0) {
+			// Nothing more can be done with stderr
+		}
+	}
+	if (n->sock >= 0) {
+		// No receiver or a full receiver queue loses the datagram
+		int json_len = event_json(e, json, sizeof(json));
+		sendto(n->sock, json, json_len, MSG_DONTWAIT,
+			(struct sockaddr *)&n->sock_addr, sizeof(n->sock_addr));
+	}
+
+	uint64_t latency = ads1x9x_now_ns() - e->frame_ns;
+	ads1x9x_hist_record(&ads1x9x_metrics.alarm_latency, latency);
+	if (latency > ADS1X9X_ALARM_BUDGET_NS) {
+		ADS1X9X_METRIC_INC(alarms_late);
+	}
+
+	if (n->webhook) {
+		pthread_mutex_lock(&n->lock);
+		queue_push(&n->remote, e);
+		pthread_mutex_unlock(&n->lock);
+	}
+}
+
+static void *notifier_thread (void *arg) {
+	ads1x9x_notifier_t *n = arg;
+	ads1x9x_alarm_event_t e;
+
+	while (queue_pop(n, &n->local, &e)) {
+		deliver(n, &e);
+	}
+	return NULL;
+}
+
+/**
+ * POST events to the webhook one at a time, so a slow or unreachable
+ * server holds back only later webhook posts.
+ */
+static void *webhook_thread (void *arg) {
+	ads1x9x_notifier_t *n = arg;
+	ads1x9x_alarm_event_t e;
+	char json[256];
+
+	while (queue_pop(n, &n->remote, &e)) {
+		int json_len = event_json(&e, json, sizeof(json));
+		if (webhook_post(n, json, json_len) < 0) {
+			fprintf (stderr,"Warning: alarm webhook http://%s%s failed\n", n->webhook_host, n->webhook_path);
+		}
+	}
+	return NULL;
+}
+
+static int queue_start (ads1x9x_notifier_t *n, event_queue_t *q, void *(*fn) (void *)) {
+	pthread_cond_init(&q->cond, NULL);
+	if (pthread_create(&q->thread, NULL, fn, n) != 0) {
+		return -1;
+	}
+	q->running = TRUE;
+	return 0;
+}
+
+/**
+ * Deliver what is queued on q and stop its thread.
+ */
+static void queue_stop (ads1x9x_notifier_t *n, event_queue_t *q, const char *what) {
+	if (!q->running) {
+		return;
+	}
+	pthread_mutex_lock(&n->lock);
+	q->stop = TRUE;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&n->lock);
+	pthread_join(q->thread, NULL);
+	q->running = FALSE;
+	if (q->dropped > 0) {
+		fprintf (stderr,"Warning: %llu alarm events dropped%s\n", (unsigned long long)q->dropped, what);
+	}
+}
+
+/**
+ * Split http://host[:port]/path and resolve host.
+ */
+static int webhook_parse (ads1x9x_notifier_t *n, const char *url) {
+	char port[16] = "80";
+	struct addrinfo hints, *ai;
+
+	if (strncmp(url, "http://", 7) != 0) {
+		return -1;
+	}
+	url += 7;
+	const char *path = strchr(url, '/');
+	size_t host_len = path != NULL ? (size_t)(path - url) : strlen(url);
+	if (host_len == 0 || host_len >= sizeof(n->webhook_host)) {
+		return -1;
+	}
+	memcpy(n->webhook_host, url, host_len);
+	n->webhook_host[host_len] = '\0';
+	snprintf(n->webhook_path, sizeof(n->webhook_path), "%s", path != NULL ? path : "/");
+
+	char *colon = strchr(n->webhook_host, ':');
+	if (colon != NULL) {
+		snprintf(port, sizeof(port), "%s", colon + 1);
+		*colon = '\0';
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(n->webhook_host, port, &hints, &ai) != 0) {
+		return -1;
+	}
+	memcpy(&n->webhook_addr, ai->ai_addr, ai->ai_addrlen);
+	n->webhook_addr_len = ai->ai_addrlen;
+	freeaddrinfo(ai);
+	if (colon != NULL) {
+		// Keep host:port for the Host header
+		*colon = ':';
+	}
+	n->webhook = TRUE;
+	return 0;
+}
+
+/**
+ * Start the notifier thread, and the webhook thread if there is a webhook.
+ *
+ * @param socket_path Unix datagram socket to send JSON events to, or NULL
+ * @param webhook_url http://host[:port]/path to POST JSON events to, or NULL
+ * @return Notifier or NULL if the webhook URL is invalid or a thread
+ * could not be started.
+ */
+ads1x9x_notifier_t *ads1x9x_notifier_start (int to_stderr, const char *socket_path, const char *webhook_url) {
+	ads1x9x_notifier_t *n = calloc(1, sizeof(ads1x9x_notifier_t));
+	if (n == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&n->lock, NULL);
+	n->to_stderr = to_stderr;
+	n->sock = -1;
+	if (socket_path != NULL) {
+		n->sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		n->sock_addr.sun_family = AF_UNIX;
+		snprintf(n->sock_addr.sun_path, sizeof(n->sock_addr.sun_path), "%s", socket_path);
+	}
+	if (webhook_url != NULL && webhook_parse(n, webhook_url) < 0) {
+		fprintf (stderr,"Error: invalid webhook URL %s\n", webhook_url);
+		ads1x9x_notifier_stop(n);
+		return NULL;
+	}
+	if ((n->webhook && queue_start(n, &n->remote, webhook_thread) < 0)
+			|| queue_start(n, &n->local, notifier_thread) < 0) {
+		ads1x9x_notifier_stop(n);
+		return NULL;
+	}
+	return n;
+}
+
+/**
+ * Queue an event for delivery. Never blocks on delivery; if the queue is
+ * full the event is dropped and counted.
+ */
+void ads1x9x_notifier_post (ads1x9x_notifier_t *n, const ads1x9x_alarm_event_t *e) {
+	ADS1X9X_METRIC_INC(alarms);
+	pthread_mutex_lock(&n->lock);
+	queue_push(&n->local, e);
+	pthread_mutex_unlock(&n->lock);
+}
+
+/**
+ * Deliver queued events and stop the threads.
+ */
+void ads1x9x_notifier_stop (ads1x9x_notifier_t *n) {
+	// The notifier thread feeds the webhook thread, so stops first
+	queue_stop(n, &n->local, "");
+	queue_stop(n, &n->remote, " by the webhook");
+	if (n->sock >= 0) {
+		close(n->sock);
+	}
+	free(n);
+}
@@ -0,0 +1,82 @@
+/**
+ * ads1x9x_alarm.h - alarm engine for lead-off, heart rate limits and
+ * flatline (asystole), evaluated on each decoded frame as it arrives.
+ *
+ * An alarm is raised as soon as its condition is seen and cleared only
+ * after the condition has been absent for its hold time, so a flapping
+ * condition gives one raise and one clear. Events are handed to a
+ * notifier thread which writes them to stderr and a unix datagram socket,
+ * so delivery never waits on the sample output, and from there to a
+ * thread of its own for the HTTP webhook, so a slow server delays no
+ * other delivery. Delivery latency from the read that brought the frame
+ * in is recorded in the alarm_latency metric.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_ALARM_H
+#define ADS1X9X_ALARM_H
+
+#include <stdint.h>
+
+#define ADS1X9X_ALARM_LEAD_OFF 0
+#define ADS1X9X_ALARM_HR_LOW 1
+#define ADS1X9X_ALARM_HR_HIGH 2
+#define ADS1X9X_ALARM_FLATLINE 3
+#define ADS1X9X_NALARMS 4
+
+// Frame arrival to first delivery (stderr and socket) budget, ns
+#define ADS1X9X_ALARM_BUDGET_NS 5000000
+
+// Flatline is judged over this many one second blocks
+#define ADS1X9X_ALARM_FLAT_BLOCKS 4
+
+typedef struct {
+	// Host time the triggering frame was read, ns (CLOCK_MONOTONIC)
+	uint64_t frame_ns;
+	// Stream time, s from the first sample
+	double t;
+	int device;
+	int alarm;
+	int raised;
+	double value;
+} ads1x9x_alarm_event_t;
+
+typedef struct ads1x9x_notifier ads1x9x_notifier_t;
+
+typedef struct {
+	int device;
+	int sps;
+	ads1x9x_notifier_t *notifier;
+
+	// Limits: heart rate, bpm, and the ECG peak to peak range, ADC units,
+	// below which the signal is flat
+	double hr_low;
+	double hr_high;
+	double hr_hysteresis;
+	int32_t flat_range;
+
+	int active[ADS1X9X_NALARMS];
+	// Stream time the condition was last seen, for the clear hold time
+	double last_seen[ADS1X9X_NALARMS];
+
+	// ECG range of the current and the last few one second blocks
+	int32_t block_min, block_max;
+	int block_n;
+	int32_t ranges[ADS1X9X_ALARM_FLAT_BLOCKS];
+	int nblocks;
+} ads1x9x_alarm_t;
+
+const char *ads1x9x_alarm_name (int alarm);
+
+void ads1x9x_alarm_init (ads1x9x_alarm_t *a, int device, int sps, double hr_low, double hr_high,
+	ads1x9x_notifier_t *notifier);
+void ads1x9x_alarm_frame (ads1x9x_alarm_t *a, uint64_t frame_ns, double t, int lead_off,
+	const int32_t *ecg, int stride, int nrows);
+void ads1x9x_alarm_hr (ads1x9x_alarm_t *a, uint64_t frame_ns, double t, double hr);
+
+ads1x9x_notifier_t *ads1x9x_notifier_start (int to_stderr, const char *socket_path, const char *webhook_url);
+void ads1x9x_notifier_post (ads1x9x_notifier_t *n, const ads1x9x_alarm_event_t *e);
+void ads1x9x_notifier_stop (ads1x9x_notifier_t *n);
+
+#endif
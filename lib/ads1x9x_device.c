@@ -0,0 +1,55 @@
+/**
+ * ads1x9x_device.c - table of ADS1x9x family parts and their frame layouts.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "ads1x9x.h"
+
+#define DEVICE(prefix, name, id, width) \
+	{ name, id, prefix##_NCHANNELS, width, prefix##_STATUS_BYTES, prefix##_FRAME_SIZE, prefix##_decode_n }
+
+// ID register values. ADS1x9x: REV_ID = 010 (011 on the ADS1292R) and
+// DEV_ID 00..11 selects the part. ADS129x: REV_ID = 100 and DEV_ID 00..10
+// selects 4, 6 or 8 channels.
+static const ads1x9x_device_t devices[] = {
+	DEVICE(ads1191, "ADS1191", 0x50, 2),
+	DEVICE(ads1192, "ADS1192", 0x51, 2),
+	DEVICE(ads1291, "ADS1291", 0x52, 3),
+	DEVICE(ads1292, "ADS1292", 0x53, 3),
+	DEVICE(ads1292r, "ADS1292R", 0x73, 3),
+	DEVICE(ads1294, "ADS1294", 0x90, 3),
+	DEVICE(ads1296, "ADS1296", 0x91, 3),
+	DEVICE(ads1298, "ADS1298", 0x92, 3),
+};
+
+/**
+ * @param id Value read from REG_ID
+ * @return Part description or NULL if the ID is not recognised.
+ */
+const ads1x9x_device_t *ads1x9x_device_by_id (int id) {
+	int i;
+	for (i = 0; i < (int)ARRAY_SIZE(devices); i++) {
+		if (devices[i].id == id) {
+			return &devices[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @param name Part name, eg "ADS1298". Case is ignored.
+ * @return Part description or NULL if the name is not recognised.
+ */
+const ads1x9x_device_t *ads1x9x_device_by_name (const char *name) {
+	int i;
+	for (i = 0; i < (int)ARRAY_SIZE(devices); i++) {
+		if (strcasecmp(devices[i].name, name) == 0) {
+			return &devices[i];
+		}
+	}
+	return NULL;
+}
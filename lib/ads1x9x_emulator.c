@@ -0,0 +1,248 @@
+/**
+ * ads1x9x_emulator.c - software emulation of the ADS1x9x EVM firmware
+ * Host/USB protocol. Replies to commands and streams a synthetic ECG
+ * (ch2) and respiration (ch1) signal so that the tools can be exercised
+ * and benchmarked without hardware. Frames are generated on demand, as
+ * fast as they are read.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ads1x9x_evm.h"
+
+typedef struct {
+	// Bytes waiting to be read by the host
+	uint8_t out[256];
+	int out_head;
+	int out_len;
+
+	int streaming;
+	int acquire_frames;
+	uint32_t sample_index;
+	// Frames held in the flash recording and the next to download, or -1
+	int recorded_frames;
+	int download_frame;
+	// Filter selected by CMD_FILTER_SELECT
+	int filter;
+	uint8_t regs[16];
+} emulator_t;
+
+/**
+ * Queue a frame for the host to read. A frame that does not fit, when
+ * the host sends commands faster than it reads the replies, is dropped
+ * whole, as by a full USB FIFO.
+ *
+ * @return 0 or -1 if the frame was dropped.
+ */
+static int queue (emulator_t *emu, const uint8_t *buf, int length) {
+	if (emu->out_len + length > (int)sizeof(emu->out)) {
+		return -1;
+	}
+	memmove (emu->out, emu->out + emu->out_head, emu->out_len);
+	emu->out_head = 0;
+	memcpy (emu->out + emu->out_len, buf, length);
+	emu->out_len += length;
+	return 0;
+}
+
+/**
+ * Triangular pulse of given half width and peak centred on 0.
+ */
+static int pulse (int x, int half_width, int peak) {
+	if (x < 0) {
+		x = -x;
+	}
+	return x >= half_width ? 0 : peak * (half_width - x) / half_width;
+}
+
+/**
+ * Synthetic signal in ADC units of the EVM 16 bit stream. ECG at 72 bpm,
+ * respiration at 15 breaths/min, both at EVM_STREAM_SPS.
+ */
+static void synth (uint32_t n, int32_t *resp, int32_t *ecg) {
+	int beat = n % (EVM_STREAM_SPS * 60 / 72);
+	int breath = n % (EVM_STREAM_SPS * 4);
+	*ecg = pulse(beat - 100, 6, 1200) - pulse(beat - 108, 6, 250)
+		+ pulse(beat - 60, 25, 80) + pulse(beat - 220, 45, 200);
+	*resp = pulse(breath - EVM_STREAM_SPS * 2, EVM_STREAM_SPS * 2, 1000) - 500;
+}
+
+/**
+ * 50Hz mains pickup, one cycle at EVM_STREAM_SPS.
+ */
+static const int8_t mains_hum[10] = {0, 35, 57, 57, 35, 0, -35, -57, -57, -35};
+
+static void queue_stream_frame (emulator_t *emu) {
+	uint8_t f[2 + EVM_STREAM_PAYLOAD + 2];
+	int32_t resp, ecg;
+	int i;
+	f[0] = START_DATA_HEADER;
+	f[1] = CMD_DATA_STREAMING;
+	f[2] = 72;
+	f[3] = 15;
+	f[4] = 0;
+	for (i = 0; i < EVM_STREAM_ROWS; i++) {
+		synth (emu->sample_index, &resp, &ecg);
+		// The stream is DSP filtered, removing mains pickup only if
+		// the matching notch is selected
+		if (emu->filter != FILTER_50HZ_NOTCH) {
+			ecg += mains_hum[emu->sample_index % 10];
+			resp += mains_hum[emu->sample_index % 10] / 4;
+		}
+		emu->sample_index++;
+		f[5 + i*4] = resp & 0xff;
+		f[6 + i*4] = (resp >> 8) & 0xff;
+		f[7 + i*4] = ecg & 0xff;
+		f[8 + i*4] = (ecg >> 8) & 0xff;
+	}
+	f[sizeof(f)-2] = END_DATA_HEADER;
+	f[sizeof(f)-1] = END_DATA_HEADER;
+	queue (emu, f, sizeof(f));
+}
+
+/**
+ * Queue a CMD_ACQUIRE_DATA layout frame of the given type with 24 bit
+ * samples starting at sample n.
+ */
+static void queue_acquire_frame (emulator_t *emu, int type, uint32_t n) {
+	uint8_t f[2 + EVM_ACQUIRE_PAYLOAD + 1];
+	int32_t resp, ecg;
+	int i;
+	f[0] = START_DATA_HEADER;
+	f[1] = type;
+	f[2] = 0xc0;
+	f[3] = 0x00;
+	for (i = 0; i < EVM_ACQUIRE_ROWS; i++) {
+		synth (n++, &resp, &ecg);
+		resp *= 256;
+		ecg *= 256;
+		f[4 + i*6] = (resp >> 16) & 0xff;
+		f[5 + i*6] = (resp >> 8) & 0xff;
+		f[6 + i*6] = resp & 0xff;
+		f[7 + i*6] = (ecg >> 16) & 0xff;
+		f[8 + i*6] = (ecg >> 8) & 0xff;
+		f[9 + i*6] = ecg & 0xff;
+	}
+	f[sizeof(f)-1] = END_DATA_HEADER;
+	queue (emu, f, sizeof(f));
+}
+
+static void command (emulator_t *emu, int cmd, int param0, int param1) {
+	uint8_t reply[7] = {START_DATA_HEADER, cmd, param0, param1,
+		END_DATA_HEADER, END_DATA_HEADER, 0x0A};
+	uint8_t ack[3] = {START_DATA_HEADER, cmd, END_DATA_HEADER};
+
+	switch (cmd) {
+		case CMD_REG_WRITE:
+			emu->regs[param0 & 0x0f] = param1;
+			queue (emu, reply, 7);
+			break;
+		case CMD_REG_READ:
+			reply[3] = emu->regs[param0 & 0x0f];
+			queue (emu, reply, 7);
+			break;
+		case CMD_QUERY_FIRMWARE_VERSION:
+			reply[2] = 1;
+			reply[3] = 4;
+			queue (emu, reply, 7);
+			break;
+		case CMD_DATA_STREAMING:
+			// Toggle, parameters ignored as in the real firmware
+			emu->streaming = !emu->streaming;
+			break;
+		case CMD_ACQUIRE_DATA:
+			emu->acquire_frames = ((param0 << 8) | param1) / EVM_ACQUIRE_ROWS;
+			queue (emu, ack, 3);
+			break;
+		case CMD_FILTER_SELECT:
+			emu->filter = param1;
+			queue (emu, ack, 3);
+			break;
+		case START_RECORDING_COMMAND:
+			// Record (param0 << 8 | param1) seconds, instantly
+			emu->recorded_frames = ((param0 << 8) | param1) * EVM_STREAM_SPS / EVM_DOWNLOAD_ROWS;
+			break;
+		case CMD_DATA_DOWNLOAD:
+			emu->download_frame = 0;
+			break;
+		case CMD_RESTART:
+			emu->streaming = FALSE;
+			emu->acquire_frames = 0;
+			emu->download_frame = -1;
+			break;
+	}
+}
+
+static int emulator_write (ads1x9x_transport_t *t, const void *buf, int length) {
+	emulator_t *emu = t->priv;
+	const uint8_t *p = buf;
+	int i;
+	// Commands are START_DATA_HEADER cmd param0 param1 EOD EOD 0x0A
+	for (i = 0; i + 3 < length; i++) {
+		if (p[i] == START_DATA_HEADER) {
+			command (emu, p[i+1], p[i+2], p[i+3]);
+			i += 6;
+		}
+	}
+	return length;
+}
+
+static int emulator_read (ads1x9x_transport_t *t, void *buf, int length) {
+	emulator_t *emu = t->priv;
+
+	if (emu->out_len == 0) {
+		if (emu->streaming) {
+			queue_stream_frame (emu);
+		} else if (emu->acquire_frames > 0) {
+			queue_acquire_frame (emu, CMD_ACQUIRE_DATA, emu->sample_index);
+			emu->sample_index += EVM_ACQUIRE_ROWS;
+			emu->acquire_frames--;
+		} else if (emu->download_frame >= 0 && emu->download_frame < emu->recorded_frames) {
+			// The recording replays the same samples on every download
+			queue_acquire_frame (emu, CMD_DATA_DOWNLOAD, emu->download_frame * EVM_DOWNLOAD_ROWS);
+			emu->download_frame++;
+		} else if (emu->download_frame >= 0) {
+			uint8_t end[3] = {START_DATA_HEADER, CMD_DATA_DOWNLOAD, END_DATA_HEADER};
+			queue (emu, end, 3);
+			emu->download_frame = -1;
+		} else {
+			return 0;
+		}
+	}
+
+	if (length > emu->out_len) {
+		length = emu->out_len;
+	}
+	memcpy (buf, emu->out + emu->out_head, length);
+	emu->out_head += length;
+	emu->out_len -= length;
+	return length;
+}
+
+static void emulator_close (ads1x9x_transport_t *t) {
+	free(t->priv);
+	free(t);
+}
+
+ads1x9x_transport_t *ads1x9x_transport_open_emulator (void) {
+	ads1x9x_transport_t *t = calloc(1, sizeof(ads1x9x_transport_t));
+	emulator_t *emu = calloc(1, sizeof(emulator_t));
+	// ADS1292R register values on reset
+	emu->regs[REG_ID] = 0x73;
+	emu->regs[REG_CONFIG1] = 0x02;
+	emu->regs[REG_CONFIG2] = 0x80;
+	emu->regs[REG_LOFF] = 0x10;
+	// A 60 second recording is in flash
+	emu->recorded_frames = 60 * EVM_STREAM_SPS / EVM_DOWNLOAD_ROWS;
+	emu->download_frame = -1;
+	t->name = "emulator";
+	t->fd = -1;
+	t->priv = emu;
+	t->read = emulator_read;
+	t->write = emulator_write;
+	t->close = emulator_close;
+	return t;
+}
@@ -0,0 +1,436 @@
+/**
+ * ads1x9x_evm.c - Host/USB protocol frame reading and command writing
+ * for the TI ADS1x9x EVM firmware.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "ads1x9x_evm.h"
+#include "ads1x9x_probes.h"
+
+/**
+ * Open EVM. The device "emulator" selects a software emulation of the
+ * EVM firmware and a regular file or FIFO is replayed as a recording of
+ * EVM output. Anything else is taken to be a serial device.
+ *
+ * @param device Pointer to string with device name (eg "/dev/ttyACM0")
+ * @param bps Serial bits per second. Ignored by the emulator.
+ * @return Transport or NULL if there was an error.
+ */
+ads1x9x_transport_t *ads1x9x_evm_open (const char *device, int bps) {
+	if (strcmp(device,"emulator")==0) {
+		return ads1x9x_transport_open_emulator();
+	}
+	struct stat st;
+	if (stat(device,&st)==0 && (S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode))) {
+		return ads1x9x_transport_open_file(device);
+	}
+	return ads1x9x_transport_open_serial(device,bps);
+}
+
+/**
+ * Close EVM transport.
+ */
+void ads1x9x_evm_close (ads1x9x_transport_t *t) {
+	ads1x9x_transport_close(t);
+}
+
+/**
+ * Display length bytes from pointer buf in zero padded
+ * hex.
+ */
+void ads1x9x_display_hex (const uint8_t *buf, int length) {
+	int i;
+	for (i = 0; i < length; i++) {
+		fprintf (stderr,"%02X ",buf[i]);
+	}
+}
+
+/**
+ * Initialise a frame parser reading from transport t. t may be NULL for
+ * a parser that is only given data with ads1x9x_evm_parser_feed(). A
+ * protocol trace set on t also records the frames parsed.
+ */
+void ads1x9x_evm_parser_init (ads1x9x_evm_parser_t *p, ads1x9x_transport_t *t) {
+	memset(p, 0, sizeof(*p));
+	p->t = t;
+	if (t != NULL) {
+		p->trace = t->trace;
+		p->trace_interface = t->trace_interface;
+	}
+}
+
+/**
+ * Append up to length bytes to the parser buffer.
+ *
+ * @return Number of bytes accepted.
+ */
+int ads1x9x_evm_parser_feed (ads1x9x_evm_parser_t *p, const uint8_t *data, int length) {
+	if (p->head > 0 && p->tail + length > ADS1X9X_EVM_PARSER_BUF_SIZE) {
+		memmove(p->buf, p->buf + p->head, p->tail - p->head);
+		p->tail -= p->head;
+		p->head = 0;
+	}
+	if (length > ADS1X9X_EVM_PARSER_BUF_SIZE - p->tail) {
+		length = ADS1X9X_EVM_PARSER_BUF_SIZE - p->tail;
+	}
+	memcpy(p->buf + p->tail, data, length);
+	p->tail += length;
+	p->read_ns = ads1x9x_now_ns();
+	return length;
+}
+
+/**
+ * Read whatever the transport has available into the parser buffer.
+ *
+ * @return 0 if successful, -1 on read error or end of data.
+ */
+static int parser_fill (ads1x9x_evm_parser_t *p) {
+	int n;
+	if (p->t == NULL) {
+		return -1;
+	}
+	if (p->head > 0) {
+		memmove(p->buf, p->buf + p->head, p->tail - p->head);
+		p->tail -= p->head;
+		p->head = 0;
+	}
+	do {
+		n = ads1x9x_transport_read(p->t, p->buf + p->tail, ADS1X9X_EVM_PARSER_BUF_SIZE - p->tail);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		return -1;
+	}
+	p->read_ns = ads1x9x_now_ns();
+	p->tail += n;
+	return 0;
+}
+
+// Command replies: two data bytes, 2 x EOD, newline
+#define EVM_REPLY_LENGTH (2 + 5)
+// Acknowledgements carry no data: START_DATA_HEADER cmd END_DATA_HEADER
+#define EVM_ACK_LENGTH 3
+
+/**
+ * Wire length of a frame of the given type including header and
+ * trailer, or -1 if this is not a frame type. Every frame type has a
+ * fixed length, so a corrupted type byte cannot make the parser swallow
+ * the frames after it looking for a trailer.
+ */
+static int frame_wire_length (const uint8_t *f) {
+	switch (f[1]) {
+		case CMD_DATA_STREAMING:
+			return 2 + EVM_STREAM_PAYLOAD + 2;
+		case CMD_ACQUIRE_DATA:
+		case CMD_DATA_DOWNLOAD:
+			// The ack to CMD_ACQUIRE_DATA and the end of a download are
+			// empty frames. Data frames start with an ADS1x9x status
+			// byte, 0xC0 to 0xCF.
+			return f[2] == END_DATA_HEADER ? EVM_ACK_LENGTH : 2 + EVM_ACQUIRE_PAYLOAD + 1;
+		case CMD_REG_WRITE:
+		case CMD_REG_READ:
+		case CMD_QUERY_FIRMWARE_VERSION:
+			return EVM_REPLY_LENGTH;
+	}
+	return (f[1] >= CMD_REG_WRITE && f[1] <= CMD_RESTART) ? EVM_ACK_LENGTH : -1;
+}
+
+/**
+ * Check the END_DATA_HEADER trailer of a complete frame.
+ */
+static int frame_trailer_ok (const uint8_t *f, int length) {
+	if (length == EVM_ACK_LENGTH) {
+		return f[2] == END_DATA_HEADER;
+	}
+	switch (f[1]) {
+		case CMD_DATA_STREAMING:
+			return f[length-2] == END_DATA_HEADER && f[length-1] == END_DATA_HEADER;
+		case CMD_ACQUIRE_DATA:
+		case CMD_DATA_DOWNLOAD:
+			return f[length-1] == END_DATA_HEADER;
+		default:
+			return f[4] == END_DATA_HEADER && f[5] == END_DATA_HEADER;
+	}
+}
+
+/**
+ * Write the run of discarded bytes held for the trace.
+ */
+static void trace_discard_flush (ads1x9x_evm_parser_t *p) {
+	if (p->trace_discard_len > 0) {
+		ads1x9x_pcapng_write(p->trace, p->trace_interface, ADS1X9X_PCAPNG_INBOUND, p->trace_discard_ns,
+			ADS1X9X_PCAPNG_DISCARDED, p->trace_discard, p->trace_discard_len);
+		p->trace_discard_len = 0;
+	}
+}
+
+/**
+ * Account for the n bytes at the head of the buffer, about to be
+ * skipped as not belonging to a valid frame.
+ */
+static void parser_discard (ads1x9x_evm_parser_t *p, int n) {
+	if (p->trace != NULL) {
+		const uint8_t *d = p->buf + p->head;
+		int left = n;
+		while (left > 0) {
+			if (p->trace_discard_len == ADS1X9X_EVM_TRACE_DISCARD) {
+				trace_discard_flush(p);
+			}
+			if (p->trace_discard_len == 0) {
+				p->trace_discard_ns = p->read_ns;
+			}
+			int c = ADS1X9X_EVM_TRACE_DISCARD - p->trace_discard_len;
+			c = c < left ? c : left;
+			memcpy(p->trace_discard + p->trace_discard_len, d, c);
+			p->trace_discard_len += c;
+			d += c;
+			left -= c;
+		}
+	}
+	p->discarded_bytes += n;
+	p->discarded_since_sync += n;
+	ADS1X9X_METRIC_ADD(discarded_bytes, n);
+	if (p->in_sync) {
+		p->in_sync = FALSE;
+		p->resyncs++;
+		ADS1X9X_METRIC_INC(resyncs);
+	}
+}
+
+/**
+ * Drop the byte at the head of the buffer as not being the start of a
+ * valid frame.
+ */
+static void parser_reject (ads1x9x_evm_parser_t *p) {
+	parser_discard(p, 1);
+	p->head++;
+	p->start_probed = FALSE;
+}
+
+/**
+ * Extract the next valid frame from data already in the parser buffer.
+ * Candidate frames that fail validation are dropped one byte at a time
+ * and the buffer rescanned from the next START_DATA_HEADER, so nothing
+ * is read twice and a corrupted frame never reaches the caller.
+ *
+ * @return 1 if a frame was extracted, 0 if more data is needed.
+ */
+int ads1x9x_evm_parse (ads1x9x_evm_parser_t *p, ads1x9x_evm_frame_t *frame) {
+	for (;;) {
+		// Skip to candidate START_DATA_HEADER
+		uint8_t *f = memchr(p->buf + p->head, START_DATA_HEADER, p->tail - p->head);
+		if (f == NULL) {
+			if (p->tail > p->head) {
+				parser_discard(p, p->tail - p->head);
+			}
+			p->head = p->tail = 0;
+			break;
+		}
+		int skipped = f - (p->buf + p->head);
+		if (skipped > 0) {
+			parser_discard(p, skipped);
+			p->head += skipped;
+		}
+
+		int avail = p->tail - p->head;
+		if (avail < 3) {
+			break;
+		}
+
+		int length = frame_wire_length(f);
+		if (length < 0) {
+			parser_reject(p);
+			continue;
+		}
+		if (!p->start_probed) {
+			ADS1X9X_PROBE1(frame_start, f[1]);
+			p->start_probed = TRUE;
+		}
+		if (avail < length) {
+			break;
+		}
+		if (!frame_trailer_ok(f, length)) {
+			parser_reject(p);
+			continue;
+		}
+
+		frame->type = f[1];
+		frame->read_ns = p->read_ns;
+		switch (f[1]) {
+			case CMD_DATA_STREAMING:
+				frame->length = EVM_STREAM_PAYLOAD;
+				break;
+			case CMD_ACQUIRE_DATA:
+			case CMD_DATA_DOWNLOAD:
+				frame->length = length > 3 ? EVM_ACQUIRE_PAYLOAD : 0;
+				break;
+			default:
+				frame->length = length - 3;
+		}
+		memcpy(frame->data, f + 2, length - 2);
+		if (p->trace != NULL) {
+			trace_discard_flush(p);
+			ads1x9x_pcapng_write(p->trace, p->trace_interface, ADS1X9X_PCAPNG_INBOUND, p->read_ns,
+				NULL, f, length);
+		}
+		p->head += length;
+		p->start_probed = FALSE;
+		ADS1X9X_PROBE2(frame_complete, frame->type, length);
+
+		// A stream that had to be resynchronised lost roughly the
+		// discarded bytes' worth of frames of the type it resumed with.
+		if (!p->in_sync && p->frames > 0) {
+			int lost = (p->discarded_since_sync + length / 2) / length;
+			p->lost_frames += lost;
+			ADS1X9X_METRIC_ADD(dropped_frames, lost);
+		}
+		p->discarded_since_sync = 0;
+		p->in_sync = TRUE;
+		p->frames++;
+		ADS1X9X_METRIC_INC(frames_read);
+		ADS1X9X_METRIC_SET(parser_queue_bytes, p->tail - p->head);
+		return 1;
+	}
+
+	// More data needed. What was discarded before here is a whole run.
+	if (p->trace != NULL) {
+		trace_discard_flush(p);
+	}
+	return 0;
+}
+
+/**
+ * Read the next valid Host/EVM protocol frame from the EVM. Every frame
+ * type has a fixed wire length, so a frame is taken whole once that many
+ * bytes are in and its END_DATA_HEADER trailer checks out; 0x03 in the
+ * payload never ends it early. On an unknown type or a bad trailer the
+ * parser skips to the next START_DATA_HEADER and tries again.
+ *
+ * @return 0 if successful, -1 on read error or end of data.
+ */
+int ads1x9x_evm_read_frame (ads1x9x_evm_parser_t *p, ads1x9x_evm_frame_t *frame) {
+	while (ads1x9x_evm_parse(p, frame) == 0) {
+		if (parser_fill(p) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read exactly length bytes through the parser buffer, without framing.
+ *
+ * @return length if successful, -1 on read error or end of data.
+ */
+int ads1x9x_evm_parser_read (ads1x9x_evm_parser_t *p, void *buf, int length) {
+	int n = 0;
+	while (n < length) {
+		if (p->head == p->tail && parser_fill(p) < 0) {
+			return -1;
+		}
+		int c = p->tail - p->head < length - n ? p->tail - p->head : length - n;
+		memcpy((uint8_t *)buf + n, p->buf + p->head, c);
+		p->head += c;
+		n += c;
+	}
+	return length;
+}
+
+/**
+ * Read a Host/EVM frame by scanning for END_DATA_HEADER. This cannot be used
+ * in general because frame data may contain END_DATA_HEADER.
+ *
+ * @return 0 if successful, -1 on read error or end of data.
+ */
+int ads1x9x_evm_read_frame_to_eod (ads1x9x_evm_parser_t *p, ads1x9x_evm_frame_t *frame) {
+
+	uint8_t c=0;
+
+	// Wait for start of data header
+	do {
+		if (ads1x9x_evm_parser_read (p,&c,1) < 0) {
+			return -1;
+		}
+	} while (c != START_DATA_HEADER);
+
+	// read packet type
+	if (ads1x9x_evm_parser_read (p,&c,1) < 0) {
+		return -1;
+	}
+	frame->type = c;
+
+	// Read until END_DATA_HEADER
+	int i = 0;
+	do {
+		if (ads1x9x_evm_parser_read(p,&c,1) < 0) {
+			return -1;
+		}
+		frame->data[i]=c;
+		i++;
+	} while (c != END_DATA_HEADER && i < (int)sizeof(frame->data));
+
+	frame->length = i-1;
+	return 0;
+}
+
+/**
+ * Write a command to ADS1x9x EVM. Commands are:
+ * CMD_REG_WRITE (0x91): register, value
+ * CMD_REG_READ (0x92): register, 0x00
+ * CMD_DATA_STREAMING (0x93): on/off, 0x00  (0x00 = off, 0x01 = on)
+ *
+ * @return 0 if successful, -1 on write error.
+ */
+int ads1x9x_evm_write_cmd (ads1x9x_transport_t *t, int cmd, int param0, int param1) {
+
+	uint8_t cmd_buf[7];
+
+	cmd_buf[0] = START_DATA_HEADER;
+	cmd_buf[1] = cmd;
+	cmd_buf[2] = param0;
+	cmd_buf[3] = param1;
+	cmd_buf[4] = END_DATA_HEADER;
+	cmd_buf[5] = END_DATA_HEADER;
+	cmd_buf[6] = 0x0A;
+
+	ADS1X9X_PROBE2(cmd_sent, cmd, param0);
+	if (t->trace != NULL) {
+		ads1x9x_pcapng_write(t->trace, t->trace_interface, ADS1X9X_PCAPNG_OUTBOUND, 0,
+			NULL, cmd_buf, sizeof(cmd_buf));
+	}
+	return t->write (t, cmd_buf, sizeof(cmd_buf)) == sizeof(cmd_buf) ? 0 : -1;
+}
+
+/**
+ * Set span to the samples carried by a CMD_DATA_STREAMING or
+ * CMD_ACQUIRE_DATA frame. The span points into frame->data.
+ *
+ * @return 0 if successful, -1 if the frame type carries no samples.
+ */
+int ads1x9x_evm_frame_span (const ads1x9x_evm_frame_t *frame, ads1x9x_span_t *span) {
+	switch (frame->type) {
+		case CMD_DATA_STREAMING:
+			span->data = frame->data + 3;
+			span->nrows = EVM_STREAM_ROWS;
+			span->width = 2;
+			span->big_endian = FALSE;
+			break;
+		case CMD_ACQUIRE_DATA:
+		case CMD_DATA_DOWNLOAD:
+			span->data = frame->data + 2;
+			span->nrows = EVM_ACQUIRE_ROWS;
+			span->width = 3;
+			span->big_endian = TRUE;
+			break;
+		default:
+			return -1;
+	}
+	span->nchannels = EVM_NCHANNELS;
+	span->stride = EVM_NCHANNELS * span->width;
+	return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * ads1x9x_evm.h - Host/USB protocol spoken by the TI ADS1x9x EVM firmware.
+ *
+ * EVM board schematics, BOM, firmware and sourcecode at
+ * ftp://ftp.ti.com/pub/data_acquisition/ECG_FE/ADS1292/
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_EVM_H
+#define ADS1X9X_EVM_H
+
+#include <stdint.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_transport.h"
+
+#define FILTER_40HZ_LOWPASS 1
+// 50Hz notch and 0.5-150Hz pass
+#define FILTER_50HZ_NOTCH 2
+// 60Hz notch and 0.5-150Hz pass
+#define FILTER_60HZ_NOTCH 3
+
+// Host/USB protocol command definitions in ADS1x9x_USB_Communication.h
+
+
+#define CMD_REG_WRITE			0x91
+#define CMD_REG_READ			0x92
+
+
+#define CMD_DATA_STREAMING		0x93
+
+#define CMD_ACQUIRE_DATA		0x94
+
+#define PROC_DATA_DOWNLOAD_COMMAND	0x95
+#define CMD_DATA_DOWNLOAD		0x96
+#define FIRMWARE_UPGRADE_COMMAND	0x97
+#define START_RECORDING_COMMAND		0x98
+
+
+#define CMD_QUERY_FIRMWARE_VERSION		0x99
+
+#define STATUS_INFO_REQ 			0x9A
+#define CMD_FILTER_SELECT		0x9B
+#define CMD_ERASE_MEMORY		0x9C
+
+// Seems to have no effect
+#define CMD_RESTART				0x9D
+
+// Host <-> EVM data frames
+// START_DATA_HEADER (packet type/cmd) (data ...) END_DATA_HEADER
+#define START_DATA_HEADER			0x02
+#define END_DATA_HEADER				0x03
+
+// CMD_DATA_STREAMING frame: HR + RESP + LOFF + 14 x (ch1(16bits) + ch2(16bits)) + 2 x EOD
+#define EVM_STREAM_PAYLOAD 59
+#define EVM_STREAM_ROWS 14
+#define EVM_STREAM_SPS 500
+
+// CMD_ACQUIRE_DATA frame: 2 x status bytes + 8 x (ch1(24bits) + ch2(24bits)) + EOD
+#define EVM_ACQUIRE_PAYLOAD 50
+#define EVM_ACQUIRE_ROWS 8
+// LOFF_STAT bits of the status word at the start of the frame
+#define EVM_ACQUIRE_LEAD_OFF(data) ((((data)[0] & 0x0f) << 1) | ((data)[1] >> 7))
+
+// CMD_DATA_DOWNLOAD: the flash recording is sent as frames with the
+// CMD_ACQUIRE_DATA layout, ended by an empty frame (02 96 03)
+#define EVM_DOWNLOAD_PAYLOAD EVM_ACQUIRE_PAYLOAD
+#define EVM_DOWNLOAD_ROWS EVM_ACQUIRE_ROWS
+
+#define EVM_NCHANNELS 2
+
+// A structure that represents one frame of Host/USB protocol.
+typedef struct  {
+	uint8_t type;
+	uint8_t length;
+	uint8_t data[128];
+	// Host time the read that completed the frame returned, ns
+	// (CLOCK_MONOTONIC)
+	uint64_t read_ns;
+} ads1x9x_evm_frame_t;
+
+#define ADS1X9X_EVM_PARSER_BUF_SIZE 4096
+#define ADS1X9X_EVM_TRACE_DISCARD 256
+
+/**
+ * Frame parser state. Bytes are read from the transport in bulk into buf
+ * and frames validated and extracted from there.
+ */
+typedef struct {
+	ads1x9x_transport_t *t;
+	int head;
+	int tail;
+	int in_sync;
+	uint64_t discarded_since_sync;
+	// frame_start probe fired for the candidate frame at head
+	int start_probed;
+	// Host time of the last read or feed, ns
+	uint64_t read_ns;
+
+	// Valid frames extracted
+	uint64_t frames;
+	// Times the parser lost frame alignment
+	uint64_t resyncs;
+	// Bytes skipped while looking for a valid frame
+	uint64_t discarded_bytes;
+	// Estimate of frames lost in the discarded bytes
+	uint64_t lost_frames;
+
+	// Protocol trace of frames and discarded bytes, taken from the
+	// transport. A run of discarded bytes is held here until the next
+	// frame or the end of the buffered data, to go out as one block.
+	ads1x9x_pcapng_t *trace;
+	int trace_interface;
+	uint8_t trace_discard[ADS1X9X_EVM_TRACE_DISCARD];
+	int trace_discard_len;
+	uint64_t trace_discard_ns;
+
+	uint8_t buf[ADS1X9X_EVM_PARSER_BUF_SIZE];
+} ads1x9x_evm_parser_t;
+
+// Decoders operate on frame.data. Rows are ch1 (respiration on the
+// ADS1292R) followed by ch2 (ECG).
+ADS1X9X_DEFINE_DECODER(ads1x9x_evm_decode_stream, s16le, 3, EVM_STREAM_ROWS, EVM_NCHANNELS)
+ADS1X9X_DEFINE_DECODER(ads1x9x_evm_decode_acquire, s24be, 2, EVM_ACQUIRE_ROWS, EVM_NCHANNELS)
+
+ads1x9x_transport_t *ads1x9x_evm_open (const char *device, int bps);
+void ads1x9x_evm_close (ads1x9x_transport_t *t);
+void ads1x9x_evm_parser_init (ads1x9x_evm_parser_t *p, ads1x9x_transport_t *t);
+int ads1x9x_evm_parser_feed (ads1x9x_evm_parser_t *p, const uint8_t *data, int length);
+int ads1x9x_evm_parser_read (ads1x9x_evm_parser_t *p, void *buf, int length);
+int ads1x9x_evm_parse (ads1x9x_evm_parser_t *p, ads1x9x_evm_frame_t *frame);
+int ads1x9x_evm_read_frame (ads1x9x_evm_parser_t *p, ads1x9x_evm_frame_t *frame);
+int ads1x9x_evm_read_frame_to_eod (ads1x9x_evm_parser_t *p, ads1x9x_evm_frame_t *frame);
+int ads1x9x_evm_write_cmd (ads1x9x_transport_t *t, int cmd, int param0, int param1);
+int ads1x9x_evm_frame_span (const ads1x9x_evm_frame_t *frame, ads1x9x_span_t *span);
+void ads1x9x_display_hex (const uint8_t *buf, int length);
+
+#endif
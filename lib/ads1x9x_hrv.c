@@ -0,0 +1,278 @@
+/**
+ * ads1x9x_hrv.c - streaming R peak detection and heart rate variability.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_hrv.h"
+
+// Accepted RR range and the largest change from the previous RR, beyond
+// which a beat is taken as missed, extra or ectopic
+#define RR_MIN_US 250000
+#define RR_MAX_US 2500000
+#define RR_MAX_CHANGE 0.4
+// Rejections in a row after which the next RR in range is accepted, so a
+// genuine step change in rate is followed
+#define RR_MAX_REJECTS 3
+
+void ads1x9x_rpeak_init (ads1x9x_rpeak_t *d, int sps) {
+	memset(d, 0, sizeof(*d));
+	d->sps = sps;
+	d->window = sps * 150 / 1000;
+	if (d->window > ADS1X9X_RPEAK_MAX_WINDOW) {
+		d->window = ADS1X9X_RPEAK_MAX_WINDOW;
+	}
+	d->refractory = sps * 200 / 1000;
+}
+
+/**
+ * Process one ECG sample. Peaks of the integrated signal are classified
+ * against the adaptive threshold once the first two seconds have set
+ * the initial signal and noise levels.
+ *
+ * @param r_index Receives the sample index of the R peak when one is
+ * detected. Detection is about one integration window behind the peak.
+ * @return 1 if an R peak was detected, else 0.
+ */
+int ads1x9x_rpeak_process (ads1x9x_rpeak_t *d, int32_t x, uint64_t *r_index) {
+	uint64_t n = d->n++;
+	int slot = n % d->window;
+	int64_t dx = (int64_t)x - d->x2;
+	int64_t s = dx * dx;
+	int found = 0;
+	int i;
+
+	d->x2 = d->x1;
+	d->x1 = x;
+	d->mwi_sum += s - d->sq[slot];
+	d->sq[slot] = s;
+	d->raw[slot] = x;
+	int64_t mwi = d->mwi_sum;
+
+	uint64_t learn = 2 * d->sps;
+	if (n < learn) {
+		if (mwi > d->learn_max) {
+			d->learn_max = mwi;
+		}
+		d->learn_sum += mwi;
+		if (n == learn - 1) {
+			d->spk = d->learn_max / 3;
+			d->npk = d->learn_sum / learn / 2;
+			d->threshold = d->npk + 0.25 * (d->spk - d->npk);
+		}
+	} else if (d->mwi1 > mwi && d->mwi1 >= d->mwi2) {
+		// Local maximum of the integral at n-1. Peaks inside the
+		// refractory period are the same QRS complex and ignored.
+		double peak = d->mwi1;
+		if (n - 1 - d->last_r > (uint64_t)d->refractory) {
+			if (peak > d->threshold) {
+				// The R peak is the sample furthest from the window
+				// mean, so QRS complexes of either polarity are found
+				int64_t sum = 0;
+				for (i = 0; i < d->window; i++) {
+					sum += d->raw[i];
+				}
+				double mean = (double)sum / d->window;
+				uint64_t r = n;
+				double max = 0;
+				for (i = 0; i < d->window; i++) {
+					double dev = d->raw[(n - i) % d->window] - mean;
+					if (dev < 0) {
+						dev = -dev;
+					}
+					if (dev > max) {
+						max = dev;
+						r = n - i;
+					}
+				}
+				*r_index = r;
+				d->last_r = n - 1;
+				d->spk = 0.125 * peak + 0.875 * d->spk;
+				found = 1;
+			} else {
+				d->npk = 0.125 * peak + 0.875 * d->npk;
+			}
+			d->threshold = d->npk + 0.25 * (d->spk - d->npk);
+		}
+	}
+
+	d->mwi2 = d->mwi1;
+	d->mwi1 = mwi;
+	return found;
+}
+
+/**
+ * @param window_s Time window for SDNN, RMSSD and pNN50
+ */
+void ads1x9x_hrv_init (ads1x9x_hrv_t *h, int window_s) {
+	int i;
+	memset(h, 0, sizeof(*h));
+	h->window_us = (int64_t)window_s * 1000000;
+	for (i = 0; i < ADS1X9X_HRV_NBINS; i++) {
+		double w = 2 * M_PI * (ADS1X9X_HRV_LF_BIN0 + i) / ADS1X9X_HRV_DFT_N;
+		h->cos_k[i] = cos(w);
+		h->sin_k[i] = sin(w);
+	}
+}
+
+/**
+ * Add a tachogram sample to the sliding DFT. Every DFT_N samples the
+ * bins are recomputed from the window to discard rounding drift.
+ */
+static void tacho_push (ads1x9x_hrv_t *h, double v) {
+	double old = h->tacho[h->tacho_head];
+	int i, j;
+
+	v -= h->tacho_base;
+	h->tacho[h->tacho_head] = v;
+	h->tacho_head = (h->tacho_head + 1) % ADS1X9X_HRV_DFT_N;
+	h->tacho_n++;
+
+	if (h->tacho_n % ADS1X9X_HRV_DFT_N == 0) {
+		for (i = 0; i < ADS1X9X_HRV_NBINS; i++) {
+			int k = ADS1X9X_HRV_LF_BIN0 + i;
+			double re = 0, im = 0;
+			for (j = 0; j < ADS1X9X_HRV_DFT_N; j++) {
+				double w = 2 * M_PI * ((k * j) % ADS1X9X_HRV_DFT_N) / ADS1X9X_HRV_DFT_N;
+				double x = h->tacho[(h->tacho_head + j) % ADS1X9X_HRV_DFT_N];
+				re += x * cos(w);
+				im -= x * sin(w);
+			}
+			h->re[i] = re;
+			h->im[i] = im;
+		}
+		return;
+	}
+
+	// X_k <- (X_k - oldest + newest) e^(i 2 pi k / N)
+	for (i = 0; i < ADS1X9X_HRV_NBINS; i++) {
+		double a = h->re[i] - old + v;
+		double b = h->im[i];
+		h->re[i] = a * h->cos_k[i] - b * h->sin_k[i];
+		h->im[i] = a * h->sin_k[i] + b * h->cos_k[i];
+	}
+}
+
+/**
+ * Drop the oldest RR interval from the window.
+ */
+static void rr_evict (ads1x9x_hrv_t *h) {
+	int i = (h->head - h->count + ADS1X9X_HRV_MAX_BEATS) % ADS1X9X_HRV_MAX_BEATS;
+	int j = (i + 1) % ADS1X9X_HRV_MAX_BEATS;
+	h->sum -= h->rr[i];
+	h->sumsq -= h->rr[i] * h->rr[i];
+	h->span -= h->rr[i];
+	h->count--;
+	// The new oldest interval's difference was to the one evicted
+	if (h->count > 0 && h->diff_ok[j]) {
+		int64_t d = h->rr[j] - h->rr[i];
+		h->diff_sumsq -= d * d;
+		h->ndiff--;
+		h->nn50 -= d > 50000 || d < -50000;
+		h->diff_ok[j] = 0;
+	}
+}
+
+/**
+ * Add an R peak.
+ *
+ * @param t Time of the R peak, s
+ * @return 1 if the RR interval ending at this beat was accepted, 0 if it
+ * is the first beat or the interval was rejected as an artifact.
+ */
+int ads1x9x_hrv_beat (ads1x9x_hrv_t *h, double t) {
+	double prev_t = h->last_t;
+
+	h->last_t = t;
+	if (!h->have_beat) {
+		h->have_beat = TRUE;
+		return 0;
+	}
+
+	int64_t rr = (int64_t)((t - prev_t) * 1e6 + 0.5);
+	if (rr < RR_MIN_US || rr > RR_MAX_US || (h->last_rr > 0
+			&& (rr < h->last_rr * (1 - RR_MAX_CHANGE) || rr > h->last_rr * (1 + RR_MAX_CHANGE)))) {
+		if (++h->rejects >= RR_MAX_REJECTS) {
+			h->last_rr = 0;
+		}
+		return 0;
+	}
+	// After a rejection the next interval does not follow on from the
+	// last accepted one, so has no successive difference
+	int continuous = h->rejects == 0;
+	h->rejects = 0;
+
+	while (h->count > 0 && (h->span + rr > h->window_us || h->count == ADS1X9X_HRV_MAX_BEATS)) {
+		rr_evict(h);
+	}
+
+	int i = h->head;
+	h->rr[i] = rr;
+	h->diff_ok[i] = 0;
+	if (h->count > 0 && continuous) {
+		int64_t d = rr - h->rr[(i - 1 + ADS1X9X_HRV_MAX_BEATS) % ADS1X9X_HRV_MAX_BEATS];
+		h->diff_sumsq += d * d;
+		h->ndiff++;
+		h->nn50 += d > 50000 || d < -50000;
+		h->diff_ok[i] = 1;
+	}
+	h->head = (h->head + 1) % ADS1X9X_HRV_MAX_BEATS;
+	h->count++;
+	h->sum += rr;
+	h->sumsq += rr * rr;
+	h->span += rr;
+
+	// Resample the tachogram (RR in ms, linear between beats) at 4Hz
+	double rr_ms = rr * 1e-3;
+	if (h->tacho_n == 0 && h->next_tacho_t == 0) {
+		h->tacho_base = rr_ms;
+		h->next_tacho_t = t;
+	}
+	double last_ms = h->last_rr > 0 ? h->last_rr * 1e-3 : rr_ms;
+	while (h->next_tacho_t <= t) {
+		double f = (h->next_tacho_t - prev_t) / (t - prev_t);
+		tacho_push(h, last_ms + (rr_ms - last_ms) * (f < 0 ? 0 : f));
+		h->next_tacho_t += 1.0 / ADS1X9X_HRV_TACHO_SPS;
+	}
+
+	h->last_rr = rr;
+	return 1;
+}
+
+void ads1x9x_hrv_metrics (const ads1x9x_hrv_t *h, ads1x9x_hrv_metrics_t *m) {
+	int i;
+	memset(m, 0, sizeof(*m));
+	m->nbeats = h->count;
+	if (h->count == 0) {
+		return;
+	}
+	int last = (h->head - 1 + ADS1X9X_HRV_MAX_BEATS) % ADS1X9X_HRV_MAX_BEATS;
+	m->rr_ms = h->rr[last] * 1e-3;
+	m->hr_bpm = 60000.0 / m->rr_ms;
+	if (h->count > 1) {
+		double n = h->count;
+		double var = ((double)h->sumsq - (double)h->sum * h->sum / n) / (n - 1);
+		m->sdnn_ms = var > 0 ? sqrt(var) * 1e-3 : 0;
+	}
+	if (h->ndiff > 0) {
+		m->rmssd_ms = sqrt((double)h->diff_sumsq / h->ndiff) * 1e-3;
+		m->pnn50 = 100.0 * h->nn50 / h->ndiff;
+	}
+	if (h->tacho_n >= ADS1X9X_HRV_DFT_N) {
+		// One sided power, Parseval scaled to ms^2
+		double scale = 2.0 / ((double)ADS1X9X_HRV_DFT_N * ADS1X9X_HRV_DFT_N);
+		for (i = 0; i < ADS1X9X_HRV_NBINS; i++) {
+			double p = (h->re[i] * h->re[i] + h->im[i] * h->im[i]) * scale;
+			if (ADS1X9X_HRV_LF_BIN0 + i < ADS1X9X_HRV_HF_BIN0) {
+				m->lf_ms2 += p;
+			} else {
+				m->hf_ms2 += p;
+			}
+		}
+		m->lf_hf = m->hf_ms2 > 0 ? m->lf_ms2 / m->hf_ms2 : 0;
+	}
+}
@@ -0,0 +1,109 @@
+/**
+ * ads1x9x_hrv.h - streaming R peak detection and heart rate variability.
+ *
+ * The detector is a lightweight Pan-Tompkins: derivative, squaring and
+ * a 150ms moving window integral with adaptive signal and noise peak
+ * levels and a 200ms refractory period. The R peak time is the sample
+ * furthest from the mean of the integration window.
+ *
+ * The HRV engine keeps the RR intervals of a sliding time window with
+ * running integer sums, so SDNN, RMSSD and pNN50 cost O(1) per beat.
+ * LF and HF power come from a sliding DFT of the RR tachogram resampled
+ * at 4Hz, updating only the bins in the LF and HF bands.
+ *
+ * State is per device and fixed size, so many can run on one host.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_HRV_H
+#define ADS1X9X_HRV_H
+
+#include <stdint.h>
+
+#define ADS1X9X_RPEAK_MAX_WINDOW 256
+
+typedef struct {
+	int sps;
+	// Integration window and refractory period, samples
+	int window;
+	int refractory;
+	uint64_t n;
+
+	int32_t x1, x2;
+	int32_t raw[ADS1X9X_RPEAK_MAX_WINDOW];
+	int64_t sq[ADS1X9X_RPEAK_MAX_WINDOW];
+	int64_t mwi_sum;
+	int64_t mwi1, mwi2;
+
+	// Signal and noise peak levels, threshold between them
+	double spk, npk, threshold;
+	double learn_max, learn_sum;
+	uint64_t last_r;
+} ads1x9x_rpeak_t;
+
+void ads1x9x_rpeak_init (ads1x9x_rpeak_t *d, int sps);
+int ads1x9x_rpeak_process (ads1x9x_rpeak_t *d, int32_t x, uint64_t *r_index);
+
+// RR intervals held, enough for a 5 minute window at 240 bpm
+#define ADS1X9X_HRV_MAX_BEATS 1200
+// Tachogram sample rate and sliding DFT length (64s)
+#define ADS1X9X_HRV_TACHO_SPS 4
+#define ADS1X9X_HRV_DFT_N 256
+// DFT bins covering LF (0.04-0.15Hz) and HF (0.15-0.4Hz)
+#define ADS1X9X_HRV_LF_BIN0 3
+#define ADS1X9X_HRV_HF_BIN0 10
+#define ADS1X9X_HRV_HF_BIN1 25
+#define ADS1X9X_HRV_NBINS (ADS1X9X_HRV_HF_BIN1 - ADS1X9X_HRV_LF_BIN0 + 1)
+
+typedef struct {
+	double rr_ms;
+	double hr_bpm;
+	double sdnn_ms;
+	double rmssd_ms;
+	double pnn50;
+	// Band powers, ms^2, 0 until the tachogram window is full
+	double lf_ms2;
+	double hf_ms2;
+	double lf_hf;
+	int nbeats;
+} ads1x9x_hrv_metrics_t;
+
+typedef struct {
+	int64_t window_us;
+
+	// RR intervals in the window, us. diff_ok[i] is set if rr[i] has a
+	// successive difference counted in the sums.
+	int64_t rr[ADS1X9X_HRV_MAX_BEATS];
+	uint8_t diff_ok[ADS1X9X_HRV_MAX_BEATS];
+	int head;
+	int count;
+	int64_t sum;
+	int64_t sumsq;
+	int64_t span;
+	int64_t diff_sumsq;
+	int ndiff;
+	int nn50;
+
+	double last_t;
+	int64_t last_rr;
+	int have_beat;
+	int rejects;
+
+	// Tachogram and its sliding DFT over the LF and HF bins
+	double next_tacho_t;
+	double tacho_base;
+	double tacho[ADS1X9X_HRV_DFT_N];
+	int tacho_head;
+	uint64_t tacho_n;
+	double re[ADS1X9X_HRV_NBINS];
+	double im[ADS1X9X_HRV_NBINS];
+	double cos_k[ADS1X9X_HRV_NBINS];
+	double sin_k[ADS1X9X_HRV_NBINS];
+} ads1x9x_hrv_t;
+
+void ads1x9x_hrv_init (ads1x9x_hrv_t *h, int window_s);
+int ads1x9x_hrv_beat (ads1x9x_hrv_t *h, double t);
+void ads1x9x_hrv_metrics (const ads1x9x_hrv_t *h, ads1x9x_hrv_metrics_t *m);
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * ads1x9x_merge.c - time aligned merge of several device streams.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ads1x9x_merge.h"
+#include "ads1x9x_metrics.h"
+
+// Frames over which the clock fit is averaged, about a minute of EVM frames
+#define FIT_WINDOW 2048
+// Limit of the fitted rate relative to nominal. Crystals are within
+// ppm; this only stops early fits on jittery arrivals running away.
+#define MAX_RATE_ERROR 0.02
+
+/**
+ * @param nchannels Channels per input, the output has ninputs * nchannels
+ * @param sps Nominal input and output sample rate
+ * @param capacity Samples buffered per input
+ * @param max_latency_ms Longest an output row waits for a slow input
+ * @return Merge state or NULL if out of memory.
+ */
+ads1x9x_merge_t *ads1x9x_merge_new (int ninputs, int nchannels, int sps, int capacity, int max_latency_ms) {
+	ads1x9x_merge_t *m = calloc(1, sizeof(ads1x9x_merge_t) + ninputs * sizeof(ads1x9x_merge_input_t));
+	int i;
+	if (m == NULL) {
+		return NULL;
+	}
+	m->ninputs = ninputs;
+	m->nchannels = nchannels;
+	m->capacity = capacity;
+	m->period = 1.0 / sps;
+	m->max_latency_ns = (uint64_t)max_latency_ms * 1000000;
+	m->origin_ns = ads1x9x_now_ns();
+	for (i = 0; i < ninputs; i++) {
+		m->in[i].ring = calloc(capacity * nchannels, sizeof(int32_t));
+		m->in[i].b = m->period;
+		if (m->in[i].ring == NULL) {
+			ads1x9x_merge_free(m);
+			return NULL;
+		}
+	}
+	return m;
+}
+
+void ads1x9x_merge_free (ads1x9x_merge_t *m) {
+	int i;
+	for (i = 0; i < m->ninputs; i++) {
+		free(m->in[i].ring);
+	}
+	free(m);
+}
+
+/**
+ * Add a frame of nrows samples from an input.
+ *
+ * @param t_ns Host time the frame arrived (its last sample), ns
+ */
+void ads1x9x_merge_push (ads1x9x_merge_t *m, int input, uint64_t t_ns, const int32_t *samples, int nrows) {
+	ads1x9x_merge_input_t *in = &m->in[input];
+	int i;
+
+	for (i = 0; i < nrows; i++) {
+		memcpy(in->ring + (in->count % m->capacity) * m->nchannels,
+			samples + i * m->nchannels, m->nchannels * sizeof(int32_t));
+		in->count++;
+	}
+
+	// Update the fit with (index of last sample, arrival time)
+	double x = in->count - 1;
+	double y = (int64_t)(t_ns - m->origin_ns) * 1e-9;
+	in->frames++;
+	double w = in->frames < FIT_WINDOW ? 1.0 / in->frames : 1.0 / FIT_WINDOW;
+	double dx = x - in->mx;
+	double dy = y - in->my;
+	in->mx += w * dx;
+	in->my += w * dy;
+	in->vxx = (1 - w) * (in->vxx + w * dx * dx);
+	in->cxy = (1 - w) * (in->cxy + w * dx * dy);
+
+	double b = in->vxx > 0 ? in->cxy / in->vxx : m->period;
+	if (b < m->period * (1 - MAX_RATE_ERROR)) {
+		b = m->period * (1 - MAX_RATE_ERROR);
+	} else if (b > m->period * (1 + MAX_RATE_ERROR)) {
+		b = m->period * (1 + MAX_RATE_ERROR);
+	}
+	in->b = b;
+	in->a = in->my - b * in->mx;
+}
+
+/**
+ * No more data will arrive from input; rows are no longer held for it.
+ */
+void ads1x9x_merge_end (ads1x9x_merge_t *m, int input) {
+	m->in[input].ended = TRUE;
+}
+
+/**
+ * Value of channel c of input in at fractional sample index k.
+ */
+static int32_t interpolate (ads1x9x_merge_t *m, ads1x9x_merge_input_t *in, double k, int c) {
+	uint64_t j = (uint64_t)k;
+	double f = k - j;
+	int32_t s0 = in->ring[(j % m->capacity) * m->nchannels + c];
+	int32_t s1 = in->ring[((j + 1) % m->capacity) * m->nchannels + c];
+	double v = s0 + f * (s1 - s0);
+	return v < 0 ? (int32_t)(v - 0.5) : (int32_t)(v + 0.5);
+}
+
+/**
+ * Get the next output row if every input has data for it, or the row's
+ * wait for a slow input has exceeded max_latency.
+ *
+ * @param now_ns Current host time, ns
+ * @param t_ns Receives the host time of the row
+ * @param row Receives ninputs * nchannels samples
+ * @return 1 if a row was produced, 0 if not yet, -1 when all inputs have
+ * ended and there is nothing more to produce.
+ */
+int ads1x9x_merge_pop (ads1x9x_merge_t *m, uint64_t now_ns, uint64_t *t_ns, int32_t *row) {
+	int i, c;
+	int ready = 0, ended = 0;
+
+	if (!m->started) {
+		// Start once every input has a clock fit, at the latest first
+		// sample time among them
+		for (i = 0; i < m->ninputs; i++) {
+			ready += m->in[i].frames >= 2;
+			ended += m->in[i].ended;
+		}
+		if (ended == m->ninputs) {
+			return -1;
+		}
+		if (ready < m->ninputs) {
+			return 0;
+		}
+		m->t0 = m->in[0].a;
+		for (i = 1; i < m->ninputs; i++) {
+			if (m->in[i].a > m->t0) {
+				m->t0 = m->in[i].a;
+			}
+		}
+		m->started = TRUE;
+	}
+
+	double t = m->t0 + m->next * m->period;
+	uint64_t row_ns = m->origin_ns + (uint64_t)(t * 1e9);
+	int late = now_ns > row_ns && now_ns - row_ns > m->max_latency_ns;
+
+	ready = 0;
+	ended = 0;
+	for (i = 0; i < m->ninputs; i++) {
+		ads1x9x_merge_input_t *in = &m->in[i];
+		double k = (t - in->a) / in->b;
+		if (k + 1 < in->count) {
+			ready++;
+		} else if (in->ended) {
+			ended++;
+		} else if (!late) {
+			return 0;
+		}
+	}
+	if (ready == 0 && ended == m->ninputs) {
+		return -1;
+	}
+
+	for (i = 0; i < m->ninputs; i++) {
+		ads1x9x_merge_input_t *in = &m->in[i];
+		double k = (t - in->a) / in->b;
+		if (k < 0) {
+			k = 0;
+		}
+		if (k + 1 >= in->count) {
+			// No data yet: hold the last value
+			memcpy(row + i * m->nchannels, in->last, m->nchannels * sizeof(int32_t));
+			m->gaps++;
+			continue;
+		}
+		if (in->count > (uint64_t)m->capacity && k < in->count - m->capacity) {
+			// Overwritten before use
+			k = in->count - m->capacity;
+			m->overruns++;
+		}
+		for (c = 0; c < m->nchannels; c++) {
+			in->last[c] = row[i * m->nchannels + c] = interpolate(m, in, k, c);
+		}
+	}
+
+	*t_ns = row_ns;
+	m->next++;
+	m->rows++;
+	return 1;
+}
@@ -0,0 +1,63 @@
+/**
+ * ads1x9x_merge.h - merge sample streams from several devices onto one
+ * host timebase. Each input's sample clock is related to host time by a
+ * linear fit (offset and rate, tracking crystal drift) over its frame
+ * arrival times. Output rows at a fixed rate are interpolated from every
+ * input, waiting at most max_latency for a slow input before filling
+ * its channels with the last value seen.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_MERGE_H
+#define ADS1X9X_MERGE_H
+
+#include <stdint.h>
+
+#include "ads1x9x.h"
+
+typedef struct {
+	// Sample ring, capacity rows of nchannels
+	int32_t *ring;
+	// Samples received; index of the next sample
+	uint64_t count;
+	uint64_t frames;
+	// Exponentially weighted fit of host time (s since origin) against
+	// sample index: means, variance and covariance
+	double mx, my, vxx, cxy;
+	// Host time of sample k is a + b k
+	double a, b;
+	int ended;
+	int32_t last[ADS1X9X_MAX_CHANNELS];
+} ads1x9x_merge_input_t;
+
+typedef struct {
+	int ninputs;
+	int nchannels;
+	int capacity;
+	// Nominal and output sample period, s
+	double period;
+	uint64_t max_latency_ns;
+	// Host time origin, ns
+	uint64_t origin_ns;
+	int started;
+	// Host time of output row 0, s since origin
+	double t0;
+	uint64_t next;
+
+	// Output rows, times an input's channels were filled for want of
+	// data, and samples overwritten in a ring before use
+	uint64_t rows;
+	uint64_t gaps;
+	uint64_t overruns;
+
+	ads1x9x_merge_input_t in[];
+} ads1x9x_merge_t;
+
+ads1x9x_merge_t *ads1x9x_merge_new (int ninputs, int nchannels, int sps, int capacity, int max_latency_ms);
+void ads1x9x_merge_free (ads1x9x_merge_t *m);
+void ads1x9x_merge_push (ads1x9x_merge_t *m, int input, uint64_t t_ns, const int32_t *samples, int nrows);
+void ads1x9x_merge_end (ads1x9x_merge_t *m, int input);
+int ads1x9x_merge_pop (ads1x9x_merge_t *m, uint64_t now_ns, uint64_t *t_ns, int32_t *row);
+
+#endif
@@ -0,0 +1,250 @@
+/**
+ * ads1x9x_metrics.c - metrics exposition.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "ads1x9x_metrics.h"
+
+ads1x9x_metrics_t ads1x9x_metrics;
+
+// Dump requests and the Prometheus interval are checked this often
+#define TICK_NS 100000000ULL
+// Prometheus histogram buckets: every power of two ns from about 1us to
+// about 17s, the same set on every rewrite so series stay continuous.
+// Each is the end of an octave of the finer buckets, so counts are exact.
+#define PROM_MIN_SHIFT 10
+#define PROM_MAX_SHIFT 34
+
+static const char *prometheus_path = NULL;
+static uint64_t interval_ns;
+static uint64_t next_write_ns;
+static volatile sig_atomic_t dump_requested = 0;
+
+static pthread_t thread;
+static int running = 0;
+static int stopping = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond;
+
+typedef struct {
+	const char *name;
+	const char *help;
+	const char *type;
+	const uint64_t *value;
+} metric_t;
+
+static const metric_t metrics[] = {
+	{ "ads1x9x_frames_read_total", "Valid frames read from the device", "counter", &ads1x9x_metrics.frames_read },
+	{ "ads1x9x_bytes_read_total", "Bytes read from the device", "counter", &ads1x9x_metrics.bytes_read },
+	{ "ads1x9x_read_calls_total", "Transport reads", "counter", &ads1x9x_metrics.read_calls },
+	{ "ads1x9x_syscalls_total", "I/O system calls on the capture path", "counter", &ads1x9x_metrics.syscalls },
+	{ "ads1x9x_resyncs_total", "Times frame alignment was lost", "counter", &ads1x9x_metrics.resyncs },
+	{ "ads1x9x_discarded_bytes_total", "Bytes skipped resynchronising", "counter", &ads1x9x_metrics.discarded_bytes },
+	{ "ads1x9x_dropped_frames_total", "Estimated frames lost", "counter", &ads1x9x_metrics.dropped_frames },
+	{ "ads1x9x_output_bytes_total", "Bytes written to the output", "counter", &ads1x9x_metrics.output_bytes },
+	{ "ads1x9x_output_dropped_bytes_total", "Bytes dropped because the output fell behind", "counter", &ads1x9x_metrics.output_dropped_bytes },
+	{ "ads1x9x_alarms_total", "Alarm events raised or cleared", "counter", &ads1x9x_metrics.alarms },
+	{ "ads1x9x_alarms_late_total", "Alarm events delivered outside the latency budget", "counter", &ads1x9x_metrics.alarms_late },
+	{ "ads1x9x_parser_queue_bytes", "Bytes buffered in the frame parser", "gauge", &ads1x9x_metrics.parser_queue_bytes },
+	{ "ads1x9x_output_queue_depth", "Output buffers queued or in flight", "gauge", &ads1x9x_metrics.output_queue_depth },
+};
+
+typedef struct {
+	const char *name;
+	const char *help;
+	const ads1x9x_hist_t *hist;
+} hist_metric_t;
+
+static const hist_metric_t hists[] = {
+	{ "ads1x9x_read_to_output_seconds", "Frame read complete to output written", &ads1x9x_metrics.read_to_output },
+	{ "ads1x9x_drdy_to_sample_seconds", "DRDY asserted to sample read over SPI", &ads1x9x_metrics.drdy_to_sample },
+	{ "ads1x9x_alarm_latency_seconds", "Frame arrival to alarm delivered", &ads1x9x_metrics.alarm_latency },
+};
+
+#define NMETRICS (sizeof(metrics) / sizeof(metrics[0]))
+#define NHISTS (sizeof(hists) / sizeof(hists[0]))
+
+/**
+ * Largest value that falls in bucket i.
+ */
+static uint64_t bucket_upper (int i) {
+	if (i < (1 << ADS1X9X_HIST_SUB_BITS)) {
+		return i;
+	}
+	int shift = (i >> ADS1X9X_HIST_SUB_BITS) - 1;
+	uint64_t lower = (uint64_t)((1 << ADS1X9X_HIST_SUB_BITS) | (i & ((1 << ADS1X9X_HIST_SUB_BITS) - 1))) << shift;
+	return lower + (1ULL << shift) - 1;
+}
+
+/**
+ * Value at quantile q (0 to 1), to within the bucket resolution.
+ */
+uint64_t ads1x9x_hist_quantile (const ads1x9x_hist_t *h, double q) {
+	uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	uint64_t rank = (uint64_t)(q * count);
+	uint64_t seen = 0;
+	int i;
+	for (i = 0; i < ADS1X9X_HIST_BUCKETS; i++) {
+		seen += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		if (seen > rank) {
+			uint64_t upper = bucket_upper(i);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
+
+/**
+ * Timer thread: services dump requests and rewrites the Prometheus file,
+ * so neither waits for the capture loop, which may be blocked in a read.
+ */
+static void *metrics_thread (void *arg) {
+	struct timespec deadline;
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	while (!stopping) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += TICK_NS;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!stopping && pthread_cond_timedwait(&cond, &lock, &deadline) != ETIMEDOUT) {
+		}
+		if (dump_requested) {
+			dump_requested = 0;
+			ads1x9x_metrics_dump(stderr);
+		}
+		uint64_t now = ads1x9x_now_ns();
+		if (prometheus_path != NULL && now >= next_write_ns) {
+			next_write_ns = now + interval_ns;
+			ads1x9x_metrics_write_prometheus(prometheus_path);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/**
+ * Start the metrics thread.
+ *
+ * @param prometheus_file Rewritten every interval_ms, and once more by
+ * ads1x9x_metrics_stop(), or NULL for none.
+ * @return 0 if successful, -1 if the thread could not be started.
+ */
+int ads1x9x_metrics_init (const char *prometheus_file, int interval_ms) {
+	pthread_condattr_t attr;
+
+	prometheus_path = prometheus_file;
+	interval_ns = (uint64_t)interval_ms * 1000000;
+	next_write_ns = 0;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&thread, NULL, metrics_thread, NULL) != 0) {
+		return -1;
+	}
+	running = 1;
+	return 0;
+}
+
+/**
+ * Stop the metrics thread and write the Prometheus file a last time.
+ */
+void ads1x9x_metrics_stop (void) {
+	if (running) {
+		pthread_mutex_lock(&lock);
+		stopping = 1;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&lock);
+		pthread_join(thread, NULL);
+		running = 0;
+	}
+	if (prometheus_path != NULL) {
+		ads1x9x_metrics_write_prometheus(prometheus_path);
+	}
+}
+
+/**
+ * Ask for a dump to stderr, made by the metrics thread within 100ms.
+ * Safe to call from a signal handler.
+ */
+void ads1x9x_metrics_request_dump (void) {
+	dump_requested = 1;
+}
+
+/**
+ * Write all metrics in Prometheus text format to path. The file is
+ * written under a temporary name and renamed into place so readers
+ * never see a partial file.
+ *
+ * @return 0 if successful, -1 on error.
+ */
+int ads1x9x_metrics_write_prometheus (const char *path) {
+	char tmp[1024];
+	unsigned i;
+	int b;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *f = fopen(tmp, "w");
+	if (f == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < NMETRICS; i++) {
+		fprintf(f, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+			metrics[i].name, metrics[i].help, metrics[i].name, metrics[i].type, metrics[i].name,
+			(unsigned long long)__atomic_load_n(metrics[i].value, __ATOMIC_RELAXED));
+	}
+
+	for (i = 0; i < NHISTS; i++) {
+		const ads1x9x_hist_t *h = hists[i].hist;
+		uint64_t cumulative = 0;
+		fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", hists[i].name, hists[i].help, hists[i].name);
+		int shift = PROM_MIN_SHIFT;
+		for (b = 0; b < ADS1X9X_HIST_BUCKETS; b++) {
+			cumulative += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+			if (shift <= PROM_MAX_SHIFT && bucket_upper(b) + 1 == 1ULL << shift) {
+				fprintf(f, "%s_bucket{le=\"%.9g\"} %llu\n", hists[i].name,
+					(1ULL << shift) * 1e-9, (unsigned long long)cumulative);
+				shift++;
+			}
+		}
+		fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", hists[i].name, (unsigned long long)cumulative);
+		fprintf(f, "%s_sum %.9g\n", hists[i].name, __atomic_load_n(&h->sum, __ATOMIC_RELAXED) * 1e-9);
+		fprintf(f, "%s_count %llu\n", hists[i].name, (unsigned long long)cumulative);
+	}
+
+	if (fclose(f) != 0) {
+		return -1;
+	}
+	return rename(tmp, path);
+}
+
+/**
+ * Human readable dump of all metrics.
+ */
+void ads1x9x_metrics_dump (FILE *f) {
+	unsigned i;
+	for (i = 0; i < NMETRICS; i++) {
+		fprintf(f, "%s %llu\n", metrics[i].name,
+			(unsigned long long)__atomic_load_n(metrics[i].value, __ATOMIC_RELAXED));
+	}
+	for (i = 0; i < NHISTS; i++) {
+		const ads1x9x_hist_t *h = hists[i].hist;
+		fprintf(f, "%s count %llu p50 %.3f us p99 %.3f us p99.9 %.3f us max %.3f us\n", hists[i].name,
+			(unsigned long long)h->count,
+			ads1x9x_hist_quantile(h, 0.5) * 1e-3, ads1x9x_hist_quantile(h, 0.99) * 1e-3,
+			ads1x9x_hist_quantile(h, 0.999) * 1e-3, h->max * 1e-3);
+	}
+	fflush(f);
+}
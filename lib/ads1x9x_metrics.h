@@ -0,0 +1,95 @@
+/**
+ * ads1x9x_metrics.h - capture metrics: counters, gauges and latency
+ * histograms. Updates are relaxed atomic operations with no locks so they
+ * can stay enabled in production. Metrics are exposed as a periodically
+ * rewritten Prometheus text file and dumped to stderr on request (SIGUSR1),
+ * both from a thread of their own.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_METRICS_H
+#define ADS1X9X_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Log-linear (HDR style) histogram. Values below 2^SUB_BITS have a
+ * bucket each; above that every power of two is split into 2^SUB_BITS
+ * buckets, so the bucket width is within 12.5% of the value.
+ */
+#define ADS1X9X_HIST_SUB_BITS 3
+#define ADS1X9X_HIST_BUCKETS ((64 - ADS1X9X_HIST_SUB_BITS + 1) << ADS1X9X_HIST_SUB_BITS)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[ADS1X9X_HIST_BUCKETS];
+} ads1x9x_hist_t;
+
+typedef struct {
+	// Counters
+	uint64_t frames_read;
+	uint64_t bytes_read;
+	uint64_t read_calls;
+	uint64_t syscalls;
+	uint64_t resyncs;
+	uint64_t discarded_bytes;
+	uint64_t dropped_frames;
+	uint64_t output_bytes;
+	uint64_t output_dropped_bytes;
+	uint64_t alarms;
+	uint64_t alarms_late;
+
+	// Gauges
+	uint64_t parser_queue_bytes;
+	uint64_t output_queue_depth;
+
+	// Latency histograms, ns
+	ads1x9x_hist_t read_to_output;
+	ads1x9x_hist_t drdy_to_sample;
+	ads1x9x_hist_t alarm_latency;
+} ads1x9x_metrics_t;
+
+extern ads1x9x_metrics_t ads1x9x_metrics;
+
+#define ADS1X9X_METRIC_ADD(name, n) __atomic_fetch_add(&ads1x9x_metrics.name, (n), __ATOMIC_RELAXED)
+#define ADS1X9X_METRIC_INC(name) ADS1X9X_METRIC_ADD(name, 1)
+#define ADS1X9X_METRIC_SET(name, v) __atomic_store_n(&ads1x9x_metrics.name, (v), __ATOMIC_RELAXED)
+
+static inline int ads1x9x_hist_index (uint64_t v) {
+	if (v < (1 << ADS1X9X_HIST_SUB_BITS)) {
+		return v;
+	}
+	int shift = 63 - __builtin_clzll(v) - ADS1X9X_HIST_SUB_BITS;
+	return ((shift + 1) << ADS1X9X_HIST_SUB_BITS)
+		+ ((v >> shift) & ((1 << ADS1X9X_HIST_SUB_BITS) - 1));
+}
+
+static inline void ads1x9x_hist_record (ads1x9x_hist_t *h, uint64_t v) {
+	__atomic_fetch_add(&h->buckets[ads1x9x_hist_index(v)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (v > max && !__atomic_compare_exchange_n(&h->max, &max, v, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+static inline uint64_t ads1x9x_now_ns (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t ads1x9x_hist_quantile (const ads1x9x_hist_t *h, double q);
+int ads1x9x_metrics_init (const char *prometheus_file, int interval_ms);
+void ads1x9x_metrics_stop (void);
+void ads1x9x_metrics_request_dump (void);
+int ads1x9x_metrics_write_prometheus (const char *path);
+void ads1x9x_metrics_dump (FILE *f);
+
+#endif
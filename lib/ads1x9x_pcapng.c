@@ -0,0 +1,242 @@
+/**
+ * ads1x9x_pcapng.c - protocol trace of Host/USB traffic in pcapng format.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_pcapng.h"
+#include "ads1x9x_metrics.h"
+
+#define BLOCK_SHB 0x0A0D0D0A
+#define BLOCK_IDB 0x00000001
+#define BLOCK_EPB 0x00000006
+
+#define OPT_ENDOFOPT 0
+#define OPT_COMMENT 1
+#define OPT_SHB_USERAPPL 4
+#define OPT_IF_NAME 2
+#define OPT_IF_TSRESOL 9
+#define OPT_EPB_FLAGS 2
+
+// Largest block: EPB header, a frame or discarded run, a comment,
+// epb_flags and the trailer
+#define MAX_BLOCK 512
+#define MAX_COMMENT 64
+#define FLUSH_INTERVAL_NS 1000000000ULL
+
+struct ads1x9x_pcapng {
+	ads1x9x_sink_t *out;
+	int interfaces;
+	// CLOCK_REALTIME - CLOCK_MONOTONIC, to stamp blocks with wall time
+	int64_t realtime_offset_ns;
+
+	// Blocks come from the capture thread; the flusher thread pushes
+	// them out once a second whether or not more arrive
+	pthread_t flusher;
+	int flusher_running;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+	int dirty;
+};
+
+typedef struct {
+	uint8_t buf[MAX_BLOCK];
+	int len;
+} block_t;
+
+static void put32 (block_t *b, uint32_t v) {
+	memcpy(b->buf + b->len, &v, 4);
+	b->len += 4;
+}
+
+static void put16 (block_t *b, uint16_t v) {
+	memcpy(b->buf + b->len, &v, 2);
+	b->len += 2;
+}
+
+/**
+ * Append length bytes and zero pad to a 32 bit boundary.
+ */
+static void put_padded (block_t *b, const void *data, int length) {
+	memcpy(b->buf + b->len, data, length);
+	b->len += length;
+	while (b->len & 3) {
+		b->buf[b->len++] = 0;
+	}
+}
+
+static void put_option (block_t *b, uint16_t code, const void *data, int length) {
+	put16(b, code);
+	put16(b, length);
+	put_padded(b, data, length);
+}
+
+static void block_begin (block_t *b, uint32_t type) {
+	b->len = 0;
+	put32(b, type);
+	// Total length, filled in by block_end()
+	put32(b, 0);
+}
+
+static int block_end (ads1x9x_pcapng_t *pc, block_t *b) {
+	uint32_t total = b->len + 4;
+	memcpy(b->buf + 4, &total, 4);
+	put32(b, total);
+	pthread_mutex_lock(&pc->lock);
+	int r = pc->out->write(pc->out, b->buf, b->len);
+	pc->dirty = TRUE;
+	pthread_mutex_unlock(&pc->lock);
+	return r;
+}
+
+/**
+ * Keep what is buffered no more than a second old, so a trace of a
+ * misbehaving unit is current when looked at even if it has gone quiet.
+ */
+static void *flusher_thread (void *arg) {
+	ads1x9x_pcapng_t *pc = arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&pc->lock);
+	while (!pc->stop) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += FLUSH_INTERVAL_NS / 1000000000ULL;
+		while (!pc->stop && pthread_cond_timedwait(&pc->cond, &pc->lock, &deadline) != ETIMEDOUT) {
+		}
+		if (pc->dirty) {
+			pc->out->flush(pc->out);
+			pc->dirty = FALSE;
+		}
+	}
+	pthread_mutex_unlock(&pc->lock);
+	return NULL;
+}
+
+/**
+ * Start a trace on out with a Section Header Block. Blocks are written
+ * in host byte order, which the byte order magic records.
+ *
+ * @param application Name recorded as shb_userappl
+ * @return Writer or NULL if the header could not be written.
+ */
+ads1x9x_pcapng_t *ads1x9x_pcapng_open (ads1x9x_sink_t *out, const char *application) {
+	ads1x9x_pcapng_t *pc = calloc(1, sizeof(ads1x9x_pcapng_t));
+	pthread_condattr_t attr;
+	struct timespec ts;
+	block_t b;
+
+	pc->out = out;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	pc->realtime_offset_ns = (int64_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec) - (int64_t)ads1x9x_now_ns();
+	pthread_mutex_init(&pc->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pc->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	block_begin(&b, BLOCK_SHB);
+	put32(&b, 0x1A2B3C4D);
+	put16(&b, 1);
+	put16(&b, 0);
+	// Section length not known
+	put32(&b, 0xFFFFFFFF);
+	put32(&b, 0xFFFFFFFF);
+	put_option(&b, OPT_SHB_USERAPPL, application, strlen(application));
+	put_option(&b, OPT_ENDOFOPT, NULL, 0);
+	if (block_end(pc, &b) < 0) {
+		free(pc);
+		return NULL;
+	}
+	pc->flusher_running = pthread_create(&pc->flusher, NULL, flusher_thread, pc) == 0;
+	return pc;
+}
+
+/**
+ * Add an interface, one per EVM, with nanosecond timestamps.
+ *
+ * @return Interface number for ads1x9x_pcapng_write() or -1 on error.
+ */
+int ads1x9x_pcapng_add_interface (ads1x9x_pcapng_t *pc, const char *name) {
+	uint8_t tsresol = 9;
+	int length = strlen(name);
+	block_t b;
+
+	if (length > 256) {
+		length = 256;
+	}
+	block_begin(&b, BLOCK_IDB);
+	put16(&b, ADS1X9X_PCAPNG_LINKTYPE_USER0);
+	put16(&b, 0);
+	// No snap length limit
+	put32(&b, 0);
+	put_option(&b, OPT_IF_NAME, name, length);
+	put_option(&b, OPT_IF_TSRESOL, &tsresol, 1);
+	put_option(&b, OPT_ENDOFOPT, NULL, 0);
+	if (block_end(pc, &b) < 0) {
+		return -1;
+	}
+	return pc->interfaces++;
+}
+
+/**
+ * Record one frame, or a run of bytes that were not a frame, as an
+ * Enhanced Packet Block.
+ *
+ * @param direction ADS1X9X_PCAPNG_INBOUND (EVM to host) or
+ * ADS1X9X_PCAPNG_OUTBOUND (host to EVM)
+ * @param t_ns Host time the bytes were read or written, ns
+ * (CLOCK_MONOTONIC), or 0 for now
+ * @param comment opt_comment for the block, or NULL
+ * @return 0 or -1 on error.
+ */
+int ads1x9x_pcapng_write (ads1x9x_pcapng_t *pc, int interface, int direction, uint64_t t_ns,
+		const char *comment, const void *data, int length) {
+	uint32_t flags = direction & 3;
+	int comment_len = comment != NULL ? strlen(comment) : 0;
+	block_t b;
+
+	if (comment_len > MAX_COMMENT) {
+		comment_len = MAX_COMMENT;
+	}
+	if (length > MAX_BLOCK - MAX_COMMENT - 48) {
+		length = MAX_BLOCK - MAX_COMMENT - 48;
+	}
+	uint64_t t = (t_ns != 0 ? t_ns : ads1x9x_now_ns()) + pc->realtime_offset_ns;
+
+	block_begin(&b, BLOCK_EPB);
+	put32(&b, interface);
+	put32(&b, t >> 32);
+	put32(&b, t);
+	put32(&b, length);
+	put32(&b, length);
+	put_padded(&b, data, length);
+	if (comment_len > 0) {
+		put_option(&b, OPT_COMMENT, comment, comment_len);
+	}
+	put_option(&b, OPT_EPB_FLAGS, &flags, 4);
+	put_option(&b, OPT_ENDOFOPT, NULL, 0);
+	return block_end(pc, &b);
+}
+
+/**
+ * Flush and close the trace and its sink.
+ */
+void ads1x9x_pcapng_close (ads1x9x_pcapng_t *pc) {
+	if (pc->flusher_running) {
+		pthread_mutex_lock(&pc->lock);
+		pc->stop = TRUE;
+		pthread_cond_signal(&pc->cond);
+		pthread_mutex_unlock(&pc->lock);
+		pthread_join(pc->flusher, NULL);
+	}
+	ads1x9x_sink_close(pc->out);
+	free(pc);
+}
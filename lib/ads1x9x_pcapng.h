@@ -0,0 +1,41 @@
+/**
+ * ads1x9x_pcapng.h - protocol trace of Host/USB traffic in pcapng format.
+ *
+ * Each command sent to an EVM and each frame received from it becomes an
+ * Enhanced Packet Block holding the frame as on the wire, with a
+ * nanosecond wall clock timestamp and the direction in epb_flags
+ * (outbound = host to EVM). Received frames are stamped with the time of
+ * the read that brought them in. Bytes the parser discarded while
+ * resynchronising are recorded too, each run as an inbound block with
+ * the comment "discarded", so a trace shows exactly what was on the wire.
+ * Every EVM is its own interface with link type LINKTYPE_USER0, so
+ * Wireshark shows the bytes without a dissector. Blocks go out through a
+ * buffered sink which a thread flushes once a second.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_PCAPNG_H
+#define ADS1X9X_PCAPNG_H
+
+#include <stdint.h>
+
+#include "ads1x9x_sink.h"
+
+#define ADS1X9X_PCAPNG_LINKTYPE_USER0 147
+
+#define ADS1X9X_PCAPNG_INBOUND 1
+#define ADS1X9X_PCAPNG_OUTBOUND 2
+
+// Comment on blocks of bytes discarded by the frame parser
+#define ADS1X9X_PCAPNG_DISCARDED "discarded"
+
+typedef struct ads1x9x_pcapng ads1x9x_pcapng_t;
+
+ads1x9x_pcapng_t *ads1x9x_pcapng_open (ads1x9x_sink_t *out, const char *application);
+int ads1x9x_pcapng_add_interface (ads1x9x_pcapng_t *pc, const char *name);
+int ads1x9x_pcapng_write (ads1x9x_pcapng_t *pc, int interface, int direction, uint64_t t_ns,
+	const char *comment, const void *data, int length);
+void ads1x9x_pcapng_close (ads1x9x_pcapng_t *pc);
+
+#endif
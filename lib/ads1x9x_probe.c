@@ -0,0 +1,281 @@
+/**
+ * ads1x9x_probe.c - find ADS1x9x EVMs and chips attached to the host.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "ads1x9x_probe.h"
+#include "ads1x9x_evm.h"
+#include "ads1x9x_spidev.h"
+
+// spidev nodes are never probed unless named: writing to a chip select
+// with no ADS1x9x behind it (eg the MCP482x DAC) sends it stray commands
+static const char *candidates[] = {
+	"/dev/ttyACM*",
+	"/dev/ttyUSB*",
+};
+
+/**
+ * Fill r with the serial ports present.
+ *
+ * @return Number of candidates, at most max.
+ */
+int ads1x9x_probe_find (ads1x9x_probe_result_t *r, int max) {
+	int n = 0;
+	int i;
+	size_t j;
+
+	for (i = 0; i < (int)ARRAY_SIZE(candidates); i++) {
+		glob_t g;
+		if (glob(candidates[i], 0, NULL, &g) != 0) {
+			continue;
+		}
+		for (j = 0; j < g.gl_pathc && n < max; j++) {
+			ads1x9x_probe_add(&r[n++], g.gl_pathv[j]);
+		}
+		globfree(&g);
+	}
+	return n;
+}
+
+/**
+ * Set r up to probe path, which is taken to be SPI if the name contains
+ * "spidev", else a serial port.
+ */
+void ads1x9x_probe_add (ads1x9x_probe_result_t *r, const char *path) {
+	memset(r, 0, sizeof(*r));
+	snprintf(r->path, sizeof(r->path), "%s", path);
+	r->kind = strstr(path, "spidev") != NULL ? "spidev" : "evm";
+	r->fw_major = r->fw_minor = r->id = -1;
+}
+
+const char *ads1x9x_probe_state_name (ads1x9x_probe_state_t state) {
+	switch (state) {
+		case ADS1X9X_PROBE_FOUND:
+			return "found";
+		case ADS1X9X_PROBE_STREAMING:
+			return "streaming";
+		case ADS1X9X_PROBE_BUSY:
+			return "busy";
+		case ADS1X9X_PROBE_ERROR:
+			return "error";
+		default:
+			return "none";
+	}
+}
+
+/**
+ * Open path and take an exclusive lock on it without waiting.
+ *
+ * @return File descriptor or -1 with r->state set.
+ */
+static int probe_open (ads1x9x_probe_result_t *r, int flags) {
+	int fd = open(r->path, flags);
+	if (fd < 0) {
+		r->state = ADS1X9X_PROBE_ERROR;
+		return -1;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		r->state = errno == EWOULDBLOCK ? ADS1X9X_PROBE_BUSY : ADS1X9X_PROBE_ERROR;
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Read REG_ID over SPI. The chip powers up in RDATAC mode, where register
+ * reads are ignored, so SDATAC is sent first.
+ */
+static void probe_spidev (ads1x9x_probe_result_t *r) {
+	spidev_opts_t opts;
+	uint8_t sdatac = CMD_SDATAC;
+	uint8_t tx[3] = {CMD_RREG | REG_ID, 0x00, 0x00};
+	uint8_t rx[3];
+
+	int fd = probe_open(r, O_RDWR);
+	if (fd < 0) {
+		return;
+	}
+	spidev_opts_init(&opts);
+	opts.device = r->path;
+	if (spidev_configure(fd, &opts) < 0
+			|| spidev_transfer(fd, &opts, &sdatac, NULL, 1) < 0
+			|| spidev_transfer(fd, &opts, tx, rx, sizeof(tx)) < 0) {
+		r->state = ADS1X9X_PROBE_ERROR;
+		close(fd);
+		return;
+	}
+	close(fd);
+	// An empty bus reads all zeros or all ones, neither a known ID
+	r->id = rx[2];
+	r->dev = ads1x9x_device_by_id(r->id);
+	r->state = r->dev != NULL ? ADS1X9X_PROBE_FOUND : ADS1X9X_PROBE_NONE;
+}
+
+typedef struct {
+	ads1x9x_probe_result_t *r;
+	int fd;
+	ads1x9x_transport_t t;
+	ads1x9x_evm_parser_t parser;
+	int streaming;
+} serial_probe_t;
+
+static int fd_write (ads1x9x_transport_t *t, const void *buf, int length) {
+	return write(t->fd, buf, length);
+}
+
+/**
+ * Handle the frames read so far from an EVM.
+ *
+ * @return 1 once the EVM has answered both queries, else 0.
+ */
+static int serial_probe_frames (serial_probe_t *s, double ms) {
+	ads1x9x_evm_frame_t frame;
+
+	while (ads1x9x_evm_parse(&s->parser, &frame) == 1) {
+		switch (frame.type) {
+			case CMD_QUERY_FIRMWARE_VERSION:
+				s->r->fw_major = frame.data[0];
+				s->r->fw_minor = frame.data[1];
+				s->r->state = ADS1X9X_PROBE_FOUND;
+				s->r->ms = ms;
+				ads1x9x_evm_write_cmd(&s->t, CMD_REG_READ, REG_ID, 0x00);
+				break;
+			case CMD_REG_READ:
+				s->r->id = frame.data[1];
+				s->r->dev = ads1x9x_device_by_id(s->r->id);
+				s->r->ms = ms;
+				return 1;
+			case CMD_DATA_STREAMING:
+				s->streaming = TRUE;
+				break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Probe n devices concurrently. Serial ports are sent
+ * CMD_QUERY_FIRMWARE_VERSION and then a REG_ID read; spidev nodes have
+ * REG_ID read directly.
+ *
+ * @param bps Serial speed. The EVM is a USB CDC device that ignores it.
+ * @param timeout_ms Time allowed for all replies.
+ * @return Number of devices found.
+ */
+int ads1x9x_probe_run (ads1x9x_probe_result_t *r, int n, int bps, int timeout_ms) {
+	serial_probe_t *s = calloc(n, sizeof(serial_probe_t));
+	struct pollfd *pfd = calloc(n, sizeof(struct pollfd));
+	int *idx = calloc(n, sizeof(int));
+	uint64_t t0 = ads1x9x_now_ns();
+	uint64_t deadline = t0 + (uint64_t)timeout_ms * 1000000;
+	int i, nserial = 0, found = 0;
+
+	// Queries go out to every port before any reply is waited for
+	for (i = 0; i < n; i++) {
+		if (strcmp(r[i].kind, "spidev") == 0) {
+			continue;
+		}
+		int fd = probe_open(&r[i], O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (fd < 0) {
+			continue;
+		}
+		if (ads1x9x_serial_configure(fd, bps) < 0) {
+			r[i].state = ADS1X9X_PROBE_ERROR;
+			close(fd);
+			continue;
+		}
+		tcflush(fd, TCIFLUSH);
+		serial_probe_t *sp = &s[nserial];
+		sp->r = &r[i];
+		sp->fd = fd;
+		sp->t.name = "probe";
+		sp->t.fd = fd;
+		sp->t.write = fd_write;
+		ads1x9x_evm_parser_init(&sp->parser, NULL);
+		if (ads1x9x_evm_write_cmd(&sp->t, CMD_QUERY_FIRMWARE_VERSION, 0x00, 0x00) < 0) {
+			r[i].state = ADS1X9X_PROBE_ERROR;
+			close(fd);
+			continue;
+		}
+		nserial++;
+	}
+
+	// SPI is synchronous and quick, so is done while the EVMs answer
+	for (i = 0; i < n; i++) {
+		if (strcmp(r[i].kind, "spidev") == 0) {
+			probe_spidev(&r[i]);
+		}
+	}
+
+	int pending = nserial;
+	while (pending > 0) {
+		uint64_t now = ads1x9x_now_ns();
+		if (now >= deadline) {
+			break;
+		}
+		int npfd = 0;
+		for (i = 0; i < nserial; i++) {
+			if (s[i].fd >= 0) {
+				pfd[npfd].fd = s[i].fd;
+				pfd[npfd].events = POLLIN;
+				idx[npfd++] = i;
+			}
+		}
+		int ms = (deadline - now + 999999) / 1000000;
+		if (poll(pfd, npfd, ms) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		double elapsed_ms = (ads1x9x_now_ns() - t0) * 1e-6;
+		int j;
+		for (j = 0; j < npfd; j++) {
+			serial_probe_t *sp = &s[idx[j]];
+			if (pfd[j].revents == 0) {
+				continue;
+			}
+			uint8_t buf[512];
+			int len = read(sp->fd, buf, sizeof(buf));
+			int done = len <= 0 && !(len < 0 && (errno == EAGAIN || errno == EINTR));
+			if (len > 0) {
+				ads1x9x_evm_parser_feed(&sp->parser, buf, len);
+				done = serial_probe_frames(sp, elapsed_ms);
+			}
+			if (done) {
+				close(sp->fd);
+				sp->fd = -1;
+				pending--;
+			}
+		}
+	}
+
+	for (i = 0; i < nserial; i++) {
+		if (s[i].fd >= 0) {
+			close(s[i].fd);
+		}
+		if (s[i].r->state == ADS1X9X_PROBE_NONE && s[i].streaming) {
+			s[i].r->state = ADS1X9X_PROBE_STREAMING;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		found += r[i].state == ADS1X9X_PROBE_FOUND;
+	}
+	free(s);
+	free(pfd);
+	free(idx);
+	return found;
+}
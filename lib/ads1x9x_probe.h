@@ -0,0 +1,53 @@
+/**
+ * ads1x9x_probe.h - find ADS1x9x EVMs and chips attached to the host.
+ *
+ * Every candidate serial port is opened and queried at once and the
+ * replies gathered in one poll() loop against a single deadline, so a
+ * probe takes about one EVM round trip however many ports there are and
+ * a port that never answers costs no more than the timeout. spidev
+ * nodes named explicitly are read directly for REG_ID, which takes
+ * microseconds; they are never found by ads1x9x_probe_find() because
+ * probing sends SDATAC and RREG to whatever is on that chip select.
+ *
+ * Devices locked by another capture (see ads1x9x_transport_open_serial
+ * and spidev_open) are reported busy and not disturbed.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_PROBE_H
+#define ADS1X9X_PROBE_H
+
+#include "ads1x9x.h"
+
+#define ADS1X9X_PROBE_MAX 32
+
+typedef enum {
+	ADS1X9X_PROBE_NONE = 0,    // no reply before the deadline
+	ADS1X9X_PROBE_FOUND,
+	ADS1X9X_PROBE_STREAMING,   // an EVM sending stream frames that did not reply
+	ADS1X9X_PROBE_BUSY,        // locked by another process
+	ADS1X9X_PROBE_ERROR,       // could not be opened or set up
+} ads1x9x_probe_state_t;
+
+typedef struct {
+	char path[64];
+	// "evm" for serial ports, "spidev" for SPI
+	const char *kind;
+	ads1x9x_probe_state_t state;
+	// Firmware version reported by an EVM, -1 if none
+	int fw_major;
+	int fw_minor;
+	// REG_ID value, -1 if not read
+	int id;
+	const ads1x9x_device_t *dev;
+	// Time from the start of the probe to the last reply, ms
+	double ms;
+} ads1x9x_probe_result_t;
+
+int ads1x9x_probe_find (ads1x9x_probe_result_t *r, int max);
+void ads1x9x_probe_add (ads1x9x_probe_result_t *r, const char *path);
+int ads1x9x_probe_run (ads1x9x_probe_result_t *r, int n, int bps, int timeout_ms);
+const char *ads1x9x_probe_state_name (ads1x9x_probe_state_t state);
+
+#endif
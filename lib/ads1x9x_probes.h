@@ -0,0 +1,46 @@
+/**
+ * ads1x9x_probes.h - USDT (statically defined) tracepoints on the capture
+ * path, provider "ads1x9x". With systemtap's sys/sdt.h available each
+ * probe compiles to a single nop plus an ELF note, so they cost nothing
+ * until attached with bpftrace, perf or systemtap (see
+ * etc/ads1x9x_latency.bt). Without sys/sdt.h, or with -DADS1X9X_NO_PROBES,
+ * they compile to nothing.
+ *
+ * Probes:
+ *   frame_start(type)            START_DATA_HEADER of a candidate frame seen
+ *   frame_complete(type, bytes)  frame validated and extracted
+ *   decode_done(rows)            frame converted to output format
+ *   output_flushed(bytes)        buffered output written to the descriptor
+ *   cmd_sent(cmd, param0)        Host/EVM command written
+ *   reply_received(type)         reply to a command read
+ *   drdy(sample, edge_ns)        DRDY edge handled (SPI); edge_ns is the
+ *                                kernel's CLOCK_MONOTONIC stamp of the edge
+ *   spi_xfer_start(bytes)        SPI transfer started
+ *   spi_xfer_done(bytes)         SPI transfer complete
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_PROBES_H
+#define ADS1X9X_PROBES_H
+
+#if !defined(ADS1X9X_NO_PROBES) && defined(HAVE_SYS_SDT_H)
+#define ADS1X9X_HAVE_SDT
+#elif !defined(ADS1X9X_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define ADS1X9X_HAVE_SDT
+#endif
+#endif
+
+#ifdef ADS1X9X_HAVE_SDT
+#include <sys/sdt.h>
+#define ADS1X9X_PROBE(name) DTRACE_PROBE(ads1x9x, name)
+#define ADS1X9X_PROBE1(name, a) DTRACE_PROBE1(ads1x9x, name, a)
+#define ADS1X9X_PROBE2(name, a, b) DTRACE_PROBE2(ads1x9x, name, a, b)
+#else
+#define ADS1X9X_PROBE(name) do { } while (0)
+#define ADS1X9X_PROBE1(name, a) do { } while (0)
+#define ADS1X9X_PROBE2(name, a, b) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * ads1x9x_quality.c - streaming signal quality index and gap aware output.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_quality.h"
+
+// Fraction of samples at a rail for a block to count as clipped
+#define CLIP_FRACTION 0.005
+// Drift and noise limits for 16 bit samples, scaled for wider ones
+#define DRIFT_LIMIT_16 500
+#define NOISE_LIMIT_16 150
+
+/**
+ * @param bits Sample width, 16 for stream frames or 24 for acquire data
+ * @param channel Channel judged for drift and noise
+ * @param block Samples per verdict. A verdict is given at the end of the
+ * push that reaches this, so pushes never straddle blocks.
+ */
+void ads1x9x_quality_init (ads1x9x_quality_t *q, int bits, int nchannels, int channel, int block) {
+	memset(q, 0, sizeof(*q));
+	q->nchannels = nchannels;
+	q->channel = channel;
+	q->block = block;
+	q->rail_hi = (1 << (bits - 1)) - 1;
+	q->rail_lo = -(1 << (bits - 1));
+	q->drift_limit = DRIFT_LIMIT_16 * (double)(1 << (bits - 16));
+	q->noise_limit = NOISE_LIMIT_16 * (double)(1 << (bits - 16));
+	q->sqi = 100;
+}
+
+/**
+ * Add rows of nchannels samples sharing one lead-off status.
+ *
+ * @return 1 if a block was completed and sqi and flags updated, else 0.
+ */
+int ads1x9x_quality_push (ads1x9x_quality_t *q, int lead_off, const int32_t *samples, int nrows) {
+	int i, c;
+
+	q->lead_off |= lead_off != 0;
+	for (i = 0; i < nrows; i++) {
+		const int32_t *row = samples + i * q->nchannels;
+		for (c = 0; c < q->nchannels; c++) {
+			if (row[c] >= q->rail_hi || row[c] <= q->rail_lo) {
+				q->clipped++;
+			}
+		}
+		int32_t x = row[q->channel];
+		if (q->samples >= 2) {
+			double d2 = (double)x - 2.0 * q->x1 + q->x2;
+			q->d2_sumsq += d2 * d2;
+		}
+		q->x2 = q->x1;
+		q->x1 = x;
+		q->sum += x;
+		q->samples++;
+		q->n++;
+	}
+	if (q->n < q->block) {
+		return 0;
+	}
+
+	double mean = (double)q->sum / q->n;
+	double drift = q->have_mean ? fabs(mean - q->last_mean) : 0;
+	double noise = sqrt(q->d2_sumsq / q->n);
+	q->flags = 0;
+	if (q->lead_off) {
+		q->flags |= ADS1X9X_QUALITY_LEAD_OFF;
+	}
+	if (q->clipped > CLIP_FRACTION * q->n * q->nchannels) {
+		q->flags |= ADS1X9X_QUALITY_CLIPPED;
+	}
+	if (drift > q->drift_limit) {
+		q->flags |= ADS1X9X_QUALITY_DRIFT;
+	}
+	if (noise > q->noise_limit) {
+		q->flags |= ADS1X9X_QUALITY_NOISE;
+	}
+	if (q->flags) {
+		q->sqi = 0;
+	} else {
+		double sqi = 100 - 50 * drift / q->drift_limit - 50 * noise / q->noise_limit;
+		q->sqi = sqi < 0 ? 0 : (int)sqi;
+	}
+
+	q->last_mean = mean;
+	q->have_mean = TRUE;
+	q->n = 0;
+	q->lead_off = 0;
+	q->clipped = 0;
+	q->sum = 0;
+	q->d2_sumsq = 0;
+	return 1;
+}
+
+/**
+ * Format flags as a comma separated list of reasons.
+ */
+const char *ads1x9x_quality_reasons (int flags, char *buf, int size) {
+	snprintf(buf, size, "%s%s%s%s",
+		flags & ADS1X9X_QUALITY_LEAD_OFF ? "lead_off," : "",
+		flags & ADS1X9X_QUALITY_CLIPPED ? "clipped," : "",
+		flags & ADS1X9X_QUALITY_DRIFT ? "drift," : "",
+		flags & ADS1X9X_QUALITY_NOISE ? "noise," : "");
+	int n = strlen(buf);
+	if (n > 0) {
+		buf[n - 1] = '\0';
+	}
+	return buf;
+}
+
+typedef struct {
+	ads1x9x_sink_t *next;
+	char *buf;
+	int fill;
+	int size;
+} gate_sink_t;
+
+static int gate_sink_write (ads1x9x_sink_t *s, const void *buf, int length) {
+	gate_sink_t *g = s->priv;
+	if (g->fill + length > g->size) {
+		int size = g->size * 2 > g->fill + length ? g->size * 2 : g->fill + length;
+		char *p = realloc(g->buf, size);
+		if (p == NULL) {
+			return -1;
+		}
+		g->buf = p;
+		g->size = size;
+	}
+	memcpy(g->buf + g->fill, buf, length);
+	g->fill += length;
+	return 0;
+}
+
+/**
+ * Held output waits for its verdict; only what has been released is
+ * flushed.
+ */
+static int gate_sink_flush (ads1x9x_sink_t *s) {
+	gate_sink_t *g = s->priv;
+	return g->next->flush(g->next);
+}
+
+static void gate_sink_close (ads1x9x_sink_t *s) {
+	gate_sink_t *g = s->priv;
+	ads1x9x_gate_sink_release(s, TRUE);
+	ads1x9x_sink_close(g->next);
+	free(g->buf);
+	free(g);
+	free(s);
+}
+
+/**
+ * Sink that holds output until released. Closing it releases what is
+ * held and closes next.
+ */
+ads1x9x_sink_t *ads1x9x_gate_sink_open (ads1x9x_sink_t *next) {
+	ads1x9x_sink_t *s = calloc(1, sizeof(ads1x9x_sink_t));
+	gate_sink_t *g = calloc(1, sizeof(gate_sink_t));
+	g->next = next;
+	s->name = "gate";
+	s->fd = next->fd;
+	s->priv = g;
+	s->write = gate_sink_write;
+	s->flush = gate_sink_flush;
+	s->close = gate_sink_close;
+	return s;
+}
+
+/**
+ * Pass the held output on if keep, else drop it.
+ *
+ * @return 0 or -1 if writing to the next sink failed.
+ */
+int ads1x9x_gate_sink_release (ads1x9x_sink_t *s, int keep) {
+	gate_sink_t *g = s->priv;
+	int r = 0;
+	if (keep && g->fill > 0) {
+		r = g->next->write(g->next, g->buf, g->fill);
+	}
+	g->fill = 0;
+	return r;
+}
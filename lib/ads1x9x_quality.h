@@ -0,0 +1,61 @@
+/**
+ * ads1x9x_quality.h - streaming signal quality index and gap aware output.
+ *
+ * Quality is judged over blocks of samples from the lead-off status,
+ * samples at the ADC rails (16 bit stream or 24 bit acquire data),
+ * baseline drift (change in block mean) and high frequency noise (RMS
+ * second difference). A gate sink holds the output of the current block
+ * until its verdict and then passes it on or drops it, so poor quality
+ * stretches cost neither storage nor upload.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_QUALITY_H
+#define ADS1X9X_QUALITY_H
+
+#include <stdint.h>
+
+#include "ads1x9x_sink.h"
+
+// Reasons a block is poor, or'd together in flags
+#define ADS1X9X_QUALITY_LEAD_OFF 0x01
+#define ADS1X9X_QUALITY_CLIPPED 0x02
+#define ADS1X9X_QUALITY_DRIFT 0x04
+#define ADS1X9X_QUALITY_NOISE 0x08
+
+typedef struct {
+	int nchannels;
+	// Channel judged for drift and noise
+	int channel;
+	int block;
+	int32_t rail_lo, rail_hi;
+	// Limits in ADC units of the sample width
+	double drift_limit;
+	double noise_limit;
+
+	// Current block
+	int n;
+	int lead_off;
+	int clipped;
+	int64_t sum;
+	double d2_sumsq;
+	int32_t x1, x2;
+	uint64_t samples;
+
+	double last_mean;
+	int have_mean;
+
+	// Verdict on the last complete block: index 0-100 and reasons
+	int sqi;
+	int flags;
+} ads1x9x_quality_t;
+
+void ads1x9x_quality_init (ads1x9x_quality_t *q, int bits, int nchannels, int channel, int block);
+int ads1x9x_quality_push (ads1x9x_quality_t *q, int lead_off, const int32_t *samples, int nrows);
+const char *ads1x9x_quality_reasons (int flags, char *buf, int size);
+
+ads1x9x_sink_t *ads1x9x_gate_sink_open (ads1x9x_sink_t *next);
+int ads1x9x_gate_sink_release (ads1x9x_sink_t *s, int keep);
+
+#endif
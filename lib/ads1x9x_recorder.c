@@ -0,0 +1,499 @@
+/**
+ * ads1x9x_recorder.c - crash safe segmented recording sink.
+ *
+ * The journal holds two 32 byte records written alternately, each with a
+ * sequence number and check value, so a torn journal write leaves the
+ * previous record intact. A record (segment, length) means the first
+ * length bytes of that segment and all earlier segments are on disk.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_recorder.h"
+#include "ads1x9x_metrics.h"
+#include "ads1x9x_probes.h"
+
+// Two buffers of queued output: the capture thread fills one while the
+// writer thread writes out the other. The writer is woken once a buffer
+// is half full.
+#define RECORDER_BUF_SIZE (1 << 20)
+// Segment rotations queued in one buffer
+#define RECORDER_MAX_CUTS 8
+#define JOURNAL_MAGIC 0x4a583941	// "A9XJ"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t segment;
+	uint64_t seq;
+	uint64_t length;
+	uint32_t check;
+	uint32_t reserved;
+} journal_record_t;
+
+typedef struct {
+	int fill;
+	// Offsets at which a new segment starts
+	int ncuts;
+	int cut[RECORDER_MAX_CUTS];
+	uint8_t data[RECORDER_BUF_SIZE];
+} recorder_buf_t;
+
+typedef struct {
+	char dir[512];
+	uint64_t segment_bytes;
+	uint64_t segment_ns;
+	uint64_t sync_ns;
+
+	int dir_fd;
+	int journal_fd;
+	uint64_t seq;
+
+	// Owned by the writer thread, which does all file I/O: the segment
+	// being written, bytes written to it and of those known durable
+	unsigned segment;
+	uint64_t length;
+	uint64_t synced;
+	uint64_t last_sync_ns;
+
+	// Shared with the capture thread under lock. Bytes queued for the
+	// current segment and when it was started decide rotation as writes
+	// are queued, so a write is never split across segments.
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t space;
+	int stop;
+	int kick;
+	int error;
+	uint64_t queued;
+	uint64_t queued_start_ns;
+	int active;
+	recorder_buf_t buf[2];
+} recorder_t;
+
+/**
+ * FNV-1a over the record up to the check field.
+ */
+static uint32_t journal_check (const journal_record_t *r) {
+	const uint8_t *p = (const uint8_t *)r;
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < offsetof(journal_record_t, check); i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+static int journal_write (recorder_t *rec, unsigned segment, uint64_t length) {
+	journal_record_t r;
+	memset(&r, 0, sizeof(r));
+	r.magic = JOURNAL_MAGIC;
+	r.segment = segment;
+	r.seq = ++rec->seq;
+	r.length = length;
+	r.check = journal_check(&r);
+	ADS1X9X_METRIC_ADD(syscalls, 2);
+	if (pwrite(rec->journal_fd, &r, sizeof(r), (r.seq & 1) * sizeof(r)) != sizeof(r)
+			|| fdatasync(rec->journal_fd) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @return 0 and the latest valid record, or -1 if the journal has none.
+ */
+static int journal_read (recorder_t *rec, journal_record_t *latest) {
+	journal_record_t r[2];
+	int i, found = -1;
+	memset(r, 0, sizeof(r));
+	if (pread(rec->journal_fd, r, sizeof(r), 0) < (ssize_t)sizeof(r[0])) {
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		if (r[i].magic == JOURNAL_MAGIC && r[i].check == journal_check(&r[i])
+				&& (found < 0 || r[i].seq > r[found].seq)) {
+			found = i;
+		}
+	}
+	if (found < 0) {
+		return -1;
+	}
+	*latest = r[found];
+	return 0;
+}
+
+static void segment_path (const recorder_t *rec, unsigned segment, char *path, size_t size) {
+	snprintf(path, size, ADS1X9X_RECORDER_SEGMENT_FMT, rec->dir, segment);
+}
+
+/**
+ * Write length bytes to the current segment.
+ */
+static int segment_write (ads1x9x_sink_t *s, const uint8_t *data, int length) {
+	recorder_t *rec = s->priv;
+	int n = 0;
+	while (n < length) {
+		int r = write(s->fd, data + n, length - n);
+		ADS1X9X_METRIC_INC(syscalls);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		n += r;
+	}
+	rec->length += length;
+	ADS1X9X_METRIC_ADD(output_bytes, length);
+	ADS1X9X_PROBE1(output_flushed, length);
+	return 0;
+}
+
+/**
+ * Make everything written so far durable and record it in the journal.
+ * Synced pages are dropped from the page cache so memory use and write
+ * cost stay flat over long recordings.
+ */
+static int recorder_sync (ads1x9x_sink_t *s, uint64_t now_ns) {
+	recorder_t *rec = s->priv;
+	rec->last_sync_ns = now_ns;
+	if (rec->length == rec->synced) {
+		return 0;
+	}
+	ADS1X9X_METRIC_INC(syscalls);
+	if (fdatasync(s->fd) < 0 || journal_write(rec, rec->segment, rec->length) < 0) {
+		return -1;
+	}
+	posix_fadvise(s->fd, 0, rec->length, POSIX_FADV_DONTNEED);
+	rec->synced = rec->length;
+	return 0;
+}
+
+/**
+ * Create the next segment, reserving segment_bytes of disk for it.
+ */
+static int segment_open (ads1x9x_sink_t *s) {
+	recorder_t *rec = s->priv;
+	char path[600];
+
+	segment_path(rec, rec->segment, path, sizeof(path));
+	s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (s->fd < 0) {
+		fprintf (stderr,"Error: unable to create segment %s\n", path);
+		return -1;
+	}
+	// Reserve without changing the file size, so the size is always
+	// the data written. Not every file system supports this.
+	fallocate(s->fd, FALLOC_FL_KEEP_SIZE, 0, rec->segment_bytes);
+
+	// The new directory entry and the journal pointing at it must both
+	// be durable before data written to the segment counts as synced
+	if (fsync(rec->dir_fd) < 0 || journal_write(rec, rec->segment, 0) < 0) {
+		fprintf (stderr,"Error: unable to record segment %s in the journal\n", path);
+		close(s->fd);
+		s->fd = -1;
+		return -1;
+	}
+
+	rec->length = rec->synced = 0;
+	return 0;
+}
+
+static int segment_close (ads1x9x_sink_t *s) {
+	recorder_t *rec = s->priv;
+	int ret = recorder_sync(s, ads1x9x_now_ns());
+	// Release the unused part of the reservation
+	if (ftruncate(s->fd, rec->length) < 0) {
+		ret = -1;
+	}
+	close(s->fd);
+	s->fd = -1;
+	return ret;
+}
+
+/**
+ * Write out a buffer taken from the capture thread, rotating segments
+ * where it says.
+ */
+static int recorder_write_buf (ads1x9x_sink_t *s, recorder_buf_t *b) {
+	recorder_t *rec = s->priv;
+	int i, pos = 0;
+
+	for (i = 0; i <= b->ncuts; i++) {
+		int end = i < b->ncuts ? b->cut[i] : b->fill;
+		if (end > pos && segment_write(s, b->data + pos, end - pos) < 0) {
+			return -1;
+		}
+		pos = end;
+		if (i < b->ncuts) {
+			int r = segment_close(s);
+			rec->segment++;
+			if (r < 0 || segment_open(s) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writer thread: takes the filled buffer whenever it is kicked or the
+ * sync interval is up, writes it out and makes a sync point once
+ * sync_ns has passed, so data never waits on the next write to become
+ * durable. The lock is held only to swap buffers.
+ */
+static void *writer_thread (void *arg) {
+	ads1x9x_sink_t *s = arg;
+	recorder_t *rec = s->priv;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&rec->lock);
+	for (;;) {
+		uint64_t due = rec->last_sync_ns + rec->sync_ns;
+		deadline.tv_sec = due / 1000000000ULL;
+		deadline.tv_nsec = due % 1000000000ULL;
+		while (!rec->stop && !rec->kick) {
+			// With no sync interval every batch is synced as written
+			if (rec->sync_ns == 0) {
+				pthread_cond_wait(&rec->cond, &rec->lock);
+			} else if (pthread_cond_timedwait(&rec->cond, &rec->lock, &deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+		int stop = rec->stop;
+		rec->kick = FALSE;
+		recorder_buf_t *b = &rec->buf[rec->active];
+		rec->active ^= 1;
+		pthread_mutex_unlock(&rec->lock);
+
+		int r = rec->error ? 0 : recorder_write_buf(s, b);
+		uint64_t now = ads1x9x_now_ns();
+		if (r == 0 && !rec->error && (stop || now - rec->last_sync_ns >= rec->sync_ns)) {
+			r = recorder_sync(s, now);
+		}
+
+		pthread_mutex_lock(&rec->lock);
+		b->fill = b->ncuts = 0;
+		rec->error |= r < 0;
+		pthread_cond_broadcast(&rec->space);
+		if (stop) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&rec->lock);
+	return NULL;
+}
+
+/**
+ * Queue a write for the writer thread. This only copies: it waits only
+ * if the disk has fallen a whole buffer behind, and then nothing is lost.
+ */
+static int recorder_write (ads1x9x_sink_t *s, const void *buf, int length) {
+	recorder_t *rec = s->priv;
+	const uint8_t *p = buf;
+	uint64_t now = ads1x9x_now_ns();
+
+	pthread_mutex_lock(&rec->lock);
+	// Rotate between writes so one write call is never split
+	if (rec->queued > 0 && (rec->queued + length > rec->segment_bytes
+			|| (rec->segment_ns > 0 && now - rec->queued_start_ns >= rec->segment_ns))) {
+		while (!rec->error && rec->buf[rec->active].ncuts == RECORDER_MAX_CUTS) {
+			rec->kick = TRUE;
+			pthread_cond_signal(&rec->cond);
+			pthread_cond_wait(&rec->space, &rec->lock);
+		}
+		recorder_buf_t *b = &rec->buf[rec->active];
+		b->cut[b->ncuts++] = b->fill;
+		rec->queued = 0;
+		rec->queued_start_ns = now;
+	}
+	rec->queued += length;
+
+	while (length > 0 && !rec->error) {
+		recorder_buf_t *b = &rec->buf[rec->active];
+		int n = RECORDER_BUF_SIZE - b->fill;
+		if (n == 0) {
+			rec->kick = TRUE;
+			pthread_cond_signal(&rec->cond);
+			pthread_cond_wait(&rec->space, &rec->lock);
+			continue;
+		}
+		if (n > length) {
+			n = length;
+		}
+		memcpy(b->data + b->fill, p, n);
+		b->fill += n;
+		p += n;
+		length -= n;
+		if (b->fill >= RECORDER_BUF_SIZE / 2 && !rec->kick) {
+			rec->kick = TRUE;
+			pthread_cond_signal(&rec->cond);
+		}
+	}
+	int error = rec->error;
+	pthread_mutex_unlock(&rec->lock);
+	return error ? -1 : 0;
+}
+
+/**
+ * Hand what is queued to the writer thread without waiting for it. Sync
+ * points are made every sync_ns and on close.
+ */
+static int recorder_flush (ads1x9x_sink_t *s) {
+	recorder_t *rec = s->priv;
+	pthread_mutex_lock(&rec->lock);
+	rec->kick = TRUE;
+	pthread_cond_signal(&rec->cond);
+	int error = rec->error;
+	pthread_mutex_unlock(&rec->lock);
+	return error ? -1 : 0;
+}
+
+static void recorder_close (ads1x9x_sink_t *s) {
+	recorder_t *rec = s->priv;
+	// The writer is idle whenever it sees stop, with only the active
+	// buffer holding data, which it writes out and syncs before it ends
+	pthread_mutex_lock(&rec->lock);
+	rec->stop = TRUE;
+	pthread_cond_signal(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+	pthread_join(rec->writer, NULL);
+	if (s->fd >= 0) {
+		segment_close(s);
+	}
+	close(rec->journal_fd);
+	close(rec->dir_fd);
+	free(rec);
+	free(s);
+}
+
+/**
+ * Recover from an interrupted recording: cut the journalled segment back
+ * to its last sync point, releasing the disk preallocated past it, remove
+ * segments created after it and continue with the next segment number.
+ */
+static void recorder_recover (recorder_t *rec) {
+	journal_record_t r;
+	char path[600];
+	struct stat st;
+
+	if (journal_read(rec, &r) < 0) {
+		// New recording: start after any segments already present
+		for (rec->segment = 0; ; rec->segment++) {
+			segment_path(rec, rec->segment, path, sizeof(path));
+			if (stat(path, &st) < 0) {
+				break;
+			}
+		}
+		return;
+	}
+
+	rec->seq = r.seq;
+	segment_path(rec, r.segment, path, sizeof(path));
+	if (stat(path, &st) == 0 && (uint64_t)st.st_size >= r.length) {
+		if ((uint64_t)st.st_size > r.length) {
+			fprintf (stderr,"recorder: recovered %s to %llu bytes (%llu unsynced bytes dropped)\n", path,
+				(unsigned long long)r.length, (unsigned long long)(st.st_size - r.length));
+		}
+		// Truncating, even to the current size, frees blocks reserved
+		// with FALLOC_FL_KEEP_SIZE beyond it
+		if (truncate(path, r.length) < 0) {
+			fprintf (stderr,"Error: unable to truncate %s\n", path);
+		}
+	}
+	for (rec->segment = r.segment + 1; ; rec->segment++) {
+		segment_path(rec, rec->segment, path, sizeof(path));
+		if (unlink(path) < 0) {
+			break;
+		}
+	}
+	rec->segment = r.segment + 1;
+}
+
+/**
+ * Open a recording directory, creating it if needed and recovering any
+ * interrupted recording in it.
+ *
+ * @param segment_bytes Rotate when a segment would exceed this size
+ * @param segment_seconds Rotate after this long, 0 for no limit
+ * @param sync_ms Interval between sync points; data written since the
+ * last sync point is lost on power failure
+ * @return Sink or NULL if the directory or journal could not be opened.
+ */
+ads1x9x_sink_t *ads1x9x_recorder_open (const char *dir, uint64_t segment_bytes,
+	int segment_seconds, int sync_ms) {
+
+	char path[600];
+	recorder_t *rec = calloc(1, sizeof(recorder_t));
+	ads1x9x_sink_t *s = calloc(1, sizeof(ads1x9x_sink_t));
+
+	snprintf(rec->dir, sizeof(rec->dir), "%s", dir);
+	rec->segment_bytes = segment_bytes;
+	rec->segment_ns = (uint64_t)segment_seconds * 1000000000ULL;
+	rec->sync_ns = (uint64_t)sync_ms * 1000000ULL;
+
+	mkdir(dir, 0755);
+	rec->dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+	snprintf(path, sizeof(path), ADS1X9X_RECORDER_JOURNAL_FMT, dir);
+	rec->journal_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (rec->dir_fd < 0 || rec->journal_fd < 0) {
+		fprintf (stderr,"Error: unable to open recording directory %s\n", dir);
+		if (rec->dir_fd >= 0) {
+			close(rec->dir_fd);
+		}
+		if (rec->journal_fd >= 0) {
+			close(rec->journal_fd);
+		}
+		free(rec);
+		free(s);
+		return NULL;
+	}
+
+	recorder_recover(rec);
+
+	s->name = "recorder";
+	s->priv = rec;
+	s->write = recorder_write;
+	s->flush = recorder_flush;
+	s->close = recorder_close;
+
+	rec->last_sync_ns = rec->queued_start_ns = ads1x9x_now_ns();
+	if (segment_open(s) < 0) {
+		close(rec->journal_fd);
+		close(rec->dir_fd);
+		free(rec);
+		free(s);
+		return NULL;
+	}
+
+	pthread_condattr_t attr;
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rec->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&rec->space, NULL);
+	if (pthread_create(&rec->writer, NULL, writer_thread, s) != 0) {
+		fprintf (stderr,"Error: unable to start recorder thread\n");
+		segment_close(s);
+		close(rec->journal_fd);
+		close(rec->dir_fd);
+		free(rec);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
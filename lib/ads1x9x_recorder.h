@@ -0,0 +1,29 @@
+/**
+ * ads1x9x_recorder.h - crash safe recording sink for long captures.
+ * Output goes to numbered segment files in a directory, preallocated
+ * and rotated by size or duration. Data is fdatasync'd in batches, at
+ * most sync_ms apart whether or not more data arrives, and each sync
+ * point recorded in a small journal, so after a power cut or
+ * crash reopening the directory recovers everything up to the last sync
+ * and recording continues in a new segment. Writes only queue the data:
+ * a writer thread does all file I/O, so a slow fdatasync (hundreds of ms
+ * on an SD card) never holds up the capture.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_RECORDER_H
+#define ADS1X9X_RECORDER_H
+
+#include <stdint.h>
+
+#include "ads1x9x_sink.h"
+
+// Segment files are <dir>/seg-NNNNNN.bin, the journal <dir>/journal
+#define ADS1X9X_RECORDER_SEGMENT_FMT "%s/seg-%06u.bin"
+#define ADS1X9X_RECORDER_JOURNAL_FMT "%s/journal"
+
+ads1x9x_sink_t *ads1x9x_recorder_open (const char *dir, uint64_t segment_bytes,
+	int segment_seconds, int sync_ms);
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * ads1x9x_resp.c - breath by breath respiration rate.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_resp.h"
+
+// Pass band corners, Hz
+#define HP_HZ 0.05
+#define LP_HZ 1.0
+// Time for the high pass to settle before breaths are detected, s
+#define SETTLE_S 10
+// Time constant of the amplitude level, s
+#define LEVEL_S 15
+// Hysteresis as a fraction of the amplitude level
+#define HYSTERESIS 0.3
+// Shortest breath accepted (60 breaths/min), s
+#define MIN_INTERVAL_S 1.0
+
+/**
+ * @param sps Input sample rate
+ */
+void ads1x9x_resp_init (ads1x9x_resp_t *r, int sps) {
+	memset(r, 0, sizeof(*r));
+	r->decimate = (sps + ADS1X9X_RESP_SPS / 2) / ADS1X9X_RESP_SPS;
+	if (r->decimate < 1) {
+		r->decimate = 1;
+	}
+	r->period = (double)r->decimate / sps;
+	r->hp_a = exp(-2 * M_PI * HP_HZ * r->period);
+	r->lp_a = exp(-2 * M_PI * LP_HZ * r->period);
+	r->settle = SETTLE_S / r->period;
+	r->last_t = -1;
+}
+
+/**
+ * Process one ch1 sample.
+ *
+ * @param b Receives the breath when one is detected
+ * @return 1 if a breath was detected, else 0.
+ */
+int ads1x9x_resp_process (ads1x9x_resp_t *r, int32_t x, ads1x9x_breath_t *b) {
+	int i;
+
+	r->acc += x;
+	if (++r->acc_n < r->decimate) {
+		return 0;
+	}
+	double v = (double)r->acc / r->decimate;
+	uint64_t k = r->n++;
+	r->acc = 0;
+	r->acc_n = 0;
+
+	if (k == 0) {
+		r->hp_x1 = v;
+	}
+	r->hp_y = r->hp_a * (r->hp_y + v - r->hp_x1);
+	r->hp_x1 = v;
+	r->lp1 += (1 - r->lp_a) * (r->hp_y - r->lp1);
+	r->lp2 += (1 - r->lp_a) * (r->lp1 - r->lp2);
+	double y = r->lp2;
+	double y1 = r->y1;
+	r->y1 = y;
+
+	r->level += (fabs(y) - r->level) * r->period / LEVEL_S;
+	if (r->settle > 0) {
+		r->settle--;
+		r->vmin = r->vmax = y;
+		return 0;
+	}
+	if (y < r->vmin) {
+		r->vmin = y;
+	}
+	if (y > r->vmax) {
+		r->vmax = y;
+	}
+
+	if (y < -HYSTERESIS * r->level) {
+		r->armed = TRUE;
+	}
+	if (!r->armed || y1 >= 0 || y < 0) {
+		return 0;
+	}
+
+	// Upward zero crossing, interpolated between this decimated sample
+	// and the last. t is the centre of the averaged block.
+	double t = (k + 0.5) * r->period;
+	double tc = t - r->period * y / (y - y1);
+	if (r->last_t >= 0 && tc - r->last_t < MIN_INTERVAL_S) {
+		return 0;
+	}
+	r->armed = FALSE;
+	if (r->last_t < 0) {
+		r->last_t = tc;
+		r->vmin = r->vmax = y;
+		return 0;
+	}
+
+	b->t = tc;
+	b->interval_s = tc - r->last_t;
+	b->rate_bpm = 60 / b->interval_s;
+	b->amplitude = r->vmax - r->vmin;
+
+	r->intervals[r->nintervals++ % ADS1X9X_RESP_MEAN_BREATHS] = b->interval_s;
+	int n = r->nintervals < ADS1X9X_RESP_MEAN_BREATHS ? r->nintervals : ADS1X9X_RESP_MEAN_BREATHS;
+	double sum = 0;
+	for (i = 0; i < n; i++) {
+		sum += r->intervals[i];
+	}
+	b->mean_rate_bpm = 60 * n / sum;
+
+	r->last_t = tc;
+	r->vmin = r->vmax = y;
+	return 1;
+}
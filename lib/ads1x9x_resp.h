@@ -0,0 +1,63 @@
+/**
+ * ads1x9x_resp.h - breath by breath respiration rate from the ADS1292R
+ * impedance pneumography channel (ch1).
+ *
+ * The signal is decimated by block averaging to about 25 SPS, band
+ * limited to roughly 0.05-1Hz with one pole filters and breaths taken at
+ * upward zero crossings, with hysteresis scaled to the running breath
+ * amplitude. Cost is a few operations per input sample and state is
+ * fixed size, so one runs per device alongside the ECG stages.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_RESP_H
+#define ADS1X9X_RESP_H
+
+#include <stdint.h>
+
+// Rate after decimation, SPS
+#define ADS1X9X_RESP_SPS 25
+// Breaths averaged for the mean rate
+#define ADS1X9X_RESP_MEAN_BREATHS 8
+
+typedef struct {
+	// Time of the breath (upward zero crossing), s from the first sample
+	double t;
+	// Time since the previous breath, s, and the rate it implies
+	double interval_s;
+	double rate_bpm;
+	// Rate over the last ADS1X9X_RESP_MEAN_BREATHS breaths
+	double mean_rate_bpm;
+	// Peak to peak filtered amplitude of the breath, ADC units
+	double amplitude;
+} ads1x9x_breath_t;
+
+typedef struct {
+	int decimate;
+	double period;
+
+	// Decimator
+	int64_t acc;
+	int acc_n;
+	uint64_t n;
+
+	// High pass and two low pass sections
+	double hp_a, lp_a;
+	double hp_x1, hp_y, lp1, lp2;
+	double y1;
+	int settle;
+
+	// Crossing detector
+	double level;
+	int armed;
+	double vmin, vmax;
+	double last_t;
+	double intervals[ADS1X9X_RESP_MEAN_BREATHS];
+	int nintervals;
+} ads1x9x_resp_t;
+
+void ads1x9x_resp_init (ads1x9x_resp_t *r, int sps);
+int ads1x9x_resp_process (ads1x9x_resp_t *r, int32_t x, ads1x9x_breath_t *b);
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * ads1x9x_serial.c - serial link tuning that needs the kernel termios2
+ * interface. Kept apart from ads1x9x_transport.c because <asm/termbits.h>
+ * cannot be included together with the C library <termios.h>.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+
+#include "ads1x9x_transport.h"
+
+/**
+ * Set an arbitrary tx/rx speed with termios2 and BOTHER. Used for rates
+ * that have no Bnnn constant, eg 230400 on older C libraries or the
+ * 921600/1000000 and custom rates that USB-serial parts support.
+ *
+ * @return 0 if successful, -1 on error.
+ */
+int ads1x9x_serial_set_speed (int fd, int bps) {
+	struct termios2 tios;
+	if (ioctl(fd, TCGETS2, &tios) < 0) {
+		return -1;
+	}
+	tios.c_cflag &= ~CBAUD;
+	tios.c_cflag |= BOTHER;
+	tios.c_ispeed = bps;
+	tios.c_ospeed = bps;
+	tios.c_cflag &= ~(CBAUD << IBSHIFT);
+	tios.c_cflag |= BOTHER << IBSHIFT;
+	return ioctl(fd, TCSETS2, &tios) < 0 ? -1 : 0;
+}
+
+/**
+ * Return the output speed the driver actually set, which may differ from
+ * the one requested, or -1 on error.
+ */
+int ads1x9x_serial_get_speed (int fd) {
+	struct termios2 tios;
+	if (ioctl(fd, TCGETS2, &tios) < 0) {
+		return -1;
+	}
+	return tios.c_ospeed;
+}
+
+/**
+ * Set VMIN/VTIME so that a blocking read returns when vmin bytes (eg one
+ * frame) have arrived, or vtime tenths of a second after the last byte if
+ * fewer arrive.
+ *
+ * @return 0 if successful, -1 on error.
+ */
+int ads1x9x_serial_set_read_size (int fd, int vmin, int vtime) {
+	struct termios2 tios;
+	if (ioctl(fd, TCGETS2, &tios) < 0) {
+		return -1;
+	}
+	tios.c_cc[VMIN] = vmin > 255 ? 255 : vmin;
+	tios.c_cc[VTIME] = vtime;
+	return ioctl(fd, TCSETS2, &tios) < 0 ? -1 : 0;
+}
+
+/**
+ * Ask the driver to push received bytes to the tty layer immediately
+ * (ASYNC_LOW_LATENCY) instead of batching them. Not all drivers support
+ * this; cdc-acm for example ignores it.
+ *
+ * @return 0 if successful, -1 if not supported.
+ */
+int ads1x9x_serial_set_low_latency (int fd) {
+	struct serial_struct ss;
+	if (ioctl(fd, TIOCGSERIAL, &ss) < 0) {
+		return -1;
+	}
+	ss.flags |= ASYNC_LOW_LATENCY;
+	return ioctl(fd, TIOCSSERIAL, &ss) < 0 ? -1 : 0;
+}
@@ -0,0 +1,288 @@
+/**
+ * ads1x9x_sink.c - buffered write(2) output sink and a queue sink that
+ * moves output to a thread of its own.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_sink.h"
+#include "ads1x9x_metrics.h"
+#include "ads1x9x_probes.h"
+
+#define FD_SINK_BUF_SIZE 65536
+
+typedef struct {
+	int owned;
+	int fill;
+	char buf[FD_SINK_BUF_SIZE];
+} fd_sink_t;
+
+/**
+ * Write all length bytes to fd, retrying on short writes.
+ *
+ * @return 0 if successful, -1 on error.
+ */
+static int write_all (int fd, const char *buf, int length) {
+	int n = 0, r;
+	while (n < length) {
+		r = write(fd, buf + n, length - n);
+		ADS1X9X_METRIC_INC(syscalls);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		n += r;
+	}
+	ADS1X9X_METRIC_ADD(output_bytes, length);
+	ADS1X9X_PROBE1(output_flushed, length);
+	return 0;
+}
+
+static int fd_sink_flush (ads1x9x_sink_t *s) {
+	fd_sink_t *fs = s->priv;
+	int r = write_all(s->fd, fs->buf, fs->fill);
+	fs->fill = 0;
+	return r;
+}
+
+static int fd_sink_write (ads1x9x_sink_t *s, const void *buf, int length) {
+	fd_sink_t *fs = s->priv;
+	if (fs->fill + length > FD_SINK_BUF_SIZE) {
+		if (fd_sink_flush(s) < 0) {
+			return -1;
+		}
+		if (length > FD_SINK_BUF_SIZE) {
+			return write_all(s->fd, buf, length);
+		}
+	}
+	memcpy(fs->buf + fs->fill, buf, length);
+	fs->fill += length;
+	return 0;
+}
+
+static void fd_sink_close (ads1x9x_sink_t *s) {
+	fd_sink_t *fs = s->priv;
+	fd_sink_flush(s);
+	if (fs->owned) {
+		close(s->fd);
+	}
+	free(fs);
+	free(s);
+}
+
+/**
+ * Buffered sink on an already open file descriptor.
+ *
+ * @param owned If TRUE the descriptor is closed when the sink is closed.
+ */
+ads1x9x_sink_t *ads1x9x_sink_open_fd (int fd, int owned) {
+	ads1x9x_sink_t *s = calloc(1, sizeof(ads1x9x_sink_t));
+	fd_sink_t *fs = calloc(1, sizeof(fd_sink_t));
+	fs->owned = owned;
+	s->name = "fd";
+	s->fd = fd;
+	s->priv = fs;
+	s->write = fd_sink_write;
+	s->flush = fd_sink_flush;
+	s->close = fd_sink_close;
+	return s;
+}
+
+/**
+ * Buffered sink on a newly created (or truncated) file.
+ *
+ * @return Sink or NULL if the file could not be opened.
+ */
+ads1x9x_sink_t *ads1x9x_sink_open_file (const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf (stderr,"Error: unable to open output file %s\n",path);
+		return NULL;
+	}
+	return ads1x9x_sink_open_fd(fd, 1);
+}
+
+typedef struct {
+	ads1x9x_sink_t *next;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *buf;
+	uint64_t size;
+	// Bytes queued and bytes taken by the writer thread since the start
+	uint64_t head;
+	uint64_t tail;
+	int flush_requested;
+	int stop;
+	int error;
+	uint64_t dropped;
+} queue_sink_t;
+
+/**
+ * Writer thread: pass queued bytes to next, and flush next whenever the
+ * queue runs empty or a flush is asked for.
+ */
+static void *queue_sink_thread (void *arg) {
+	ads1x9x_sink_t *s = arg;
+	queue_sink_t *q = s->priv;
+
+	pthread_mutex_lock(&q->lock);
+	for (;;) {
+		while (q->head == q->tail && !q->flush_requested && !q->stop) {
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+		if (q->head == q->tail) {
+			int stop = q->stop;
+			q->flush_requested = FALSE;
+			pthread_mutex_unlock(&q->lock);
+			int r = q->next->flush(q->next);
+			pthread_mutex_lock(&q->lock);
+			q->error |= r < 0;
+			if (stop) {
+				break;
+			}
+			continue;
+		}
+		// Up to the end of the ring at most
+		uint64_t off = q->tail % q->size;
+		uint64_t n = q->head - q->tail;
+		if (n > q->size - off) {
+			n = q->size - off;
+		}
+		pthread_mutex_unlock(&q->lock);
+		int r = q->next->write(q->next, q->buf + off, n);
+		pthread_mutex_lock(&q->lock);
+		q->error |= r < 0;
+		q->tail += n;
+		ADS1X9X_METRIC_SET(output_queue_depth, q->head - q->tail);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/**
+ * Queue a whole write or none of it, so a full queue drops whole frames
+ * or lines rather than tearing one.
+ */
+static int queue_sink_write (ads1x9x_sink_t *s, const void *buf, int length) {
+	queue_sink_t *q = s->priv;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->size - (q->head - q->tail) < (uint64_t)length) {
+		q->dropped += length;
+		ADS1X9X_METRIC_ADD(output_dropped_bytes, length);
+		pthread_mutex_unlock(&q->lock);
+		return 0;
+	}
+	uint64_t off = q->head % q->size;
+	uint64_t n = q->size - off < (uint64_t)length ? q->size - off : (uint64_t)length;
+	memcpy(q->buf + off, buf, n);
+	memcpy(q->buf, (const char *)buf + n, length - n);
+	q->head += length;
+	ADS1X9X_METRIC_SET(output_queue_depth, q->head - q->tail);
+	pthread_cond_signal(&q->cond);
+	int error = q->error;
+	pthread_mutex_unlock(&q->lock);
+	return error ? -1 : 0;
+}
+
+/**
+ * Ask the writer thread to flush once the queue is written. Does not
+ * wait for it.
+ */
+static int queue_sink_flush (ads1x9x_sink_t *s) {
+	queue_sink_t *q = s->priv;
+
+	pthread_mutex_lock(&q->lock);
+	q->flush_requested = TRUE;
+	pthread_cond_signal(&q->cond);
+	int error = q->error;
+	pthread_mutex_unlock(&q->lock);
+	return error ? -1 : 0;
+}
+
+static void queue_sink_close (ads1x9x_sink_t *s) {
+	queue_sink_t *q = s->priv;
+
+	pthread_mutex_lock(&q->lock);
+	q->stop = TRUE;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+	if (q->dropped > 0) {
+		fprintf (stderr,"Warning: output fell behind, %llu bytes dropped\n",
+			(unsigned long long)q->dropped);
+	}
+	ads1x9x_sink_close(q->next);
+	free(q->buf);
+	free(q);
+	free(s);
+}
+
+/**
+ * Sink that queues output for a thread that writes it to next, so the
+ * caller never blocks on a slow reader of the output. If more than size
+ * bytes are waiting, writes are dropped and counted in the
+ * output_dropped_bytes metric. Closing it writes what is queued and
+ * closes next.
+ *
+ * @return Sink or NULL if the thread could not be started.
+ */
+ads1x9x_sink_t *ads1x9x_queue_sink_open (ads1x9x_sink_t *next, int size) {
+	ads1x9x_sink_t *s = calloc(1, sizeof(ads1x9x_sink_t));
+	queue_sink_t *q = calloc(1, sizeof(queue_sink_t));
+	q->next = next;
+	q->size = size;
+	q->buf = malloc(size);
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	s->name = "queue";
+	s->fd = next->fd;
+	s->priv = q;
+	s->write = queue_sink_write;
+	s->flush = queue_sink_flush;
+	s->close = queue_sink_close;
+	if (q->buf == NULL || pthread_create(&q->thread, NULL, queue_sink_thread, s) != 0) {
+		free(q->buf);
+		free(q);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+/**
+ * Formatted output to a sink, as fprintf().
+ *
+ * @return 0 if successful, -1 on error.
+ */
+int ads1x9x_sink_printf (ads1x9x_sink_t *s, const char *fmt, ...) {
+	char buf[256];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n >= (int)sizeof(buf)) {
+		n = sizeof(buf) - 1;
+	}
+	return s->write(s, buf, n);
+}
+
+/**
+ * Flush and close sink.
+ */
+void ads1x9x_sink_close (ads1x9x_sink_t *s) {
+	s->close(s);
+}
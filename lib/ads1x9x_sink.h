@@ -0,0 +1,33 @@
+/**
+ * ads1x9x_sink.h - output sinks for capture data. Tools write formatted
+ * or raw output to a sink rather than directly to stdout so that the
+ * output path (buffered write(2), io_uring, ...) is chosen in one place.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_SINK_H
+#define ADS1X9X_SINK_H
+
+typedef struct ads1x9x_sink ads1x9x_sink_t;
+
+struct ads1x9x_sink {
+	const char *name;
+	int fd;
+	void *priv;
+
+	// Queue length bytes for output. Return 0 or -1 on error.
+	int (*write) (ads1x9x_sink_t *s, const void *buf, int length);
+	// Push all queued bytes to the operating system. Return 0 or -1 on error.
+	int (*flush) (ads1x9x_sink_t *s);
+	void (*close) (ads1x9x_sink_t *s);
+};
+
+ads1x9x_sink_t *ads1x9x_sink_open_fd (int fd, int owned);
+ads1x9x_sink_t *ads1x9x_sink_open_file (const char *path);
+ads1x9x_sink_t *ads1x9x_queue_sink_open (ads1x9x_sink_t *next, int size);
+int ads1x9x_sink_printf (ads1x9x_sink_t *s, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+void ads1x9x_sink_close (ads1x9x_sink_t *s);
+
+#endif
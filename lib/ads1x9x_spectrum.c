@@ -0,0 +1,207 @@
+/**
+ * ads1x9x_spectrum.c - short time FFT band power summaries of a stream.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ads1x9x_spectrum.h"
+
+// Band edges, Hz. The HF band runs to Nyquist.
+static const double band_hz[ADS1X9X_NBANDS][2] = {
+	{0, 2}, {2, 40}, {48, 52}, {58, 62}, {100, 1e9},
+	{46, 48}, {52, 54}, {56, 58}, {62, 64}
+};
+
+/**
+ * Plan a radix-2 FFT and Hann window of length n.
+ *
+ * @return Plan or NULL if n is not a power of 2 or out of memory.
+ */
+ads1x9x_fft_plan_t *ads1x9x_fft_plan_new (int n) {
+	ads1x9x_fft_plan_t *plan;
+	int i, h, bits = 0;
+
+	if (n < 2 || (n & (n - 1)) != 0) {
+		return NULL;
+	}
+	while ((1 << bits) < n) {
+		bits++;
+	}
+	plan = calloc(1, sizeof(ads1x9x_fft_plan_t));
+	if (plan == NULL) {
+		return NULL;
+	}
+	plan->n = n;
+	plan->bitrev = malloc(n * sizeof(uint16_t));
+	plan->tw_re = malloc(n * sizeof(float));
+	plan->tw_im = malloc(n * sizeof(float));
+	plan->window = malloc(n * sizeof(float));
+	if (plan->bitrev == NULL || plan->tw_re == NULL || plan->tw_im == NULL || plan->window == NULL) {
+		ads1x9x_fft_plan_free(plan);
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++) {
+		int j, r = 0;
+		for (j = 0; j < bits; j++) {
+			r |= ((i >> j) & 1) << (bits - 1 - j);
+		}
+		plan->bitrev[i] = r;
+		plan->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+		plan->window_power += plan->window[i] * plan->window[i];
+	}
+	for (h = 1; h < n; h <<= 1) {
+		for (i = 0; i < h; i++) {
+			plan->tw_re[h - 1 + i] = cos(M_PI * i / h);
+			plan->tw_im[h - 1 + i] = -sin(M_PI * i / h);
+		}
+	}
+	return plan;
+}
+
+void ads1x9x_fft_plan_free (ads1x9x_fft_plan_t *plan) {
+	free(plan->bitrev);
+	free(plan->tw_re);
+	free(plan->tw_im);
+	free(plan->window);
+	free(plan);
+}
+
+#if defined(__GNUC__)
+typedef float v4sf __attribute__((vector_size(16)));
+
+static inline v4sf load4 (const float *p) {
+	v4sf v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void store4 (float *p, v4sf v) {
+	memcpy(p, &v, sizeof(v));
+}
+#endif
+
+/**
+ * In place forward FFT of the complex sequence re + i im.
+ */
+void ads1x9x_fft (const ads1x9x_fft_plan_t *plan, float *re, float *im) {
+	int n = plan->n;
+	int i, j, h, b;
+
+	for (i = 0; i < n; i++) {
+		j = plan->bitrev[i];
+		if (i < j) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (h = 1; h < n; h <<= 1) {
+		const float *wr = plan->tw_re + h - 1;
+		const float *wi = plan->tw_im + h - 1;
+		for (b = 0; b < n; b += 2 * h) {
+			float *ar = re + b, *ai = im + b;
+			float *br = re + b + h, *bi = im + b + h;
+			j = 0;
+#if defined(__GNUC__)
+			// Four butterflies at a time once the stage is wide enough
+			for (; j + 4 <= h; j += 4) {
+				v4sf vwr = load4(wr + j), vwi = load4(wi + j);
+				v4sf vbr = load4(br + j), vbi = load4(bi + j);
+				v4sf var = load4(ar + j), vai = load4(ai + j);
+				v4sf tr = vbr * vwr - vbi * vwi;
+				v4sf ti = vbr * vwi + vbi * vwr;
+				store4(br + j, var - tr);
+				store4(bi + j, vai - ti);
+				store4(ar + j, var + tr);
+				store4(ai + j, vai + ti);
+			}
+#endif
+			for (; j < h; j++) {
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+		}
+	}
+}
+
+/**
+ * @param plan Plan of length ADS1X9X_SPECTRUM_N
+ */
+void ads1x9x_spectrum_init (ads1x9x_spectrum_t *s, const ads1x9x_fft_plan_t *plan, int sps) {
+	int b, n = ADS1X9X_SPECTRUM_N;
+	memset(s, 0, sizeof(*s));
+	s->plan = plan;
+	s->sps = sps;
+	for (b = 0; b < ADS1X9X_NBANDS; b++) {
+		s->band_lo[b] = (int)ceil(band_hz[b][0] * n / sps);
+		s->band_hi[b] = (int)ceil(band_hz[b][1] * n / sps);
+		if (s->band_hi[b] > n / 2 + 1) {
+			s->band_hi[b] = n / 2 + 1;
+		}
+	}
+}
+
+/**
+ * Transform the current window and sum band powers. The two real
+ * channels are separated from the one complex transform Z using
+ * X1[k] = (Z[k] + Z*[N-k]) / 2 and X2[k] = (Z[k] - Z*[N-k]) / 2i.
+ */
+static void spectrum_window (ads1x9x_spectrum_t *s) {
+	const ads1x9x_fft_plan_t *plan = s->plan;
+	int n = ADS1X9X_SPECTRUM_N;
+	int i, k, b;
+
+	for (i = 0; i < n; i++) {
+		s->re[i] = s->in[0][i] * plan->window[i];
+		s->im[i] = s->in[1][i] * plan->window[i];
+	}
+	ads1x9x_fft(plan, s->re, s->im);
+
+	// One sided mean square power, corrected for the window
+	double scale = 1.0 / (n * plan->window_power);
+	memset(s->band, 0, sizeof(s->band));
+	for (b = 0; b < ADS1X9X_NBANDS; b++) {
+		for (k = s->band_lo[b]; k < s->band_hi[b]; k++) {
+			int m = (n - k) % n;
+			double sr = s->re[k] + s->re[m], dr = s->re[k] - s->re[m];
+			double si = s->im[k] + s->im[m], di = s->im[k] - s->im[m];
+			double w = (k == 0 || k == n / 2) ? 0.25 : 0.5;
+			s->band[0][b] += (sr * sr + di * di) * w * scale;
+			s->band[1][b] += (si * si + dr * dr) * w * scale;
+		}
+	}
+	s->windows++;
+}
+
+/**
+ * Add rows of ADS1X9X_SPECTRUM_NCHANNELS samples.
+ *
+ * @return Number of windows completed; band[] holds the latest.
+ */
+int ads1x9x_spectrum_push (ads1x9x_spectrum_t *s, const int32_t *samples, int nrows) {
+	int i, c, done = 0;
+	for (i = 0; i < nrows; i++) {
+		for (c = 0; c < ADS1X9X_SPECTRUM_NCHANNELS; c++) {
+			s->in[c][s->fill] = samples[i * ADS1X9X_SPECTRUM_NCHANNELS + c];
+		}
+		if (++s->fill == ADS1X9X_SPECTRUM_N) {
+			spectrum_window(s);
+			for (c = 0; c < ADS1X9X_SPECTRUM_NCHANNELS; c++) {
+				memmove(s->in[c], s->in[c] + ADS1X9X_SPECTRUM_HOP,
+					(ADS1X9X_SPECTRUM_N - ADS1X9X_SPECTRUM_HOP) * sizeof(float));
+			}
+			s->fill = ADS1X9X_SPECTRUM_N - ADS1X9X_SPECTRUM_HOP;
+			done++;
+		}
+	}
+	return done;
+}
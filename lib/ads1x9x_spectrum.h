@@ -0,0 +1,72 @@
+/**
+ * ads1x9x_spectrum.h - short time FFT band power summaries of a stream.
+ *
+ * Both channels of a device are transformed together as the real and
+ * imaginary parts of one complex FFT over a Hann window, advanced by half
+ * a window. The FFT is radix-2 on split real/imaginary arrays with the
+ * twiddles of each stage planned once and stored contiguously, so the
+ * butterfly loops run on SIMD vectors. A plan is read only and shared by
+ * any number of spectrum stages.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_SPECTRUM_H
+#define ADS1X9X_SPECTRUM_H
+
+#include <stdint.h>
+
+// Window length and hop, samples. At 500 SPS about 1Hz resolution and a
+// summary every 0.5s.
+#define ADS1X9X_SPECTRUM_N 512
+#define ADS1X9X_SPECTRUM_HOP (ADS1X9X_SPECTRUM_N / 2)
+#define ADS1X9X_SPECTRUM_NCHANNELS 2
+
+// Summary bands
+#define ADS1X9X_BAND_BASELINE 0		// 0-2Hz: baseline wander, respiration
+#define ADS1X9X_BAND_SIGNAL 1		// 2-40Hz: ECG
+#define ADS1X9X_BAND_MAINS50 2		// 48-52Hz
+#define ADS1X9X_BAND_MAINS60 3		// 58-62Hz
+#define ADS1X9X_BAND_HF 4		// 100Hz-Nyquist: EMG, noise
+// Either side of each mains band, the floor a mains line must stand above
+#define ADS1X9X_BAND_MAINS50_BELOW 5	// 46-48Hz
+#define ADS1X9X_BAND_MAINS50_ABOVE 6	// 52-54Hz
+#define ADS1X9X_BAND_MAINS60_BELOW 7	// 56-58Hz
+#define ADS1X9X_BAND_MAINS60_ABOVE 8	// 62-64Hz
+#define ADS1X9X_NBANDS 9
+
+typedef struct {
+	int n;
+	uint16_t *bitrev;
+	// Twiddles of the stage with half size h start at index h-1
+	float *tw_re;
+	float *tw_im;
+	float *window;
+	double window_power;
+} ads1x9x_fft_plan_t;
+
+typedef struct {
+	const ads1x9x_fft_plan_t *plan;
+	int sps;
+	// Bins band_lo[b] to band_hi[b]-1 make up band b
+	int band_lo[ADS1X9X_NBANDS];
+	int band_hi[ADS1X9X_NBANDS];
+
+	float in[ADS1X9X_SPECTRUM_NCHANNELS][ADS1X9X_SPECTRUM_N];
+	int fill;
+	uint64_t windows;
+	float re[ADS1X9X_SPECTRUM_N];
+	float im[ADS1X9X_SPECTRUM_N];
+
+	// Mean square power per band of the latest window, ADC units^2
+	double band[ADS1X9X_SPECTRUM_NCHANNELS][ADS1X9X_NBANDS];
+} ads1x9x_spectrum_t;
+
+ads1x9x_fft_plan_t *ads1x9x_fft_plan_new (int n);
+void ads1x9x_fft_plan_free (ads1x9x_fft_plan_t *plan);
+void ads1x9x_fft (const ads1x9x_fft_plan_t *plan, float *re, float *im);
+
+void ads1x9x_spectrum_init (ads1x9x_spectrum_t *s, const ads1x9x_fft_plan_t *plan, int sps);
+int ads1x9x_spectrum_push (ads1x9x_spectrum_t *s, const int32_t *samples, int nrows);
+
+#endif
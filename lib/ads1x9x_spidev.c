@@ -0,0 +1,190 @@
+/*
+ * Option parsing and device setup for spidev based tools. Derived from
+ * the SPI testing utility (using spidev driver)
+ *
+ * Copyright (c) 2007  MontaVista Software, Inc.
+ * Copyright (c) 2007  Anton Vorontsov <avorontsov@ru.mvista.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+#include "ads1x9x_spidev.h"
+
+static void pabort(const char *s)
+{
+	perror(s);
+	abort();
+}
+
+void spidev_opts_init(spidev_opts_t *opts)
+{
+	opts->device = "/dev/spidev1.1";
+	opts->mode = 0;
+	opts->bits = 8;
+	opts->speed = 500000;
+	opts->delay = 0;
+}
+
+void spidev_print_usage(const char *prog)
+{
+	printf("Usage: %s [-DsbdlHOLC3]\n", prog);
+	puts("  -D --device   device to use (default /dev/spidev1.1)\n"
+	     "  -s --speed    max speed (Hz)\n"
+	     "  -d --delay    delay (usec)\n"
+	     "  -b --bpw      bits per word \n"
+	     "  -l --loop     loopback\n"
+	     "  -H --cpha     clock phase\n"
+	     "  -O --cpol     clock polarity\n"
+	     "  -L --lsb      least significant bit first\n"
+	     "  -C --cs-high  chip select active high\n"
+	     "  -3 --3wire    SI/SO signals shared\n");
+	exit(1);
+}
+
+void spidev_parse_opts(int argc, char *argv[], spidev_opts_t *opts)
+{
+	while (1) {
+		static const struct option lopts[] = {
+			{ "device",  1, 0, 'D' },
+			{ "speed",   1, 0, 's' },
+			{ "delay",   1, 0, 'd' },
+			{ "bpw",     1, 0, 'b' },
+			{ "loop",    0, 0, 'l' },
+			{ "cpha",    0, 0, 'H' },
+			{ "cpol",    0, 0, 'O' },
+			{ "lsb",     0, 0, 'L' },
+			{ "cs-high", 0, 0, 'C' },
+			{ "3wire",   0, 0, '3' },
+			{ "no-cs",   0, 0, 'N' },
+			{ "ready",   0, 0, 'R' },
+			{ NULL, 0, 0, 0 },
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "D:s:d:b:lHOLC3NR", lopts, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'D':
+			opts->device = optarg;
+			break;
+		case 's':
+			opts->speed = atoi(optarg);
+			break;
+		case 'd':
+			opts->delay = atoi(optarg);
+			break;
+		case 'b':
+			opts->bits = atoi(optarg);
+			break;
+		case 'l':
+			opts->mode |= SPI_LOOP;
+			break;
+		case 'H':
+			opts->mode |= SPI_CPHA;
+			break;
+		case 'O':
+			opts->mode |= SPI_CPOL;
+			break;
+		case 'L':
+			opts->mode |= SPI_LSB_FIRST;
+			break;
+		case 'C':
+			opts->mode |= SPI_CS_HIGH;
+			break;
+		case '3':
+			opts->mode |= SPI_3WIRE;
+			break;
+		case 'N':
+			opts->mode |= SPI_NO_CS;
+			break;
+		case 'R':
+			opts->mode |= SPI_READY;
+			break;
+		default:
+			spidev_print_usage(argv[0]);
+			break;
+		}
+	}
+}
+
+/**
+ * Apply mode, bits per word and speed to an open spidev device. The
+ * values read back from the driver are stored in opts.
+ *
+ * @return 0 if successful, -1 on error.
+ */
+int spidev_configure(int fd, spidev_opts_t *opts)
+{
+	if (ioctl(fd, SPI_IOC_WR_MODE, &opts->mode) == -1
+			|| ioctl(fd, SPI_IOC_RD_MODE, &opts->mode) == -1)
+		return -1;
+
+	if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &opts->bits) == -1
+			|| ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &opts->bits) == -1)
+		return -1;
+
+	if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &opts->speed) == -1
+			|| ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &opts->speed) == -1)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Open opts->device and apply mode, bits per word and speed. The values
+ * read back from the driver are stored in opts. The device is locked so
+ * that a second tool or a probe cannot disturb a capture in progress.
+ *
+ * @return File descriptor. Aborts on error or if the device is in use.
+ */
+int spidev_open(spidev_opts_t *opts)
+{
+	int fd;
+
+	fd = open(opts->device, O_RDWR);
+	if (fd < 0)
+		pabort("can't open device");
+
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+		pabort("device in use");
+
+	if (spidev_configure(fd, opts) < 0)
+		pabort("can't configure spi device");
+
+	return fd;
+}
+
+/**
+ * Full duplex transfer of len bytes. Either tx or rx may be NULL.
+ *
+ * @return Number of bytes transferred or -1 on error.
+ */
+int spidev_transfer(int fd, const spidev_opts_t *opts, const uint8_t *tx, uint8_t *rx, int len)
+{
+	struct spi_ioc_transfer tr = {
+		.tx_buf = (unsigned long)tx,
+		.rx_buf = (unsigned long)rx,
+		.len = len,
+		.delay_usecs = opts->delay,
+		.speed_hz = opts->speed,
+		.bits_per_word = opts->bits,
+	};
+
+	return ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
+}
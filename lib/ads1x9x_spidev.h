@@ -0,0 +1,25 @@
+/*
+ * ads1x9x_spidev.h - option parsing and setup common to the spidev based tools.
+ */
+
+#ifndef ADS1X9X_SPIDEV_H
+#define ADS1X9X_SPIDEV_H
+
+#include <stdint.h>
+
+typedef struct {
+	const char *device;
+	uint8_t mode;
+	uint8_t bits;
+	uint32_t speed;
+	uint16_t delay;
+} spidev_opts_t;
+
+void spidev_opts_init (spidev_opts_t *opts);
+void spidev_print_usage (const char *prog);
+void spidev_parse_opts (int argc, char *argv[], spidev_opts_t *opts);
+int spidev_configure (int fd, spidev_opts_t *opts);
+int spidev_open (spidev_opts_t *opts);
+int spidev_transfer (int fd, const spidev_opts_t *opts, const uint8_t *tx, uint8_t *rx, int len);
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * ads1x9x_splice.c - zero-copy archival of the EVM byte stream.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ads1x9x_splice.h"
+#include "ads1x9x_metrics.h"
+
+#define PIPE_SIZE 65536
+#define CHUNK_SIZE 16384
+
+/**
+ * Run peeked bytes through the frame parser, discarding the frames. The
+ * parser keeps the frame, resync and loss counts.
+ */
+static void check_frames (ads1x9x_evm_parser_t *check, const uint8_t *buf, int length) {
+	ads1x9x_evm_frame_t frame;
+	while (length > 0) {
+		int n = ads1x9x_evm_parser_feed(check, buf, length);
+		buf += n;
+		length -= n;
+		while (ads1x9x_evm_parse(check, &frame) == 1) {
+		}
+	}
+}
+
+/**
+ * Copy with read/write where the kernel cannot splice from in_fd.
+ */
+static int copy_capture (int in_fd, int out_fd, uint64_t nbytes, ads1x9x_evm_parser_t *check,
+	ads1x9x_splice_stats_t *stats, volatile int *stop) {
+
+	uint8_t buf[CHUNK_SIZE];
+	while (stats->bytes < nbytes && !*stop) {
+		int n = nbytes - stats->bytes < CHUNK_SIZE ? nbytes - stats->bytes : CHUNK_SIZE;
+		n = read(in_fd, buf, n);
+		ADS1X9X_METRIC_INC(syscalls);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return n < 0 ? -1 : 0;
+		}
+		if (check != NULL) {
+			check_frames(check, buf, n);
+		}
+		int w = 0;
+		while (w < n) {
+			int r = write(out_fd, buf + w, n - w);
+			ADS1X9X_METRIC_INC(syscalls);
+			if (r < 0 && errno == EINTR) {
+				continue;
+			}
+			if (r <= 0) {
+				return -1;
+			}
+			w += r;
+		}
+		stats->bytes += n;
+		ADS1X9X_METRIC_ADD(bytes_read, n);
+		ADS1X9X_METRIC_ADD(output_bytes, n);
+	}
+	return 0;
+}
+
+/**
+ * Move nbytes from in_fd to out_fd through a pipe with splice(2). If
+ * check is not NULL a tee(2) of each chunk is read back and run through
+ * that parser (initialised with no transport) to validate and count
+ * frames; the bytes written to out_fd are not affected by the check. Falls back to read/write if the kernel cannot
+ * splice from in_fd.
+ *
+ * @param stop Checked between chunks, capture ends when it becomes non-zero.
+ * @return 0 if nbytes were moved or the input ended, -1 on error.
+ */
+int ads1x9x_splice_capture (int in_fd, int out_fd, uint64_t nbytes, ads1x9x_evm_parser_t *check,
+	ads1x9x_splice_stats_t *stats, volatile int *stop) {
+
+	int p[2], q[2] = {-1, -1};
+	uint8_t buf[CHUNK_SIZE];
+	int ret = 0;
+
+	if (pipe(p) < 0) {
+		return -1;
+	}
+	fcntl(p[1], F_SETPIPE_SZ, PIPE_SIZE);
+	if (check != NULL) {
+		if (pipe(q) < 0) {
+			close(p[0]);
+			close(p[1]);
+			return -1;
+		}
+		fcntl(q[1], F_SETPIPE_SZ, PIPE_SIZE);
+	}
+
+	while (stats->bytes < nbytes && !*stop) {
+		size_t want = nbytes - stats->bytes < CHUNK_SIZE ? nbytes - stats->bytes : CHUNK_SIZE;
+		ssize_t n = splice(in_fd, NULL, p[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+		stats->splice_calls++;
+		ADS1X9X_METRIC_INC(syscalls);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && errno == EINVAL && stats->bytes == 0) {
+			ret = copy_capture(in_fd, out_fd, nbytes, check, stats, stop);
+			break;
+		}
+		if (n <= 0) {
+			ret = n < 0 ? -1 : 0;
+			break;
+		}
+
+		if (check != NULL) {
+			// Duplicate the pipe contents without consuming them
+			ssize_t m = tee(p[0], q[1], n, 0);
+			ADS1X9X_METRIC_INC(syscalls);
+			while (m > 0) {
+				ssize_t r = read(q[0], buf, m);
+				ADS1X9X_METRIC_INC(syscalls);
+				if (r <= 0) {
+					break;
+				}
+				check_frames(check, buf, r);
+				m -= r;
+			}
+		}
+
+		ssize_t left = n;
+		while (left > 0) {
+			ssize_t w = splice(p[0], NULL, out_fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+			stats->splice_calls++;
+			ADS1X9X_METRIC_INC(syscalls);
+			if (w < 0 && errno == EINTR) {
+				continue;
+			}
+			if (w <= 0) {
+				ret = -1;
+				break;
+			}
+			left -= w;
+		}
+		if (ret < 0) {
+			break;
+		}
+		stats->bytes += n;
+		ADS1X9X_METRIC_ADD(bytes_read, n);
+		ADS1X9X_METRIC_ADD(output_bytes, n);
+	}
+
+	close(p[0]);
+	close(p[1]);
+	if (check != NULL) {
+		close(q[0]);
+		close(q[1]);
+	}
+	return ret;
+}
@@ -0,0 +1,25 @@
+/**
+ * ads1x9x_splice.h - zero-copy archival of the EVM byte stream with
+ * splice(2). Bytes move from the device to the output through a kernel
+ * pipe buffer and never enter user space, except for an optional tee(2)
+ * peek fed to a frame parser to validate frames and count them.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_SPLICE_H
+#define ADS1X9X_SPLICE_H
+
+#include <stdint.h>
+
+#include "ads1x9x_evm.h"
+
+typedef struct {
+	uint64_t bytes;
+	uint64_t splice_calls;
+} ads1x9x_splice_stats_t;
+
+int ads1x9x_splice_capture (int in_fd, int out_fd, uint64_t nbytes, ads1x9x_evm_parser_t *check,
+	ads1x9x_splice_stats_t *stats, volatile int *stop);
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * ads1x9x_template.c - signal averaged beat templates.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_template.h"
+#include "ads1x9x_metrics.h"
+
+#define MAX_LAG 8
+
+#if defined(__GNUC__)
+typedef float v4sf __attribute__((vector_size(16)));
+#endif
+
+/**
+ * Dot product of two float vectors of length n.
+ */
+static float dot (const float *a, const float *b, int n) {
+	float sum = 0;
+	int i = 0;
+#if defined(__GNUC__)
+	v4sf acc = {0, 0, 0, 0};
+	for (; i + 4 <= n; i += 4) {
+		v4sf va, vb;
+		memcpy(&va, a + i, sizeof(va));
+		memcpy(&vb, b + i, sizeof(vb));
+		acc += va * vb;
+	}
+	sum = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+	for (; i < n; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+/**
+ * @param sps Sample rate of the ECG samples
+ */
+void ads1x9x_template_init (ads1x9x_template_t *tp, int sps) {
+	memset(tp, 0, sizeof(*tp));
+	tp->sps = sps;
+	tp->len = sps * 7 / 10;
+	if (tp->len > ADS1X9X_TEMPLATE_MAX_LEN) {
+		tp->len = ADS1X9X_TEMPLATE_MAX_LEN;
+	}
+	tp->pre = tp->len * 25 / 70;
+	tp->max_lag = sps / 100;
+	if (tp->max_lag > MAX_LAG) {
+		tp->max_lag = MAX_LAG;
+	}
+	ads1x9x_rpeak_init(&tp->rpeak, sps);
+}
+
+/**
+ * Add a beat to a cluster's average and refresh its centred copy.
+ */
+static void cluster_add (ads1x9x_template_t *tp, ads1x9x_template_cluster_t *c, const float *beat) {
+	int i;
+	double sum = 0, sumsq = 0;
+
+	c->count++;
+	float w = 1.0f / (c->count < ADS1X9X_TEMPLATE_AVERAGE ? c->count : ADS1X9X_TEMPLATE_AVERAGE);
+	for (i = 0; i < tp->len; i++) {
+		c->avg[i] += w * (beat[i] - c->avg[i]);
+		sum += c->avg[i];
+	}
+	float mean = sum / tp->len;
+	for (i = 0; i < tp->len; i++) {
+		c->centred[i] = c->avg[i] - mean;
+		sumsq += c->centred[i] * c->centred[i];
+	}
+	c->norm = sqrt(sumsq);
+}
+
+/**
+ * Align and classify the beat with R peak at r.
+ */
+static void classify (ads1x9x_template_t *tp, uint64_t r, ads1x9x_beat_t *beat) {
+	float buf[ADS1X9X_TEMPLATE_MAX_LEN + 2 * MAX_LAG];
+	double seg_norm[2 * MAX_LAG + 1];
+	int nlag = 2 * tp->max_lag + 1;
+	int i, c, k;
+	uint64_t start = r - tp->pre - tp->max_lag;
+
+	for (i = 0; i < tp->len + 2 * tp->max_lag; i++) {
+		buf[i] = tp->ring[(start + i) % ADS1X9X_TEMPLATE_RING];
+	}
+	// Norm of each lagged segment with its mean removed. Templates are
+	// centred so the segment mean drops out of the dot product.
+	for (k = 0; k < nlag; k++) {
+		double sum = 0, sumsq = 0;
+		for (i = 0; i < tp->len; i++) {
+			sum += buf[k + i];
+			sumsq += (double)buf[k + i] * buf[k + i];
+		}
+		double var = sumsq - sum * sum / tp->len;
+		seg_norm[k] = var > 0 ? sqrt(var) : 0;
+	}
+
+	int best = -1, best_k = tp->max_lag;
+	double best_corr = -1;
+	for (c = 0; c < tp->nclusters; c++) {
+		ads1x9x_template_cluster_t *cl = &tp->cluster[c];
+		for (k = 0; k < nlag; k++) {
+			if (seg_norm[k] == 0 || cl->norm == 0) {
+				continue;
+			}
+			double corr = dot(buf + k, cl->centred, tp->len) / (seg_norm[k] * cl->norm);
+			if (corr > best_corr) {
+				best_corr = corr;
+				best = c;
+				best_k = k;
+			}
+		}
+	}
+
+	if (best < 0 || best_corr < ADS1X9X_TEMPLATE_MIN_CORR) {
+		if (tp->nclusters < ADS1X9X_TEMPLATE_MAX) {
+			best = tp->nclusters++;
+			best_k = tp->max_lag;
+		} else {
+			best = -1;
+		}
+	}
+
+	beat->r_index = r;
+	beat->cluster = best;
+	beat->corr = best_corr;
+	beat->lag = best_k - tp->max_lag;
+	tp->beats++;
+	if (best < 0) {
+		tp->unclassified++;
+		return;
+	}
+	cluster_add(tp, &tp->cluster[best], buf + best_k);
+}
+
+/**
+ * Process one ECG sample.
+ *
+ * @param beat Receives the classified beat
+ * @return 1 if a beat was classified, else 0. Beats are classified once
+ * the samples after the R peak are in, about 0.5s after it.
+ */
+int ads1x9x_template_process (ads1x9x_template_t *tp, int32_t x, ads1x9x_beat_t *beat) {
+	uint64_t r;
+
+	tp->ring[tp->n % ADS1X9X_TEMPLATE_RING] = x;
+	tp->n++;
+	if (ads1x9x_rpeak_process(&tp->rpeak, x, &r)
+			&& r >= (uint64_t)(tp->pre + tp->max_lag) && tp->npending < 4) {
+		tp->pending[tp->npending++] = r;
+	}
+	if (tp->npending == 0
+			|| tp->n < tp->pending[0] - tp->pre + tp->len + tp->max_lag) {
+		return 0;
+	}
+	r = tp->pending[0];
+	memmove(tp->pending, tp->pending + 1, --tp->npending * sizeof(uint64_t));
+	classify(tp, r, beat);
+	return 1;
+}
+
+/**
+ * Write the templates as text, one row per sample: time from the R peak
+ * in ms then the average of each cluster. The file is replaced
+ * atomically so readers always see a complete set.
+ *
+ * @return 0 or -1 if the file could not be written.
+ */
+int ads1x9x_template_write (const ads1x9x_template_t *tp, const char *path) {
+	char tmp[512];
+	int i, c;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *f = fopen(tmp, "w");
+	if (f == NULL) {
+		return -1;
+	}
+	fprintf(f, "# beat templates, %llu beats, %llu unclassified, counts",
+		(unsigned long long)tp->beats, (unsigned long long)tp->unclassified);
+	for (c = 0; c < tp->nclusters; c++) {
+		fprintf(f, " %d", tp->cluster[c].count);
+	}
+	fprintf(f, "\n");
+	for (i = 0; i < tp->len; i++) {
+		fprintf(f, "%.1f", (i - tp->pre) * 1000.0 / tp->sps);
+		for (c = 0; c < tp->nclusters; c++) {
+			fprintf(f, " %.1f", tp->cluster[c].avg[i]);
+		}
+		fprintf(f, "\n");
+	}
+	if (fclose(f) != 0) {
+		return -1;
+	}
+	return rename(tmp, path);
+}
+
+struct ads1x9x_template_writer {
+	char path[512];
+	uint64_t interval_ns;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+	int dirty;
+	int failed;
+	// Latest templates handed over, and the copy being written
+	ads1x9x_template_t latest;
+	ads1x9x_template_t out;
+};
+
+/**
+ * Copy what ads1x9x_template_write() needs, leaving out the sample ring.
+ */
+static void template_copy (ads1x9x_template_t *dst, const ads1x9x_template_t *src) {
+	dst->sps = src->sps;
+	dst->len = src->len;
+	dst->pre = src->pre;
+	dst->nclusters = src->nclusters;
+	dst->beats = src->beats;
+	dst->unclassified = src->unclassified;
+	memcpy(dst->cluster, src->cluster, src->nclusters * sizeof(src->cluster[0]));
+}
+
+static void writer_write (ads1x9x_template_writer_t *w) {
+	int failed = ads1x9x_template_write(&w->out, w->path) < 0;
+	if (failed && !w->failed) {
+		fprintf (stderr,"Warning: unable to write templates to %s\n", w->path);
+	}
+	w->failed = failed;
+}
+
+static void *writer_thread (void *arg) {
+	ads1x9x_template_writer_t *w = arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->stop) {
+		uint64_t due = ads1x9x_now_ns() + w->interval_ns;
+		deadline.tv_sec = due / 1000000000ULL;
+		deadline.tv_nsec = due % 1000000000ULL;
+		while (!w->stop && pthread_cond_timedwait(&w->cond, &w->lock, &deadline) != ETIMEDOUT) {
+		}
+		if (w->stop || !w->dirty) {
+			continue;
+		}
+		template_copy(&w->out, &w->latest);
+		w->dirty = FALSE;
+		pthread_mutex_unlock(&w->lock);
+		writer_write(w);
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/**
+ * Start a thread that rewrites path with the latest templates every
+ * interval_ms while they change, so file I/O stays off the thread
+ * reading samples.
+ *
+ * @return Writer or NULL if the thread could not be started.
+ */
+ads1x9x_template_writer_t *ads1x9x_template_writer_start (const char *path, int interval_ms) {
+	ads1x9x_template_writer_t *w = calloc(1, sizeof(ads1x9x_template_writer_t));
+	pthread_condattr_t attr;
+
+	if (w == NULL) {
+		return NULL;
+	}
+	snprintf(w->path, sizeof(w->path), "%s", path);
+	w->interval_ns = (uint64_t)interval_ms * 1000000ULL;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&w->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+/**
+ * Hand over the templates after a beat. Copies the averages, a few KB,
+ * and never waits for a write in progress.
+ */
+void ads1x9x_template_writer_update (ads1x9x_template_writer_t *w, const ads1x9x_template_t *tp) {
+	pthread_mutex_lock(&w->lock);
+	template_copy(&w->latest, tp);
+	w->dirty = TRUE;
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Stop the thread, writing the latest templates if not yet written.
+ *
+ * @return 0 if the file is up to date, -1 if the last write failed.
+ */
+int ads1x9x_template_writer_stop (ads1x9x_template_writer_t *w) {
+	pthread_mutex_lock(&w->lock);
+	w->stop = TRUE;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+	if (w->dirty) {
+		template_copy(&w->out, &w->latest);
+		writer_write(w);
+	}
+	int ret = w->failed ? -1 : 0;
+	free(w);
+	return ret;
+}
@@ -0,0 +1,80 @@
+/**
+ * ads1x9x_template.h - signal averaged beat templates.
+ *
+ * Beats found by the R peak detector are cut from the sample stream
+ * around the R peak, aligned to the best matching template by searching
+ * a few samples of lag and assigned to that template's cluster when the
+ * normalised cross correlation is high enough, else they start a new
+ * cluster. Each template is a running average of its beats, becoming an
+ * exponential average after ADS1X9X_TEMPLATE_AVERAGE beats, so work per
+ * beat is constant. Correlations run on SIMD vectors.
+ *
+ * Meant for the 24 bit acquire data but works on any int32 samples.
+ * A template writer thread keeps a file of the templates current without
+ * file I/O on the thread reading samples.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_TEMPLATE_H
+#define ADS1X9X_TEMPLATE_H
+
+#include <stdint.h>
+
+#include "ads1x9x_hrv.h"
+
+#define ADS1X9X_TEMPLATE_MAX 8
+// Longest beat, samples; beats are 0.7s, 0.25s of it before the R peak
+#define ADS1X9X_TEMPLATE_MAX_LEN 512
+#define ADS1X9X_TEMPLATE_RING 2048
+// Beats averaged before the average becomes exponential
+#define ADS1X9X_TEMPLATE_AVERAGE 64
+// Correlation needed to join a cluster
+#define ADS1X9X_TEMPLATE_MIN_CORR 0.9
+
+typedef struct {
+	int count;
+	// Running average, and the same with its mean removed and its norm
+	float avg[ADS1X9X_TEMPLATE_MAX_LEN];
+	float centred[ADS1X9X_TEMPLATE_MAX_LEN];
+	double norm;
+} ads1x9x_template_cluster_t;
+
+typedef struct {
+	uint64_t r_index;
+	// Cluster the beat joined, or -1 if it matched none and none was free
+	int cluster;
+	double corr;
+	int lag;
+} ads1x9x_beat_t;
+
+typedef struct {
+	int sps;
+	int len;
+	int pre;
+	int max_lag;
+
+	ads1x9x_rpeak_t rpeak;
+	int32_t ring[ADS1X9X_TEMPLATE_RING];
+	uint64_t n;
+	// R peaks waiting for the rest of their beat
+	uint64_t pending[4];
+	int npending;
+
+	int nclusters;
+	ads1x9x_template_cluster_t cluster[ADS1X9X_TEMPLATE_MAX];
+	uint64_t beats;
+	uint64_t unclassified;
+} ads1x9x_template_t;
+
+void ads1x9x_template_init (ads1x9x_template_t *tp, int sps);
+int ads1x9x_template_process (ads1x9x_template_t *tp, int32_t x, ads1x9x_beat_t *beat);
+int ads1x9x_template_write (const ads1x9x_template_t *tp, const char *path);
+
+typedef struct ads1x9x_template_writer ads1x9x_template_writer_t;
+
+ads1x9x_template_writer_t *ads1x9x_template_writer_start (const char *path, int interval_ms);
+void ads1x9x_template_writer_update (ads1x9x_template_writer_t *w, const ads1x9x_template_t *tp);
+int ads1x9x_template_writer_stop (ads1x9x_template_writer_t *w);
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * ads1x9x_transport.c - serial and spidev transports.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_transport.h"
+
+static int serial_read (ads1x9x_transport_t *t, void *buf, int length) {
+	ADS1X9X_METRIC_INC(syscalls);
+	return read(t->fd, buf, length);
+}
+
+static int serial_write (ads1x9x_transport_t *t, const void *buf, int length) {
+	return write(t->fd, buf, length);
+}
+
+static void fd_close (ads1x9x_transport_t *t) {
+	close(t->fd);
+	free(t->priv);
+	free(t);
+}
+
+/**
+ * Put a serial device in raw mode: 8N1, no handshaking, blocking reads
+ * returning as soon as any data is available.
+ *
+ * @param bps Bits per second
+ * @return 0 if successful, -1 if fd is not a terminal.
+ */
+int ads1x9x_serial_configure (int fd, int bps) {
+	struct termios tios;
+	if (tcgetattr(fd,&tios) < 0) {
+		return -1;
+	}
+
+	// Rates without a Bnnn constant are set with termios2 below
+	int speed = B9600;
+	int custom = FALSE;
+	switch (bps) {
+		case 9600:
+			speed = B9600;
+			break;
+		case 19200:
+			speed = B19200;
+			break;
+		case 38400:
+			speed = B38400;
+			break;
+		case 57600:
+			speed = B57600;
+			break;
+		case 115200:
+			speed = B115200;
+			break;
+		case 230400:
+			speed = B230400;
+			break;
+		case 460800:
+			speed = B460800;
+			break;
+		case 921600:
+			speed = B921600;
+			break;
+		default:
+			custom = TRUE;
+	}
+
+	// Set tx/rx speed and set raw mode
+ 	cfsetispeed(&tios,speed);
+ 	cfsetospeed(&tios,speed);
+	cfmakeraw(&tios);
+
+	tios.c_cflag &= ~CSTOPB; // Set 1 stop bit
+	tios.c_cflag |= (CREAD | CLOCAL); // Enable receiver and disable hardware flow control
+	tios.c_oflag = 0; // Disable some modem settings
+
+	// Blocking reads return as soon as any data is available. See
+	// ads1x9x_serial_set_read_size() for frame sized reads.
+	tios.c_cc[VMIN] = 1;
+	tios.c_cc[VTIME] = 0;
+
+	tcsetattr(fd, TCSANOW, &tios);
+
+	if (custom && ads1x9x_serial_set_speed(fd, bps) < 0) {
+		fprintf (stderr,"Unsupported speed %d bps\n", bps);
+	}
+	return 0;
+}
+
+/**
+ * Open serial IO device to ADS1292R EVM
+ * (8N1, raw mode, no handshaking)
+ *
+ * @param device Pointer to string with device name (eg "/dev/ttyACM0")
+ * @param bps Bits per second
+ * @return Transport or NULL if there was an error.
+ */
+ads1x9x_transport_t *ads1x9x_transport_open_serial (const char *device, int bps) {
+
+	int fd = open(device,O_RDWR);
+	if (fd < 0) {
+		fprintf (stderr,"Error: unable to open device %s\n",device);
+		return NULL;
+	}
+
+	if (ads1x9x_serial_configure(fd, bps) < 0) {
+		fprintf (stderr,"Error: error calling tcgetattr\n");
+		close(fd);
+		return NULL;
+	}
+
+	// Advisory lock so a probe leaves a port that is in use alone
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		fprintf (stderr,"Warning: %s is in use by another process\n",device);
+	}
+
+	ads1x9x_transport_t *t = calloc(1, sizeof(ads1x9x_transport_t));
+	t->name = "serial";
+	t->fd = fd;
+	t->read = serial_read;
+	t->write = serial_write;
+	t->close = fd_close;
+	return t;
+}
+
+static int file_write (ads1x9x_transport_t *t, const void *buf, int length) {
+	// Commands have no effect on a recording
+	(void)t;
+	(void)buf;
+	return length;
+}
+
+/**
+ * Open a file or FIFO containing a recording of the Host/USB byte stream
+ * from an EVM (eg stream -f w output). Commands written to the transport
+ * are discarded.
+ *
+ * @return Transport or NULL if there was an error.
+ */
+ads1x9x_transport_t *ads1x9x_transport_open_file (const char *path) {
+	int fd = open(path,O_RDONLY);
+	if (fd < 0) {
+		fprintf (stderr,"Error: unable to open file %s\n",path);
+		return NULL;
+	}
+	ads1x9x_transport_t *t = calloc(1, sizeof(ads1x9x_transport_t));
+	t->name = "file";
+	t->fd = fd;
+	t->read = serial_read;
+	t->write = file_write;
+	t->close = fd_close;
+	return t;
+}
+
+static int spidev_read (ads1x9x_transport_t *t, void *buf, int length) {
+	return spidev_transfer(t->fd, t->priv, NULL, buf, length);
+}
+
+static int spidev_write (ads1x9x_transport_t *t, const void *buf, int length) {
+	return spidev_transfer(t->fd, t->priv, buf, NULL, length);
+}
+
+static int spidev_xfer (ads1x9x_transport_t *t, const uint8_t *tx, uint8_t *rx, int length) {
+	return spidev_transfer(t->fd, t->priv, tx, rx, length);
+}
+
+/**
+ * Open spidev device opts->device. Aborts on error as spidev_open() does.
+ * Settings read back from the driver are stored in opts.
+ */
+ads1x9x_transport_t *ads1x9x_transport_open_spidev (spidev_opts_t *opts) {
+	ads1x9x_transport_t *t = calloc(1, sizeof(ads1x9x_transport_t));
+	t->name = "spidev";
+	t->fd = spidev_open(opts);
+	t->priv = malloc(sizeof(spidev_opts_t));
+	*(spidev_opts_t *)t->priv = *opts;
+	t->read = spidev_read;
+	t->write = spidev_write;
+	t->transfer = spidev_xfer;
+	t->close = fd_close;
+	return t;
+}
+
+void ads1x9x_transport_close (ads1x9x_transport_t *t) {
+	t->close(t);
+}
+
+/**
+ * Continue to read from transport t until 'length' bytes
+ * have been read.
+ *
+ * @return length if successful, -1 on error or end of data.
+ */
+int ads1x9x_read_n_bytes (ads1x9x_transport_t *t, void *buf, int length) {
+	int n=0, r;
+	while (n < length) {
+		r = ads1x9x_transport_read(t, (uint8_t *)buf+n, length-n);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		n += r;
+	}
+	return length;
+}
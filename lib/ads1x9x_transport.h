@@ -0,0 +1,81 @@
+/**
+ * ads1x9x_transport.h - byte stream transports to an ADS1x9x device:
+ * USB-serial to the EVM firmware, spidev direct to the chip, a
+ * recording of EVM output, and a software emulation of the EVM for
+ * testing without hardware.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_TRANSPORT_H
+#define ADS1X9X_TRANSPORT_H
+
+#include <stdint.h>
+
+#include "ads1x9x_spidev.h"
+#include "ads1x9x_metrics.h"
+#include "ads1x9x_pcapng.h"
+
+typedef struct ads1x9x_transport ads1x9x_transport_t;
+
+struct ads1x9x_transport {
+	const char *name;
+	// Operating system file descriptor or -1 if the transport has none
+	int fd;
+	void *priv;
+
+	// Read up to length bytes. Return bytes read, 0 if no more data or -1 on error.
+	int (*read) (ads1x9x_transport_t *t, void *buf, int length);
+	// Write length bytes. Return bytes written or -1 on error.
+	int (*write) (ads1x9x_transport_t *t, const void *buf, int length);
+	// Full duplex transfer if supported by the transport, else NULL.
+	int (*transfer) (ads1x9x_transport_t *t, const uint8_t *tx, uint8_t *rx, int length);
+	void (*close) (ads1x9x_transport_t *t);
+
+	// Read statistics, maintained by ads1x9x_transport_read() which also
+	// updates the process wide metrics
+	uint64_t read_calls;
+	uint64_t read_bytes;
+	int read_min;
+	int read_max;
+
+	// Protocol trace of commands written and frames parsed, or NULL
+	ads1x9x_pcapng_t *trace;
+	int trace_interface;
+};
+
+/**
+ * Read through t->read() and update the read statistics.
+ */
+static inline int ads1x9x_transport_read (ads1x9x_transport_t *t, void *buf, int length) {
+	int n = t->read(t, buf, length);
+	if (n > 0) {
+		if (t->read_calls == 0 || n < t->read_min) {
+			t->read_min = n;
+		}
+		if (n > t->read_max) {
+			t->read_max = n;
+		}
+		t->read_calls++;
+		t->read_bytes += n;
+		ADS1X9X_METRIC_INC(read_calls);
+		ADS1X9X_METRIC_ADD(bytes_read, n);
+	}
+	return n;
+}
+
+ads1x9x_transport_t *ads1x9x_transport_open_serial (const char *device, int bps);
+ads1x9x_transport_t *ads1x9x_transport_open_file (const char *path);
+ads1x9x_transport_t *ads1x9x_transport_open_spidev (spidev_opts_t *opts);
+ads1x9x_transport_t *ads1x9x_transport_open_emulator (void);
+void ads1x9x_transport_close (ads1x9x_transport_t *t);
+
+int ads1x9x_read_n_bytes (ads1x9x_transport_t *t, void *buf, int length);
+
+int ads1x9x_serial_configure (int fd, int bps);
+int ads1x9x_serial_set_speed (int fd, int bps);
+int ads1x9x_serial_get_speed (int fd);
+int ads1x9x_serial_set_read_size (int fd, int vmin, int vtime);
+int ads1x9x_serial_set_low_latency (int fd);
+
+#endif
@@ -0,0 +1,551 @@
+/**
+ * ads1x9x_uring.c - io_uring transport and sink.
+ *
+ * Reads and writes on a regular file carry explicit offsets, so several
+ * may be in flight at once and still be consumed in order. Reads from a
+ * tty or FIFO and writes to a pipe have no offset and the kernel gives no
+ * ordering guarantee between concurrent requests on the same descriptor,
+ * so those run one deep: the request is still asynchronous and overlaps
+ * with frame processing, but is not duplicated.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_uring.h"
+#include "ads1x9x_metrics.h"
+#include "ads1x9x_probes.h"
+
+// Slot states
+#define SLOT_BUSY (-1000000)
+
+#define READ_BUF_SIZE 4096
+#define WRITE_BUF_SIZE 16384
+
+/**
+ * Set up a ring with room for entries submissions.
+ *
+ * @return 0 if successful, -1 on error (eg kernel without io_uring).
+ */
+int ads1x9x_uring_init (ads1x9x_uring_t *r, unsigned entries) {
+	struct io_uring_params p;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0) {
+		return -1;
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size) {
+			r->sq_size = r->cq_size;
+		}
+		r->cq_size = r->sq_size;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		close(r->fd);
+		return -1;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			munmap(r->sq_ptr, r->sq_size);
+			close(r->fd);
+			return -1;
+		}
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		if (r->cq_ptr != r->sq_ptr) {
+			munmap(r->cq_ptr, r->cq_size);
+		}
+		munmap(r->sq_ptr, r->sq_size);
+		close(r->fd);
+		return -1;
+	}
+
+	uint8_t *sq = r->sq_ptr;
+	uint8_t *cq = r->cq_ptr;
+	r->sq_entries = p.sq_entries;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	r->sqe_tail = *r->sq_tail;
+
+	return 0;
+}
+
+void ads1x9x_uring_exit (ads1x9x_uring_t *r) {
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != r->sq_ptr) {
+		munmap(r->cq_ptr, r->cq_size);
+	}
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+}
+
+/**
+ * Register n buffers for use with IORING_OP_READ_FIXED/WRITE_FIXED.
+ *
+ * @return 0 if successful, -1 on error (eg RLIMIT_MEMLOCK too small).
+ */
+int ads1x9x_uring_register_buffers (ads1x9x_uring_t *r, const struct iovec *iov, unsigned n) {
+	return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+/**
+ * @return A zeroed SQE to fill in, or NULL if the submission queue is full.
+ */
+struct io_uring_sqe *ads1x9x_uring_get_sqe (ads1x9x_uring_t *r) {
+	unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (r->sqe_tail - head >= r->sq_entries) {
+		return NULL;
+	}
+	unsigned idx = r->sqe_tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sqe_tail++;
+	r->to_submit++;
+	return sqe;
+}
+
+/**
+ * Submit prepared SQEs and optionally wait for wait_nr completions, in
+ * one system call.
+ *
+ * @return Number of SQEs submitted or -1 on error.
+ */
+int ads1x9x_uring_submit (ads1x9x_uring_t *r, unsigned wait_nr) {
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+	int ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait_nr,
+		wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	ADS1X9X_METRIC_INC(syscalls);
+	if (ret < 0) {
+		return -1;
+	}
+	r->to_submit -= ret;
+	return ret;
+}
+
+/**
+ * @return Oldest unseen completion or NULL if there is none.
+ */
+struct io_uring_cqe *ads1x9x_uring_peek_cqe (ads1x9x_uring_t *r) {
+	unsigned head = *r->cq_head;
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &r->cqes[head & *r->cq_mask];
+}
+
+void ads1x9x_uring_cqe_seen (ads1x9x_uring_t *r) {
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get an SQE, submitting what is already prepared to make room if the
+ * submission queue is full. Each buffer slot has at most one request
+ * queued, so this only fails if the kernel takes none of them.
+ *
+ * @return A zeroed SQE or NULL if the queue is still full.
+ */
+static struct io_uring_sqe *get_sqe_or_submit (ads1x9x_uring_t *r) {
+	struct io_uring_sqe *sqe = ads1x9x_uring_get_sqe(r);
+	if (sqe == NULL && ads1x9x_uring_submit(r, 0) > 0) {
+		sqe = ads1x9x_uring_get_sqe(r);
+	}
+	return sqe;
+}
+
+/**
+ * Return TRUE if reads and writes on fd take a file offset.
+ */
+static int is_seekable (int fd, off_t *pos) {
+	*pos = lseek(fd, 0, SEEK_CUR);
+	return *pos >= 0;
+}
+
+/*
+ * Reader: a transport that keeps reads in flight on inner->fd.
+ */
+
+typedef struct {
+	ads1x9x_uring_t ring;
+	ads1x9x_transport_t *inner;
+	int depth;
+	int batch;
+	int fixed;
+	int seekable;
+	off_t next_offset;
+	uint8_t *bufs;
+	off_t offset[ADS1X9X_URING_MAX_DEPTH];
+	// Bytes in slot, error if negative, SLOT_BUSY while read in flight
+	int len[ADS1X9X_URING_MAX_DEPTH];
+	// Slot being consumed and position in it
+	int head;
+	int pos;
+} uring_reader_t;
+
+static void reader_arm (uring_reader_t *ur, int slot) {
+	struct io_uring_sqe *sqe = get_sqe_or_submit(&ur->ring);
+	if (sqe == NULL) {
+		// Fails the read of this slot rather than waiting forever
+		ur->len[slot] = -EBUSY;
+		return;
+	}
+	sqe->opcode = ur->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = ur->inner->fd;
+	sqe->addr = (unsigned long)(ur->bufs + slot * READ_BUF_SIZE);
+	sqe->len = READ_BUF_SIZE;
+	sqe->off = ur->seekable ? (uint64_t)ur->offset[slot] : (uint64_t)-1;
+	sqe->buf_index = slot;
+	sqe->user_data = slot;
+	ur->len[slot] = SLOT_BUSY;
+}
+
+static void reader_reap (uring_reader_t *ur) {
+	struct io_uring_cqe *cqe;
+	while ((cqe = ads1x9x_uring_peek_cqe(&ur->ring)) != NULL) {
+		int slot = cqe->user_data;
+		int res = cqe->res;
+		ads1x9x_uring_cqe_seen(&ur->ring);
+		if (res == -EAGAIN || res == -EINTR) {
+			reader_arm(ur, slot);
+		} else {
+			ur->len[slot] = res;
+		}
+	}
+}
+
+static int reader_read (ads1x9x_transport_t *t, void *buf, int length) {
+	uring_reader_t *ur = t->priv;
+
+	while (ur->len[ur->head] == SLOT_BUSY) {
+		reader_reap(ur);
+		if (ur->len[ur->head] != SLOT_BUSY) {
+			break;
+		}
+		if (ads1x9x_uring_submit(&ur->ring, 1) < 0 && errno != EINTR) {
+			return -1;
+		}
+	}
+
+	int n = ur->len[ur->head];
+	if (n <= 0) {
+		errno = -n;
+		return n < 0 ? -1 : 0;
+	}
+
+	if (length > n - ur->pos) {
+		length = n - ur->pos;
+	}
+	memcpy(buf, ur->bufs + ur->head * READ_BUF_SIZE + ur->pos, length);
+	ur->pos += length;
+
+	if (ur->pos == n) {
+		// Slot consumed: queue another read into it
+		ur->offset[ur->head] = ur->next_offset;
+		ur->next_offset += READ_BUF_SIZE;
+		reader_arm(ur, ur->head);
+		ur->pos = 0;
+		ur->head = (ur->head + 1) % ur->depth;
+		if ((int)ur->ring.to_submit >= ur->batch) {
+			ads1x9x_uring_submit(&ur->ring, 0);
+		}
+	}
+
+	return length;
+}
+
+static int reader_write (ads1x9x_transport_t *t, const void *buf, int length) {
+	uring_reader_t *ur = t->priv;
+	return ur->inner->write(ur->inner, buf, length);
+}
+
+static void reader_close (ads1x9x_transport_t *t) {
+	uring_reader_t *ur = t->priv;
+	ads1x9x_uring_exit(&ur->ring);
+	ads1x9x_transport_close(ur->inner);
+	free(ur->bufs);
+	free(ur);
+	free(t);
+}
+
+/**
+ * Wrap a transport that has a file descriptor so that reads go through
+ * io_uring with up to depth reads in flight. Writes (commands) pass
+ * straight through to the inner transport. Reads are queued at once, so
+ * bytes read from inner->fd any other way (eg splice) may instead land
+ * in a queued read.
+ *
+ * @return New transport, or NULL if io_uring is unavailable in which case
+ * inner is left open and unchanged.
+ */
+ads1x9x_transport_t *ads1x9x_uring_transport (ads1x9x_transport_t *inner, int depth) {
+	int i;
+
+	if (inner->fd < 0) {
+		return NULL;
+	}
+
+	uring_reader_t *ur = calloc(1, sizeof(uring_reader_t));
+	if (ads1x9x_uring_init(&ur->ring, ADS1X9X_URING_MAX_DEPTH) < 0) {
+		free(ur);
+		return NULL;
+	}
+
+	ur->inner = inner;
+	ur->seekable = is_seekable(inner->fd, &ur->next_offset);
+	if (depth < 1 || !ur->seekable) {
+		depth = 1;
+	}
+	if (depth > ADS1X9X_URING_MAX_DEPTH) {
+		depth = ADS1X9X_URING_MAX_DEPTH;
+	}
+	ur->depth = depth;
+	ur->batch = depth > 1 ? depth / 2 : 1;
+	ur->bufs = aligned_alloc(4096, depth * READ_BUF_SIZE);
+
+	struct iovec iov[ADS1X9X_URING_MAX_DEPTH];
+	for (i = 0; i < depth; i++) {
+		iov[i].iov_base = ur->bufs + i * READ_BUF_SIZE;
+		iov[i].iov_len = READ_BUF_SIZE;
+	}
+	ur->fixed = ads1x9x_uring_register_buffers(&ur->ring, iov, depth) == 0;
+
+	for (i = 0; i < depth; i++) {
+		ur->offset[i] = ur->next_offset;
+		ur->next_offset += READ_BUF_SIZE;
+		reader_arm(ur, i);
+	}
+	ads1x9x_uring_submit(&ur->ring, 0);
+
+	ads1x9x_transport_t *t = calloc(1, sizeof(ads1x9x_transport_t));
+	t->name = "uring";
+	t->fd = inner->fd;
+	t->priv = ur;
+	t->read = reader_read;
+	t->write = reader_write;
+	t->close = reader_close;
+	return t;
+}
+
+/*
+ * Writer: a sink that fills registered buffers and submits each as it
+ * fills without waiting for the write to complete.
+ */
+
+typedef struct {
+	ads1x9x_uring_t ring;
+	int owned;
+	int depth;
+	int fixed;
+	int seekable;
+	off_t next_offset;
+	uint8_t *bufs;
+	off_t offset[ADS1X9X_URING_MAX_DEPTH];
+	// Bytes queued in slot and bytes of those already written
+	int fill[ADS1X9X_URING_MAX_DEPTH];
+	int done[ADS1X9X_URING_MAX_DEPTH];
+	int busy[ADS1X9X_URING_MAX_DEPTH];
+	// Slot being filled
+	int cur;
+	int inflight;
+	int error;
+} uring_writer_t;
+
+static void writer_arm (ads1x9x_sink_t *s, int slot) {
+	uring_writer_t *uw = s->priv;
+	struct io_uring_sqe *sqe = get_sqe_or_submit(&uw->ring);
+	if (sqe == NULL) {
+		// Drop the slot's data as for a failed write
+		uw->error = TRUE;
+		uw->busy[slot] = FALSE;
+		uw->fill[slot] = uw->done[slot] = 0;
+		return;
+	}
+	sqe->opcode = uw->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = s->fd;
+	sqe->addr = (unsigned long)(uw->bufs + slot * WRITE_BUF_SIZE + uw->done[slot]);
+	sqe->len = uw->fill[slot] - uw->done[slot];
+	sqe->off = uw->seekable ? (uint64_t)(uw->offset[slot] + uw->done[slot]) : (uint64_t)-1;
+	sqe->buf_index = slot;
+	sqe->user_data = slot;
+	uw->busy[slot] = TRUE;
+	uw->inflight++;
+	ADS1X9X_METRIC_SET(output_queue_depth, uw->inflight);
+}
+
+/**
+ * Submit anything prepared and reap completions, waiting for at least
+ * one if wait is TRUE.
+ */
+static void writer_reap (ads1x9x_sink_t *s, int wait) {
+	uring_writer_t *uw = s->priv;
+	struct io_uring_cqe *cqe;
+
+	if (wait || uw->ring.to_submit > 0) {
+		ads1x9x_uring_submit(&uw->ring, wait ? 1 : 0);
+	}
+
+	while ((cqe = ads1x9x_uring_peek_cqe(&uw->ring)) != NULL) {
+		int slot = cqe->user_data;
+		int res = cqe->res;
+		ads1x9x_uring_cqe_seen(&uw->ring);
+		uw->inflight--;
+		ADS1X9X_METRIC_SET(output_queue_depth, uw->inflight);
+		if (res == -EAGAIN || res == -EINTR) {
+			writer_arm(s, slot);
+		} else if (res < 0) {
+			uw->error = TRUE;
+			uw->busy[slot] = FALSE;
+			uw->fill[slot] = uw->done[slot] = 0;
+		} else {
+			uw->done[slot] += res;
+			ADS1X9X_METRIC_ADD(output_bytes, res);
+			ADS1X9X_PROBE1(output_flushed, res);
+			if (uw->done[slot] < uw->fill[slot]) {
+				// Short write: queue the remainder
+				writer_arm(s, slot);
+			} else {
+				uw->busy[slot] = FALSE;
+				uw->fill[slot] = uw->done[slot] = 0;
+			}
+		}
+	}
+}
+
+static void writer_queue_slot (ads1x9x_sink_t *s, int slot) {
+	uring_writer_t *uw = s->priv;
+	if (!uw->seekable) {
+		// No offset to order by: one write in flight at a time
+		while (uw->inflight > 0) {
+			writer_reap(s, TRUE);
+		}
+	}
+	uw->offset[slot] = uw->next_offset;
+	uw->next_offset += uw->fill[slot];
+	writer_arm(s, slot);
+	writer_reap(s, FALSE);
+}
+
+static int writer_write (ads1x9x_sink_t *s, const void *buf, int length) {
+	uring_writer_t *uw = s->priv;
+	const uint8_t *p = buf;
+
+	while (length > 0) {
+		int slot = uw->cur;
+		while (uw->busy[slot]) {
+			writer_reap(s, TRUE);
+		}
+		int n = WRITE_BUF_SIZE - uw->fill[slot];
+		if (n > length) {
+			n = length;
+		}
+		memcpy(uw->bufs + slot * WRITE_BUF_SIZE + uw->fill[slot], p, n);
+		uw->fill[slot] += n;
+		p += n;
+		length -= n;
+		if (uw->fill[slot] == WRITE_BUF_SIZE) {
+			writer_queue_slot(s, slot);
+			uw->cur = (slot + 1) % uw->depth;
+		}
+	}
+	return uw->error ? -1 : 0;
+}
+
+static int writer_flush (ads1x9x_sink_t *s) {
+	uring_writer_t *uw = s->priv;
+	if (uw->fill[uw->cur] > 0 && !uw->busy[uw->cur]) {
+		writer_queue_slot(s, uw->cur);
+		uw->cur = (uw->cur + 1) % uw->depth;
+	}
+	while (uw->inflight > 0) {
+		writer_reap(s, TRUE);
+	}
+	return uw->error ? -1 : 0;
+}
+
+static void writer_close (ads1x9x_sink_t *s) {
+	uring_writer_t *uw = s->priv;
+	writer_flush(s);
+	ads1x9x_uring_exit(&uw->ring);
+	if (uw->owned) {
+		close(s->fd);
+	}
+	free(uw->bufs);
+	free(uw);
+	free(s);
+}
+
+/**
+ * Sink that writes to fd through io_uring with up to depth buffers
+ * queued or in flight.
+ *
+ * @param owned If TRUE fd is closed when the sink is closed.
+ * @return Sink or NULL if io_uring is unavailable.
+ */
+ads1x9x_sink_t *ads1x9x_uring_sink (int fd, int owned, int depth) {
+	int i;
+
+	uring_writer_t *uw = calloc(1, sizeof(uring_writer_t));
+	if (ads1x9x_uring_init(&uw->ring, ADS1X9X_URING_MAX_DEPTH) < 0) {
+		free(uw);
+		return NULL;
+	}
+
+	if (depth < 2) {
+		depth = 2;
+	}
+	if (depth > ADS1X9X_URING_MAX_DEPTH) {
+		depth = ADS1X9X_URING_MAX_DEPTH;
+	}
+	uw->owned = owned;
+	uw->depth = depth;
+	uw->seekable = is_seekable(fd, &uw->next_offset);
+	uw->bufs = aligned_alloc(4096, depth * WRITE_BUF_SIZE);
+
+	struct iovec iov[ADS1X9X_URING_MAX_DEPTH];
+	for (i = 0; i < depth; i++) {
+		iov[i].iov_base = uw->bufs + i * WRITE_BUF_SIZE;
+		iov[i].iov_len = WRITE_BUF_SIZE;
+	}
+	uw->fixed = ads1x9x_uring_register_buffers(&uw->ring, iov, depth) == 0;
+
+	ads1x9x_sink_t *s = calloc(1, sizeof(ads1x9x_sink_t));
+	s->name = "uring";
+	s->fd = fd;
+	s->priv = uw;
+	s->write = writer_write;
+	s->flush = writer_flush;
+	s->close = writer_close;
+	return s;
+}
@@ -0,0 +1,57 @@
+/**
+ * ads1x9x_uring.h - io_uring backend for the capture loop. Keeps reads
+ * in flight on the device and submits output writes asynchronously
+ * from registered buffers, reaping completions in batches.
+ *
+ * Uses the io_uring system calls directly (Linux 5.6 or later) so
+ * there is no dependency on liburing.
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#ifndef ADS1X9X_URING_H
+#define ADS1X9X_URING_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "ads1x9x_transport.h"
+#include "ads1x9x_sink.h"
+
+#define ADS1X9X_URING_MAX_DEPTH 32
+
+typedef struct {
+	int fd;
+	unsigned sq_entries;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	// SQEs prepared with ads1x9x_uring_get_sqe() but not yet submitted
+	unsigned sqe_tail;
+	unsigned to_submit;
+} ads1x9x_uring_t;
+
+int ads1x9x_uring_init (ads1x9x_uring_t *r, unsigned entries);
+void ads1x9x_uring_exit (ads1x9x_uring_t *r);
+int ads1x9x_uring_register_buffers (ads1x9x_uring_t *r, const struct iovec *iov, unsigned n);
+struct io_uring_sqe *ads1x9x_uring_get_sqe (ads1x9x_uring_t *r);
+int ads1x9x_uring_submit (ads1x9x_uring_t *r, unsigned wait_nr);
+struct io_uring_cqe *ads1x9x_uring_peek_cqe (ads1x9x_uring_t *r);
+void ads1x9x_uring_cqe_seen (ads1x9x_uring_t *r);
+
+ads1x9x_transport_t *ads1x9x_uring_transport (ads1x9x_transport_t *inner, int depth);
+ads1x9x_sink_t *ads1x9x_uring_sink (int fd, int owned, int depth);
+
+#endif
@@ -0,0 +1,681 @@
+/**
+ * ads1x9x_module.c - Python bindings to the capture library.
+ *
+ * Samples are handed to Python through the buffer protocol, so
+ * numpy.asarray() or memoryview() of a View is a window onto the memory
+ * the samples already live in: a mmapped recording, the ring buffer of a
+ * live capture, or one block decoded in C. No Python object is made per
+ * sample.
+ *
+ *   import numpy, ads1x9x
+ *   w = ads1x9x.WireFile("cap.bin")
+ *   x = numpy.asarray(w.samples)        # int16 (nframes, 14, 2), no copy
+ *   ecg = x.reshape(-1, 2)[:, 1]        # needs a copy, frames are 63 bytes
+ *
+ * Author: Joe Desbonnet, jdesbonnet@gmail.com
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_evm.h"
+#include "ads1x9x_transport.h"
+
+// Wire length of a CMD_DATA_STREAMING frame, the header ahead of its
+// payload, and offsets within the payload. Stream raw output (-f r) is
+// the payloads alone.
+#define STREAM_WIRE_LENGTH (2 + EVM_STREAM_PAYLOAD + 2)
+#define STREAM_WIRE_HEADER 2
+#define STREAM_SAMPLE_OFFSET 3
+
+// Stream samples are little endian. memoryview only handles native
+// formats, so say so explicitly only where it differs.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define STREAM_SAMPLE_FORMAT "h"
+#else
+#define STREAM_SAMPLE_FORMAT "<h"
+#endif
+
+/*
+ * View: an N dimensional array exported through the buffer protocol. It
+ * either points into memory kept alive by owner or owns a malloc'd block.
+ */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *owner;
+	void *mem;
+	char *buf;
+	const char *format;
+	Py_ssize_t itemsize;
+	int ndim;
+	Py_ssize_t shape[3];
+	Py_ssize_t strides[3];
+} ViewObject;
+
+static PyTypeObject ViewType;
+
+static PyObject *view_new (PyObject *owner, void *mem, void *buf, const char *format,
+		Py_ssize_t itemsize, int ndim, const Py_ssize_t *shape, const Py_ssize_t *strides) {
+	ViewObject *v = PyObject_New(ViewObject, &ViewType);
+	if (v == NULL) {
+		free(mem);
+		return NULL;
+	}
+	Py_XINCREF(owner);
+	v->owner = owner;
+	v->mem = mem;
+	v->buf = buf;
+	v->format = format;
+	v->itemsize = itemsize;
+	v->ndim = ndim;
+	memcpy(v->shape, shape, ndim * sizeof(Py_ssize_t));
+	memcpy(v->strides, strides, ndim * sizeof(Py_ssize_t));
+	return (PyObject *)v;
+}
+
+/**
+ * View of a malloc'd int32 block of nrows x nchannels samples.
+ */
+static PyObject *view_new_samples (int32_t *mem, Py_ssize_t nrows, int nchannels) {
+	Py_ssize_t shape[2] = {nrows, nchannels};
+	Py_ssize_t strides[2] = {nchannels * sizeof(int32_t), sizeof(int32_t)};
+	return view_new(NULL, mem, mem, "i", sizeof(int32_t), 2, shape, strides);
+}
+
+static void view_dealloc (ViewObject *v) {
+	Py_XDECREF(v->owner);
+	free(v->mem);
+	PyObject_Free(v);
+}
+
+static int view_getbuffer (ViewObject *v, Py_buffer *view, int flags) {
+	if (flags & PyBUF_WRITABLE) {
+		PyErr_SetString(PyExc_BufferError, "ads1x9x views are read-only");
+		return -1;
+	}
+	// Only the int32 blocks are contiguous; frame views are strided
+	int contiguous = v->mem != NULL;
+	if (!contiguous && (flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+		PyErr_SetString(PyExc_BufferError, "view is not contiguous");
+		return -1;
+	}
+	Py_ssize_t len = v->itemsize;
+	int i;
+	for (i = 0; i < v->ndim; i++) {
+		len *= v->shape[i];
+	}
+	view->buf = v->buf;
+	view->obj = (PyObject *)v;
+	Py_INCREF(v);
+	view->len = len;
+	view->readonly = 1;
+	view->itemsize = v->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? (char *)v->format : NULL;
+	view->ndim = v->ndim;
+	view->shape = (flags & PyBUF_ND) ? v->shape : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? v->strides : NULL;
+	view->suboffsets = NULL;
+	view->internal = NULL;
+	return 0;
+}
+
+static PyObject *view_get_shape (ViewObject *v, void *closure) {
+	PyObject *t = PyTuple_New(v->ndim);
+	int i;
+	for (i = 0; t != NULL && i < v->ndim; i++) {
+		PyTuple_SET_ITEM(t, i, PyLong_FromSsize_t(v->shape[i]));
+	}
+	return t;
+}
+
+static PyBufferProcs view_as_buffer = {
+	.bf_getbuffer = (getbufferproc)view_getbuffer,
+};
+
+static PyGetSetDef view_getset[] = {
+	{"shape", (getter)view_get_shape, NULL, "Array shape", NULL},
+	{NULL}
+};
+
+static PyTypeObject ViewType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "ads1x9x.View",
+	.tp_basicsize = sizeof(ViewObject),
+	.tp_dealloc = (destructor)view_dealloc,
+	.tp_as_buffer = &view_as_buffer,
+	.tp_getset = view_getset,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Read-only sample array, exported through the buffer protocol.",
+};
+
+/*
+ * WireFile: a recording of EVM stream output mapped into memory, either
+ * wire frames (-f w or an archive) or raw payloads (-f r). Records are a
+ * fixed 63 or 59 bytes so their samples are a strided int16 array in
+ * place.
+ */
+
+typedef struct {
+	PyObject_HEAD
+	uint8_t *map;
+	Py_ssize_t size;
+	Py_ssize_t offset;
+	Py_ssize_t nframes;
+	// Bytes per record and ahead of the payload in each
+	Py_ssize_t record;
+	Py_ssize_t header;
+	const char *format;
+} WireFileObject;
+
+static int stream_frame_ok (const uint8_t *f) {
+	return f[0] == START_DATA_HEADER && f[1] == CMD_DATA_STREAMING
+		&& f[STREAM_WIRE_LENGTH - 2] == END_DATA_HEADER
+		&& f[STREAM_WIRE_LENGTH - 1] == END_DATA_HEADER;
+}
+
+static int wirefile_init (WireFileObject *w, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"path", "format", NULL};
+	PyObject *path;
+	const char *format = NULL;
+	struct stat st;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|z", kwlist, PyUnicode_FSConverter, &path, &format)) {
+		return -1;
+	}
+	// Views of the mapping may be alive, so it cannot be replaced
+	if (w->map != NULL) {
+		Py_DECREF(path);
+		PyErr_SetString(PyExc_RuntimeError, "WireFile already open");
+		return -1;
+	}
+	if (format != NULL && strcmp(format, "wire") != 0 && strcmp(format, "raw") != 0) {
+		Py_DECREF(path);
+		PyErr_Format(PyExc_ValueError, "unknown format %s, expected \"wire\" or \"raw\"", format);
+		return -1;
+	}
+	w->record = STREAM_WIRE_LENGTH;
+	w->header = STREAM_WIRE_HEADER;
+	w->format = "wire";
+	int fd = open(PyBytes_AS_STRING(path), O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		Py_DECREF(path);
+		return -1;
+	}
+	Py_DECREF(path);
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	w->map = map;
+	w->size = st.st_size;
+
+	// Skip anything ahead of the first frame (eg command acknowledgements),
+	// then take the run of back to back frames from there
+	Py_ssize_t i = 0, n = 0;
+	if (format == NULL || strcmp(format, "wire") == 0) {
+		Py_BEGIN_ALLOW_THREADS
+		while (i + STREAM_WIRE_LENGTH <= w->size && !stream_frame_ok(map + i)) {
+			i++;
+		}
+		while (i + (n + 1) * STREAM_WIRE_LENGTH <= w->size
+				&& stream_frame_ok(map + i + n * STREAM_WIRE_LENGTH)) {
+			n++;
+		}
+		Py_END_ALLOW_THREADS
+	}
+	// Raw payloads carry no framing to check. Without a format, a file
+	// with no wire frames that is whole payloads is taken to be raw.
+	if (n == 0 && (format != NULL ? strcmp(format, "raw") == 0 : w->size % EVM_STREAM_PAYLOAD == 0)) {
+		w->record = EVM_STREAM_PAYLOAD;
+		w->header = 0;
+		w->format = "raw";
+		i = 0;
+		n = w->size / EVM_STREAM_PAYLOAD;
+	}
+	w->offset = n > 0 ? i : 0;
+	w->nframes = n;
+	return 0;
+}
+
+static void wirefile_dealloc (WireFileObject *w) {
+	if (w->map != NULL) {
+		munmap(w->map, w->size);
+	}
+	Py_TYPE(w)->tp_free((PyObject *)w);
+}
+
+static PyObject *wirefile_get_samples (WireFileObject *w, void *closure) {
+	Py_ssize_t shape[3] = {w->nframes, EVM_STREAM_ROWS, EVM_NCHANNELS};
+	Py_ssize_t strides[3] = {w->record, EVM_NCHANNELS * sizeof(int16_t), sizeof(int16_t)};
+	return view_new((PyObject *)w, NULL, w->map + w->offset + w->header + STREAM_SAMPLE_OFFSET,
+		STREAM_SAMPLE_FORMAT, sizeof(int16_t), 3, shape, strides);
+}
+
+static PyObject *wirefile_get_status (WireFileObject *w, void *closure) {
+	Py_ssize_t shape[2] = {w->nframes, 3};
+	Py_ssize_t strides[2] = {w->record, 1};
+	return view_new((PyObject *)w, NULL, w->map + w->offset + w->header,
+		"B", 1, 2, shape, strides);
+}
+
+static PyObject *wirefile_get_end (WireFileObject *w, void *closure) {
+	return PyLong_FromSsize_t(w->offset + w->nframes * w->record);
+}
+
+static PyObject *wirefile_get_format (WireFileObject *w, void *closure) {
+	return PyUnicode_FromString(w->format != NULL ? w->format : "wire");
+}
+
+static PyMemberDef wirefile_members[] = {
+	{"offset", T_PYSSIZET, offsetof(WireFileObject, offset), READONLY,
+		"Byte offset of the first frame"},
+	{"nframes", T_PYSSIZET, offsetof(WireFileObject, nframes), READONLY,
+		"Frames in the run starting at offset"},
+	{"size", T_PYSSIZET, offsetof(WireFileObject, size), READONLY,
+		"File size, bytes"},
+	{NULL}
+};
+
+static PyGetSetDef wirefile_getset[] = {
+	{"samples", (getter)wirefile_get_samples, NULL,
+		"int16 samples, shape (nframes, 14, 2), ch1 respiration then ch2 ECG", NULL},
+	{"status", (getter)wirefile_get_status, NULL,
+		"Heart rate, respiration rate and lead-off bytes, shape (nframes, 3)", NULL},
+	{"end", (getter)wirefile_get_end, NULL,
+		"Byte offset after the last frame. Less than size if the run was broken "
+		"by a resync; read_samples() decodes the whole of a wire file.", NULL},
+	{"format", (getter)wirefile_get_format, NULL,
+		"\"wire\" for 63 byte frames, \"raw\" for 59 byte payloads (-f r)", NULL},
+	{NULL}
+};
+
+static PyTypeObject WireFileType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "ads1x9x.WireFile",
+	.tp_basicsize = sizeof(WireFileObject),
+	.tp_dealloc = (destructor)wirefile_dealloc,
+	.tp_members = wirefile_members,
+	.tp_getset = wirefile_getset,
+	.tp_init = (initproc)wirefile_init,
+	.tp_new = PyType_GenericNew,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "WireFile(path, format=None)\n\n"
+		"Recording of EVM stream frames, mapped into memory. format is \"wire\"\n"
+		"(-f w or archive output), \"raw\" (-f r) or None to tell from the file:\n"
+		"wire if it holds a wire frame, else raw if it is whole 59 byte payloads.",
+};
+
+/*
+ * Capture: stream from an EVM on a thread that decodes into a ring of
+ * int32 rows. Python reads the ring in place; rows counts every row
+ * written, so row r is at ring[r % capacity] while r >= rows - capacity.
+ */
+
+typedef struct {
+	PyObject_HEAD
+	ads1x9x_transport_t *t;
+	ads1x9x_evm_parser_t parser;
+	int32_t *ring;
+	Py_ssize_t capacity;
+	uint64_t rows;
+	pthread_t thread;
+	int running;
+	int stop;
+	int error;
+} CaptureObject;
+
+static void *capture_thread (void *arg) {
+	CaptureObject *c = arg;
+	ads1x9x_evm_parser_t *p = &c->parser;
+	ads1x9x_evm_frame_t frame;
+	int32_t block[EVM_STREAM_ROWS * EVM_NCHANNELS];
+	struct pollfd pfd = {.fd = c->t->fd, .events = POLLIN};
+	int i;
+
+	while (!__atomic_load_n(&c->stop, __ATOMIC_RELAXED)) {
+		// Wait with a timeout so stop is seen when the device is idle
+		if (p->head == p->tail && pfd.fd >= 0 && poll(&pfd, 1, 100) == 0) {
+			continue;
+		}
+		if (ads1x9x_evm_read_frame(p, &frame) < 0) {
+			c->error = 1;
+			break;
+		}
+		if (frame.type != CMD_DATA_STREAMING) {
+			continue;
+		}
+		ads1x9x_evm_decode_stream(frame.data, block);
+		uint64_t r = c->rows;
+		for (i = 0; i < EVM_STREAM_ROWS; i++) {
+			int32_t *row = c->ring + ((r + i) % c->capacity) * EVM_NCHANNELS;
+			row[0] = block[i * EVM_NCHANNELS];
+			row[1] = block[i * EVM_NCHANNELS + 1];
+		}
+		__atomic_store_n(&c->rows, r + EVM_STREAM_ROWS, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static int capture_init (CaptureObject *c, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"device", "capacity", "bps", NULL};
+	const char *device;
+	Py_ssize_t capacity = EVM_STREAM_SPS * 60;
+	int bps = 9600;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|ni", kwlist, &device, &capacity, &bps)) {
+		return -1;
+	}
+	// Views of the ring may be alive, so it cannot be replaced. The ring
+	// and device are set together, only once both are ready.
+	if (c->t != NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "capture already open");
+		return -1;
+	}
+	if (capacity < EVM_STREAM_ROWS) {
+		PyErr_SetString(PyExc_ValueError, "capacity must be at least one frame of rows");
+		return -1;
+	}
+	int32_t *ring = calloc(capacity, EVM_NCHANNELS * sizeof(int32_t));
+	if (ring == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	ads1x9x_transport_t *t = ads1x9x_evm_open(device, bps);
+	if (t == NULL) {
+		free(ring);
+		PyErr_Format(PyExc_OSError, "could not open %s", device);
+		return -1;
+	}
+	c->ring = ring;
+	c->capacity = capacity;
+	c->t = t;
+	ads1x9x_evm_parser_init(&c->parser, c->t);
+	return 0;
+}
+
+static PyObject *capture_start (CaptureObject *c, PyObject *unused) {
+	if (c->t == NULL || c->running) {
+		PyErr_SetString(PyExc_RuntimeError, c->t == NULL ? "capture is closed" : "capture already running");
+		return NULL;
+	}
+	// Streaming is a toggle
+	ads1x9x_evm_write_cmd(c->t, CMD_DATA_STREAMING, 0x00, 0x00);
+	c->stop = 0;
+	c->error = 0;
+	if (pthread_create(&c->thread, NULL, capture_thread, c) != 0) {
+		ads1x9x_evm_write_cmd(c->t, CMD_DATA_STREAMING, 0x00, 0x00);
+		PyErr_SetString(PyExc_RuntimeError, "could not start capture thread");
+		return NULL;
+	}
+	c->running = 1;
+	Py_RETURN_NONE;
+}
+
+static void capture_halt (CaptureObject *c) {
+	if (!c->running) {
+		return;
+	}
+	__atomic_store_n(&c->stop, 1, __ATOMIC_RELAXED);
+	pthread_join(c->thread, NULL);
+	c->running = 0;
+	ads1x9x_evm_write_cmd(c->t, CMD_DATA_STREAMING, 0x00, 0x00);
+}
+
+static PyObject *capture_stop (CaptureObject *c, PyObject *unused) {
+	Py_BEGIN_ALLOW_THREADS
+	capture_halt(c);
+	Py_END_ALLOW_THREADS
+	if (c->error) {
+		PyErr_SetString(PyExc_OSError, "capture ended by a read error or end of data");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *capture_exit (CaptureObject *c, PyObject *args) {
+	Py_BEGIN_ALLOW_THREADS
+	capture_halt(c);
+	Py_END_ALLOW_THREADS
+	Py_RETURN_FALSE;
+}
+
+static PyObject *capture_enter (CaptureObject *c, PyObject *unused) {
+	if (!c->running && capture_start(c, NULL) == NULL) {
+		return NULL;
+	}
+	Py_INCREF(c);
+	return (PyObject *)c;
+}
+
+static void capture_dealloc (CaptureObject *c) {
+	capture_halt(c);
+	if (c->t != NULL) {
+		ads1x9x_evm_close(c->t);
+	}
+	free(c->ring);
+	Py_TYPE(c)->tp_free((PyObject *)c);
+}
+
+static PyObject *capture_get_ring (CaptureObject *c, void *closure) {
+	Py_ssize_t shape[2] = {c->capacity, EVM_NCHANNELS};
+	Py_ssize_t strides[2] = {EVM_NCHANNELS * sizeof(int32_t), sizeof(int32_t)};
+	if (c->ring == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "capture is closed");
+		return NULL;
+	}
+	return view_new((PyObject *)c, NULL, c->ring, "i", sizeof(int32_t), 2, shape, strides);
+}
+
+static PyObject *capture_get_rows (CaptureObject *c, void *closure) {
+	return PyLong_FromUnsignedLongLong(__atomic_load_n(&c->rows, __ATOMIC_ACQUIRE));
+}
+
+static PyObject *capture_get_running (CaptureObject *c, void *closure) {
+	return PyBool_FromLong(c->running && !__atomic_load_n(&c->error, __ATOMIC_RELAXED));
+}
+
+static PyMethodDef capture_methods[] = {
+	{"start", (PyCFunction)capture_start, METH_NOARGS, "Start streaming into the ring"},
+	{"stop", (PyCFunction)capture_stop, METH_NOARGS, "Stop streaming"},
+	{"__enter__", (PyCFunction)capture_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)capture_exit, METH_VARARGS, NULL},
+	{NULL}
+};
+
+static PyMemberDef capture_members[] = {
+	{"capacity", T_PYSSIZET, offsetof(CaptureObject, capacity), READONLY, "Rows in the ring"},
+	{NULL}
+};
+
+static PyGetSetDef capture_getset[] = {
+	{"ring", (getter)capture_get_ring, NULL,
+		"int32 ring of rows, shape (capacity, 2); row r is at ring[r % capacity].\n\n"
+		"The capture thread overwrites the oldest rows in place while Python\n"
+		"reads them, and writes each 14 row frame before rows counts it. For a\n"
+		"consistent read take n0 = rows, copy the rows wanted, then take\n"
+		"n1 = rows: the copy of row r is good if n1 - capacity + 14 <= r < n0.\n"
+		"Rows older than that were overwritten during the copy; read more\n"
+		"often or use a larger capacity.", NULL},
+	{"rows", (getter)capture_get_rows, NULL, "Rows written since the capture was opened", NULL},
+	{"running", (getter)capture_get_running, NULL, "True while the capture thread is reading", NULL},
+	{NULL}
+};
+
+static PyTypeObject CaptureType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "ads1x9x.Capture",
+	.tp_basicsize = sizeof(CaptureObject),
+	.tp_dealloc = (destructor)capture_dealloc,
+	.tp_methods = capture_methods,
+	.tp_members = capture_members,
+	.tp_getset = capture_getset,
+	.tp_init = (initproc)capture_init,
+	.tp_new = PyType_GenericNew,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Capture(device, capacity=30000, bps=9600)\n\n"
+		"Stream from an EVM (or \"emulator\") into a ring buffer on a C thread.",
+};
+
+/*
+ * Module functions
+ */
+
+PyDoc_STRVAR(read_samples_doc,
+"read_samples(path) -> View\n\n"
+"Decode every sample frame of an EVM recording (stream, acquire or\n"
+"download frames, resynchronising over damage) into int32 rows of\n"
+"shape (nrows, 2).");
+
+static PyObject *read_samples (PyObject *self, PyObject *args) {
+	PyObject *path;
+	ads1x9x_evm_parser_t *p;
+	ads1x9x_evm_frame_t frame;
+	ads1x9x_span_t span;
+	int32_t *mem = NULL;
+	Py_ssize_t nrows = 0, size = 0;
+	int failed = 0;
+
+	if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) {
+		return NULL;
+	}
+	ads1x9x_transport_t *t = ads1x9x_transport_open_file(PyBytes_AS_STRING(path));
+	if (t == NULL) {
+		PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+		Py_DECREF(path);
+		return NULL;
+	}
+	Py_DECREF(path);
+	p = malloc(sizeof(*p));
+	if (p == NULL) {
+		ads1x9x_transport_close(t);
+		return PyErr_NoMemory();
+	}
+	ads1x9x_evm_parser_init(p, t);
+
+	Py_BEGIN_ALLOW_THREADS
+	while (ads1x9x_evm_read_frame(p, &frame) == 0) {
+		if (ads1x9x_evm_frame_span(&frame, &span) < 0) {
+			continue;
+		}
+		if (nrows + span.nrows > size) {
+			size = size ? size * 2 : 1 << 16;
+			int32_t *m = realloc(mem, size * EVM_NCHANNELS * sizeof(int32_t));
+			if (m == NULL) {
+				failed = 1;
+				break;
+			}
+			mem = m;
+		}
+		if (span.width == 2) {
+			ads1x9x_evm_decode_stream(frame.data, mem + nrows * EVM_NCHANNELS);
+		} else {
+			ads1x9x_evm_decode_acquire(frame.data, mem + nrows * EVM_NCHANNELS);
+		}
+		nrows += span.nrows;
+	}
+	Py_END_ALLOW_THREADS
+
+	ads1x9x_transport_close(t);
+	free(p);
+	if (failed) {
+		free(mem);
+		return PyErr_NoMemory();
+	}
+	if (mem == NULL) {
+		mem = malloc(sizeof(int32_t));
+	}
+	return view_new_samples(mem, nrows, EVM_NCHANNELS);
+}
+
+PyDoc_STRVAR(decode_spi_doc,
+"decode_spi(data, device) -> View\n\n"
+"Decode back to back SPI read data frames of the named part (eg\n"
+"\"ADS1292R\") from a bytes-like object into int32 rows of shape\n"
+"(nframes, nchannels).");
+
+static PyObject *decode_spi (PyObject *self, PyObject *args) {
+	Py_buffer data;
+	const char *name;
+
+	if (!PyArg_ParseTuple(args, "y*s", &data, &name)) {
+		return NULL;
+	}
+	const ads1x9x_device_t *dev = ads1x9x_device_by_name(name);
+	if (dev == NULL) {
+		PyBuffer_Release(&data);
+		return PyErr_Format(PyExc_ValueError, "unknown device %s", name);
+	}
+	Py_ssize_t n = data.len / dev->frame_size;
+	int32_t *mem = malloc((n > 0 ? n : 1) * dev->nchannels * sizeof(int32_t));
+	if (mem == NULL) {
+		PyBuffer_Release(&data);
+		return PyErr_NoMemory();
+	}
+	Py_BEGIN_ALLOW_THREADS
+	dev->decode_n(data.buf, n, mem);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&data);
+	return view_new_samples(mem, n, dev->nchannels);
+}
+
+static PyMethodDef module_methods[] = {
+	{"read_samples", read_samples, METH_VARARGS, read_samples_doc},
+	{"decode_spi", decode_spi, METH_VARARGS, decode_spi_doc},
+	{NULL}
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "ads1x9x",
+	.m_doc = "Zero-copy access to ADS1x9x EVM and SPI captures.",
+	.m_size = -1,
+	.m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit_ads1x9x (void) {
+	PyTypeObject *types[] = {&ViewType, &WireFileType, &CaptureType};
+	const char *names[] = {"View", "WireFile", "Capture"};
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (PyType_Ready(types[i]) < 0) {
+			return NULL;
+		}
+	}
+	PyObject *m = PyModule_Create(&module);
+	if (m == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < 3; i++) {
+		Py_INCREF(types[i]);
+		if (PyModule_AddObject(m, names[i], (PyObject *)types[i]) < 0) {
+			Py_DECREF(types[i]);
+			Py_DECREF(m);
+			return NULL;
+		}
+	}
+	return m;
+}
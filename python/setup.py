@@ -0,0 +1,34 @@
+"""
+Build the ads1x9x Python extension from the capture library sources:
+
+  python3 setup.py build_ext --inplace
+
+Author: Joe Desbonnet, jdesbonnet@gmail.com
+"""
+
+import glob
+import os
+
+from setuptools import Extension, setup
+
+here = os.path.dirname(os.path.abspath(__file__))
+lib = os.path.join(here, "..", "lib")
+# setuptools wants source paths relative to setup.py
+sources = ["ads1x9x_module.c"] + sorted(
+    os.path.relpath(p, here) for p in glob.glob(os.path.join(lib, "ads1x9x*.c")))
+
+setup(
+    name="ads1x9x",
+    version="0.1",
+    description="Zero-copy access to ADS1x9x EVM and SPI captures",
+    ext_modules=[
+        Extension(
+            "ads1x9x",
+            sources=sources,
+            include_dirs=[lib],
+            extra_compile_args=["-O2", "-pthread"],
+            extra_link_args=["-pthread"],
+            libraries=["m"],
+        )
+    ],
+)
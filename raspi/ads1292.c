@@ -1,38 +1,31 @@
 /*
- * TI ADS1292(R) user space driver. 
+ * TI ADS1292(R) user space driver.
  *
  * Joe Desbonnet, jdesbonnet@gmail.com
  *
+ * To compile:
+ * gcc -O2 -pthread -I../lib -o ads1292 ads1292.c ../lib/ads1x9x_transport.c ../lib/ads1x9x_metrics.c ../lib/ads1x9x_serial.c ../lib/ads1x9x_spidev.c ../lib/ads1x9x_device.c
+ *
+ * Usage: ads1292 [spidev options] [nsamples drdy_line [gpiochip]]
+ * With nsamples and the line of the GPIO chip (default /dev/gpiochip0,
+ * where a Raspberry Pi line is its BCM number) wired to the chip's DRDY
+ * pin, reads nsamples in RDATAC mode after the register dump.
  */
 
 #include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <getopt.h>
+#include <string.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
-#include <linux/types.h>
-#include <linux/spi/spidev.h>
-
-// ADS1292 commands
-#define CMD_WAKEUP 0x02
-#define CMD_STANDBY 0x04
-#define CMD_RESET 0x06
-#define CMD_START 0x08
-#define CMD_STOP 0x0a
-#define CMD_OFFSETCAL 0x1a
-#define CMD_RDATAC 0x10
-#define CMD_SDATAC 0x11
-#define CMD_RDATA 0x12
-
-// ADS1292 registers
-#define REG_ID 0x00
-#define REG_CONFIG1 0x01
-#define REG_CONFIG2 0x02
-#define REG_LOFF 0x03
-
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#include <linux/gpio.h>
+
+#include "ads1x9x.h"
+#include "ads1x9x_transport.h"
+#include "ads1x9x_metrics.h"
+#include "ads1x9x_probes.h"
 
 static void pabort(const char *s)
 {
@@ -40,222 +33,193 @@ static void pabort(const char *s)
 	abort();
 }
 
-static const char *device = "/dev/spidev1.1";
-static uint8_t mode;
-static uint8_t bits = 8;
-static uint32_t speed = 500000;
-static uint16_t delay;
-
-
-static void ads1292_command (int fd, int cmd)
+static void ads1292_command (ads1x9x_transport_t *t, int cmd)
 {
 	uint8_t tx[] = {
-		0x10 
+		0x10
 	};
 
 	tx[0] = cmd;
 
-	uint8_t rx[ARRAY_SIZE(tx)] = {0};
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)tx,
-		.rx_buf = (unsigned long)rx,
-		.len = ARRAY_SIZE(tx),
-		.delay_usecs = delay,
-		.speed_hz = speed,
-		.bits_per_word = bits,
-	};
-
-	int ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
+	int ret = t->write(t, tx, ARRAY_SIZE(tx));
 	if (ret < 1) {
 		pabort("can't send spi message");
 	}
 
 }
 
-static int ads1292_read_register (int fd, int reg)
+static int ads1292_transfer (ads1x9x_transport_t *t, const uint8_t *tx, uint8_t *rx, int len)
+{
+	ADS1X9X_PROBE1(spi_xfer_start, len);
+	int ret = t->transfer(t, tx, rx, len);
+	ADS1X9X_PROBE1(spi_xfer_done, len);
+	return ret;
+}
+
+static int ads1292_read_register (ads1x9x_transport_t *t, int reg)
 {
 
 	reg &= 0x1f;
-	reg |= 0x20;
+	reg |= CMD_RREG;
 
 	int nreg = 0;
 
 	int ret;
 	uint8_t tx[] = {
-		0x10, 0xff,0x00,0x00 
+		0x10, 0xff, 0x00
 	};
 
 	tx[0] = reg;
 	tx[1] = nreg;
 
 	uint8_t rx[ARRAY_SIZE(tx)] = {0, 0};
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)tx,
-		.rx_buf = (unsigned long)rx,
-		.len = ARRAY_SIZE(tx),
-		.delay_usecs = delay,
-		.speed_hz = speed,
-		.bits_per_word = bits,
-	};
 
-	ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
+	ret = ads1292_transfer(t, tx, rx, ARRAY_SIZE(tx));
 	if (ret < 1) {
 		pabort("can't send spi message");
 	}
 
-	return rx[0];
+	// Register value is clocked out after the opcode and count bytes
+	return rx[2];
 }
 
+/**
+ * Request a GPIO line as an input reporting falling edges (DRDY is active
+ * low). The kernel stamps each edge with CLOCK_MONOTONIC as it happens.
+ *
+ * @return File descriptor to read edge events from.
+ */
+static int gpio_open_drdy (const char *chip, int line)
+{
+	struct gpio_v2_line_request req;
 
+	int fd = open(chip, O_RDONLY);
+	if (fd < 0) {
+		pabort("can't open gpio chip");
+	}
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = line;
+	req.num_lines = 1;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	snprintf(req.consumer, sizeof(req.consumer), "ads1292 drdy");
+	if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+		pabort("can't request gpio line");
+	}
+	close(fd);
+	return req.fd;
+}
 
-static void print_usage(const char *prog)
+/**
+ * Wait for the next DRDY edge.
+ *
+ * @return 1 with the event in ev, 0 on timeout, -1 on error.
+ */
+static int gpio_wait_edge (int fd, int timeout_ms, struct gpio_v2_line_event *ev)
 {
-	printf("Usage: %s [-DsbdlHOLC3]\n", prog);
-	puts("  -D --device   device to use (default /dev/spidev1.1)\n"
-	     "  -s --speed    max speed (Hz)\n"
-	     "  -d --delay    delay (usec)\n"
-	     "  -b --bpw      bits per word \n"
-	     "  -l --loop     loopback\n"
-	     "  -H --cpha     clock phase\n"
-	     "  -O --cpol     clock polarity\n"
-	     "  -L --lsb      least significant bit first\n"
-	     "  -C --cs-high  chip select active high\n"
-	     "  -3 --3wire    SI/SO signals shared\n");
-	exit(1);
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	int ret = poll(&pfd, 1, timeout_ms);
+	if (ret > 0 && read(fd, ev, sizeof(*ev)) != sizeof(*ev)) {
+		return -1;
+	}
+	return ret;
 }
 
-static void parse_opts(int argc, char *argv[])
+/**
+ * Read nsamples frames in RDATAC mode, one per DRDY falling edge, and
+ * print the channel values one row per sample. Latency is measured from
+ * the kernel's timestamp of the edge, so it includes the wakeup.
+ */
+static void ads1292_read_data (ads1x9x_transport_t *t, const ads1x9x_device_t *dev, int drdy_fd, int nsamples)
 {
-	while (1) {
-		static const struct option lopts[] = {
-			{ "device",  1, 0, 'D' },
-			{ "speed",   1, 0, 's' },
-			{ "delay",   1, 0, 'd' },
-			{ "bpw",     1, 0, 'b' },
-			{ "loop",    0, 0, 'l' },
-			{ "cpha",    0, 0, 'H' },
-			{ "cpol",    0, 0, 'O' },
-			{ "lsb",     0, 0, 'L' },
-			{ "cs-high", 0, 0, 'C' },
-			{ "3wire",   0, 0, '3' },
-			{ "no-cs",   0, 0, 'N' },
-			{ "ready",   0, 0, 'R' },
-			{ NULL, 0, 0, 0 },
-		};
-		int c;
-
-		c = getopt_long(argc, argv, "D:s:d:b:lHOLC3NR", lopts, NULL);
-
-		if (c == -1)
-			break;
+	uint8_t tx[ADS1X9X_MAX_FRAME_SIZE] = {0};
+	uint8_t rx[ADS1X9X_MAX_FRAME_SIZE];
+	int32_t samples[ADS1X9X_MAX_CHANNELS];
+	struct gpio_v2_line_event ev;
+	uint32_t next_seqno = 0;
+	int i, j;
+
+	// Drop edges from before conversions were started
+	while (gpio_wait_edge(drdy_fd, 0, &ev) > 0) {
+	}
+	ads1292_command(t, CMD_RDATAC);
 
-		switch (c) {
-		case 'D':
-			device = optarg;
-			break;
-		case 's':
-			speed = atoi(optarg);
-			break;
-		case 'd':
-			delay = atoi(optarg);
-			break;
-		case 'b':
-			bits = atoi(optarg);
-			break;
-		case 'l':
-			mode |= SPI_LOOP;
-			break;
-		case 'H':
-			mode |= SPI_CPHA;
-			break;
-		case 'O':
-			mode |= SPI_CPOL;
-			break;
-		case 'L':
-			mode |= SPI_LSB_FIRST;
-			break;
-		case 'C':
-			mode |= SPI_CS_HIGH;
-			break;
-		case '3':
-			mode |= SPI_3WIRE;
-			break;
-		case 'N':
-			mode |= SPI_NO_CS;
-			break;
-		case 'R':
-			mode |= SPI_READY;
-			break;
-		default:
-			print_usage(argv[0]);
+	for (i = 0; i < nsamples; i++) {
+		if (gpio_wait_edge(drdy_fd, 1000, &ev) <= 0) {
+			fprintf(stderr, "timeout waiting for DRDY\n");
 			break;
 		}
+		ADS1X9X_PROBE2(drdy, i, ev.timestamp_ns);
+		if (next_seqno != 0 && ev.line_seqno != next_seqno) {
+			fprintf(stderr, "missed %u DRDY edges before sample %d\n", ev.line_seqno - next_seqno, i);
+		}
+		next_seqno = ev.line_seqno + 1;
+
+		if (ads1292_transfer(t, tx, rx, dev->frame_size) < 1) {
+			pabort("can't send spi message");
+		}
+		ads1x9x_hist_record(&ads1x9x_metrics.drdy_to_sample, ads1x9x_now_ns() - ev.timestamp_ns);
+
+		dev->decode_n(rx, 1, samples);
+		for (j = 0; j < dev->nchannels; j++) {
+			printf("%d ", samples[j]);
+		}
+		printf("\n");
 	}
+
+	ads1292_command(t, CMD_SDATAC);
+	ads1x9x_metrics_dump(stderr);
 }
 
 int main(int argc, char *argv[])
 {
 	int ret = 0;
-	int fd;
+	spidev_opts_t opts;
+	ads1x9x_transport_t *t;
 
 	if (argc == 1) {
-		print_usage(argv[0]);
+		spidev_print_usage(argv[0]);
 		exit(0);
 	}
 
-	parse_opts(argc, argv);
-
-	fd = open(device, O_RDWR);
-	if (fd < 0)
-		pabort("can't open device");
-
-	/*
-	 * spi mode
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_MODE, &mode);
-	if (ret == -1)
-		pabort("can't set spi mode");
-
-	ret = ioctl(fd, SPI_IOC_RD_MODE, &mode);
-	if (ret == -1)
-		pabort("can't get spi mode");
-
-	/*
-	 * bits per word
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't set bits per word");
+	spidev_opts_init(&opts);
+	spidev_parse_opts(argc, argv, &opts);
 
-	ret = ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't get bits per word");
+	t = ads1x9x_transport_open_spidev(&opts);
 
-	/*
-	 * max speed hz
-	 */
-	ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't set max speed hz");
+	printf("spi mode: %d\n", opts.mode);
+	printf("bits per word: %d\n", opts.bits);
+	printf("max speed: %d Hz (%d KHz)\n", opts.speed, opts.speed/1000);
 
-	ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't get max speed hz");
 
-	printf("spi mode: %d\n", mode);
-	printf("bits per word: %d\n", bits);
-	printf("max speed: %d Hz (%d KHz)\n", speed, speed/1000);
+	ads1292_command (t,CMD_WAKEUP);
+	ads1292_command (t,CMD_START);
 
-
-	ads1292_command (fd,CMD_WAKEUP);
-	ads1292_command (fd,CMD_START);
+	const ads1x9x_device_t *dev = ads1x9x_device_by_id (ads1292_read_register (t,REG_ID));
+	if (dev != NULL) {
+		printf("device: %s, %d channels, %d byte frame\n", dev->name, dev->nchannels, dev->frame_size);
+	} else {
+		printf("device: unknown\n");
+	}
 
 	int i;
 	for (i = 0; i < 16; i++) {
-		int regVal = ads1292_read_register (fd,i);
+		int regVal = ads1292_read_register (t,i);
+		printf("reg %02x: %02x\n", i, regVal);
 	}
 
-	close(fd);
+	if (argc - optind >= 2) {
+		if (dev == NULL) {
+			fprintf(stderr, "can't read data from unknown device\n");
+		} else {
+			const char *chip = argc - optind >= 3 ? argv[optind + 2] : "/dev/gpiochip0";
+			int drdy_fd = gpio_open_drdy(chip, atoi(argv[optind + 1]));
+			ads1292_read_data(t, dev, drdy_fd, atoi(argv[optind]));
+			close(drdy_fd);
+		}
+	}
+
+	ads1x9x_transport_close(t);
 
 	return ret;
 }